@@ -20,19 +20,33 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #if USE_CLIENT
 
+typedef enum {
+    ASYNC_NORMAL,
+    ASYNC_HIGH,     // needed as soon as possible
+    ASYNC_LOW,      // runs only when nothing else is pending
+
+    ASYNC_NUM_PRIORITIES
+} asyncprio_t;
+
 typedef struct asyncwork_s {
     void (*work_cb)(void *);
     void (*done_cb)(void *);
     void *cb_arg;
+    asyncprio_t priority;
+
+    // private fields
+    unsigned queued, started, finished;
     struct asyncwork_s *next;
 } asyncwork_t;
 
+void Com_InitAsyncWork(void);
 void Com_QueueAsyncWork(asyncwork_t *work);
 void Com_CompleteAsyncWork(void);
 void Com_ShutdownAsyncWork(void);
 
 #else
 
+#define Com_InitAsyncWork()         (void)0
 #define Com_QueueAsyncWork(work)    (void)0
 #define Com_CompleteAsyncWork()     (void)0
 #define Com_ShutdownAsyncWork()     (void)0
@@ -36,6 +36,22 @@ typedef union {
     size_t  l[VIS_FAST_LONGS(VIS_MAX_BYTES)];
 } visrow_t;
 
+typedef struct viscache_s viscache_t;
+
+// SSE2 and NEON are always available on targets that have them at all
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__ARM_NEON)
+#define USE_BRUSH_SIMD  1
+#else
+#define USE_BRUSH_SIMD  0
+#endif
+
+// for SIMD brush clipping, side planes of each brush are copied into 7 arrays
+// of BRUSH_SIMD_SIDES(numsides) elements each: normal[0], normal[1],
+// normal[2], dist, and 3 masks with all bits set for signbits bits set.
+// padding planes have zero normal and positive dist, and never clip.
+#define BRUSH_SIMD_WIDTH    4
+#define BRUSH_SIMD_SIDES(n) Q_ALIGN(n, BRUSH_SIMD_WIDTH)
+
 #if USE_CLIENT
 
 enum {
@@ -149,6 +165,9 @@ typedef struct {
     int                 numsides;
     mbrushside_t        *firstbrushside;
     unsigned            checkcount;         // to avoid repeated testings
+#if USE_BRUSH_SIMD
+    float               *sideplanes;        // SIMD copy of side planes
+#endif
 } mbrush_t;
 
 typedef struct {
@@ -270,6 +289,9 @@ typedef struct {
     int             numvisibility;
     int             visrowsize;
     dvis_t          *vis;
+    byte            *vismatrix;     // decompressed PVS and PHS rows
+    int             vispatch;       // vismatrix has PVS patches applied
+    viscache_t      *viscache;      // LRU row cache if matrix is too big, main thread only
 
     int             numentitychars;
     char            *entitystring;
@@ -334,6 +356,7 @@ void BSP_TransformedLightPoint(lightpoint_t *point, const vec3_t start, const ve
 const lightgrid_sample_t *BSP_LookupLightgrid(const lightgrid_t *grid, const uint32_t point[3]);
 #endif
 
+const visrow_t *BSP_GetClusterVis(const bsp_t *bsp, visrow_t *temp, int cluster, int vis);
 void BSP_ClusterVis(const bsp_t *bsp, visrow_t *mask, int cluster, int vis);
 const mleaf_t *BSP_PointLeaf(const mnode_t *node, const vec3_t p);
 const mmodel_t *BSP_InlineModel(const bsp_t *bsp, const char *name);
@@ -99,6 +99,10 @@ static inline const mleaf_t *CM_PointLeaf(const cm_t *cm, const vec3_t p)
     return BSP_PointLeaf(cm->cache->nodes, p);
 }
 
+#define MAX_FAT_CLUSTERS    64
+
+int         CM_FatClusters(const cm_t *cm, int *clusters, const vec3_t org);
+void        CM_ClustersVis(const cm_t *cm, visrow_t *mask, const int *clusters, int count);
 void        CM_FatPVS(const cm_t *cm, visrow_t *mask, const vec3_t org);
 
 void        CM_SetAreaPortalState(const cm_t *cm, int portalnum, bool open);
@@ -20,6 +20,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 uint16_t CRC_Block(const byte *start, size_t count);
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 byte COM_BlockSequenceCRCByte(const byte *base, size_t length, int sequence);
 #endif
@@ -79,6 +79,7 @@ void Cvar_WriteVariables(qhandle_t f, int mask, bool modified);
 size_t Cvar_BitInfo(char *info, int bit);
 
 cvar_t *Cvar_FindVar(const char *var_name);
+cvar_t *Cvar_FindVarHash(const char *var_name, unsigned hash);
 xgenerator_t Cvar_FindGenerator(const char *var_name);
 bool Cvar_Exists(const char *name, bool weak);
 
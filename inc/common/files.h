@@ -35,7 +35,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define FS_Mallocz(size)        Z_TagMallocz(size, TAG_FILESYSTEM)
 #define FS_CopyString(string)   Z_TagCopyString(string, TAG_FILESYSTEM)
 #define FS_LoadFile(path, buf)  FS_LoadFileEx(path, buf, 0, TAG_FILESYSTEM)
-#define FS_FreeFile(buf)        Z_Free(buf)
+
+// for read-only binary data, see FS_FLAG_MAPPED
+#define FS_LoadFileMapped(path, buf) \
+    FS_LoadFileEx(path, buf, FS_FLAG_MAPPED, TAG_FILESYSTEM)
 
 // just regular malloc for now
 #define FS_AllocTempMem(size)   FS_Malloc(size)
@@ -52,6 +55,7 @@ void    FS_Init(void);
 void    FS_Shutdown(void);
 void    FS_Restart(bool total);
 void    FS_AddConfigFiles(bool init);
+void    FS_FlushCache(void);
 
 #if USE_CLIENT
 int FS_RenameFile(const char *from, const char *to);
@@ -72,6 +76,7 @@ qhandle_t FS_EasyOpenFile(char *buf, size_t size, unsigned mode,
 int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag);
 // a NULL buffer will just return the file length without loading
 // length < 0 indicates error
+void FS_FreeFile(void *buf);
 
 int FS_WriteFile(const char *path, const void *data, size_t len);
 
@@ -92,6 +97,7 @@ int64_t FS_Tell(qhandle_t f);
 int FS_Seek(qhandle_t f, int64_t offset, int whence);
 
 int64_t FS_Length(qhandle_t f);
+int FS_GetFileInfo(const char *path, file_info_t *info);
 
 bool FS_WildCmp(const char *filter, const char *string);
 bool FS_ExtCmp(const char *extension, const char *string);
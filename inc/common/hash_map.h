@@ -28,6 +28,10 @@ hash_map_t *HashMap_CreateImpl(const uint32_t key_size, const uint32_t value_siz
                                uint32_t (*hasher)(const void *const),
                                bool (*comp)(const void *const, const void *const),
                                memtag_t tag);
+hash_map_t *HashMap_CreateFlatImpl(const uint32_t key_size, const uint32_t value_size,
+                                   uint32_t (*hasher)(const void *const),
+                                   bool (*comp)(const void *const, const void *const),
+                                   memtag_t tag);
 void     HashMap_Destroy(hash_map_t *map);
 void     HashMap_Reserve(hash_map_t *map, uint32_t capacity);
 bool     HashMap_InsertImpl(hash_map_t *map, const uint32_t key_size, const uint32_t value_size, const void *const key, const void *const value);
@@ -40,6 +44,10 @@ void    *HashMap_GetValueImpl(const hash_map_t *map, uint32_t index);
 #define HashMap_TagCreate(key_type, value_type, hasher, comp, tag) \
     HashMap_CreateImpl(sizeof(key_type), sizeof(value_type), hasher, comp, tag)
 #define HashMap_Create(key_type, value_type, hasher, comp) HashMap_TagCreate(key_type, value_type, hasher, comp, TAG_GENERAL)
+// Open addressing variant, faster for lookup heavy maps. Same API otherwise.
+#define HashMap_TagCreateFlat(key_type, value_type, hasher, comp, tag) \
+    HashMap_CreateFlatImpl(sizeof(key_type), sizeof(value_type), hasher, comp, tag)
+#define HashMap_CreateFlat(key_type, value_type, hasher, comp) HashMap_TagCreateFlat(key_type, value_type, hasher, comp, TAG_GENERAL)
 #define HashMap_Insert(map, key, value)                    HashMap_InsertImpl(map, sizeof(*key), sizeof(*value), key, value)
 #define HashMap_Erase(map, key)                            HashMap_EraseImpl(map, sizeof(*key), key)
 #define HashMap_Lookup(type, map, key)                     ((type *)HashMap_LookupImpl(map, sizeof(*key), key))
@@ -100,7 +100,7 @@ typedef enum {
     MSG_ES_REMOVE       = BIT(9),   // entity is removed (MVD stream only)
 } msgEsFlags_t;
 
-extern sizebuf_t    msg_write;
+extern q_thread_local sizebuf_t msg_write;
 extern byte         msg_write_buffer[MAX_MSGLEN];
 
 extern sizebuf_t    msg_read;
@@ -122,7 +122,7 @@ void    MSG_WriteString(const char *s);
 void    MSG_WritePos(const vec3_t pos, bool extended);
 void    MSG_WriteIntPos(const int32_t pos[3], bool extended);
 void    MSG_WriteAngle(float f);
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 void    MSG_FlushBits(void);
 void    MSG_WriteBits(int value, int bits);
 int     MSG_WriteDeltaUsercmd(const usercmd_t *from, const usercmd_t *cmd, int version);
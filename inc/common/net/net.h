@@ -65,6 +65,11 @@ typedef enum {
     NS_COUNT
 } netsrc_t;
 
+#if USE_LOADGEN
+// extra client sockets numbered from NS_COUNT, one per simulated client
+#define NS_MAX_LOADGEN  256
+#endif
+
 typedef enum {
     NET_NONE    = 0,
     NET_CLIENT  = BIT(0),
@@ -194,6 +199,19 @@ void        NET_GetPackets(netsrc_t sock, void (*packet_cb)(void));
 bool        NET_SendPacket(netsrc_t sock, const void *data,
                            size_t len, const netadr_t *to);
 
+#if USE_LOADGEN
+int         NET_OpenLoadgenSocket(netadrtype_t type);
+void        NET_CloseLoadgenSocket(netsrc_t sock);
+#endif
+
+#if USE_MMSG
+void        NET_BeginPacketBatch(void);
+void        NET_FlushPacketBatch(void);
+#else
+#define     NET_BeginPacketBatch()  (void)0
+#define     NET_FlushPacketBatch()  (void)0
+#endif
+
 const char  *NET_AdrToString(const netadr_t *a);
 bool        NET_StringToAdr(const char *s, netadr_t *a, int default_port);
 bool        NET_StringPairToAdr(const char *host, const char *port, netadr_t *a);
@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2026 Q2PRO contributors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "system/system.h"
+
+//
+// tracing.c -- timeline of engine events in Chrome trace format
+//
+
+extern bool     com_tracing;
+
+// returns start time for Com_TraceEnd, or 0 if not tracing
+static inline uint64_t Com_TraceTime(void)
+{
+    return q_unlikely(com_tracing) ? Sys_Microseconds() : 0;
+}
+
+// `name' must be a string literal, `arg' is copied and may be NULL
+void Com_TraceEvent(uint64_t start, uint64_t end, const char *name, const char *arg);
+void Com_TraceEnd(uint64_t start, const char *name, const char *arg);
+
+// records event only if it took longer than trace_threshold
+void Com_TraceEndSlow(uint64_t start, const char *name);
+
+// names timeline of the calling thread
+void Com_TraceThreadName(const char *name);
+
+// lets threads started later reuse buffer of the calling thread
+void Com_TraceThreadExit(void);
+
+void Com_InitTracing(void);
+void Com_ShutdownTracing(void);
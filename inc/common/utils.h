@@ -58,6 +58,7 @@ float Com_GetEntityLoopDistMult(float attenuation);
 
 bool Com_ParseMapName(char *out, const char *in, size_t size);
 
+unsigned Com_HashStringFull(const char *s);
 unsigned Com_HashString(const char *s, unsigned size);
 unsigned Com_HashStringLen(const char *s, size_t len, unsigned size);
 
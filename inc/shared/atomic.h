@@ -19,9 +19,28 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #ifdef _MSC_VER
+#include <intrin.h>
 typedef volatile int atomic_int;
+typedef void *volatile atomic_ptr;
 #define atomic_load(p)      (*(p))
 #define atomic_store(p, v)  (*(p) = (v))
+#define atomic_fetch_add(p, v) \
+    _InterlockedExchangeAdd((volatile long *)(p), v)
+#define atomic_ptr_exchange(p, v) \
+    _InterlockedExchangePointer((void *volatile *)(p), v)
+static inline bool atomic_ptr_compare_exchange(atomic_ptr *p, void **expected, void *desired)
+{
+    void *prev = _InterlockedCompareExchangePointer((void *volatile *)p, desired, *expected);
+    if (prev == *expected)
+        return true;
+    *expected = prev;
+    return false;
+}
 #else
 #include <stdatomic.h>
+typedef _Atomic(void *) atomic_ptr;
+#define atomic_ptr_exchange(p, v) \
+    atomic_exchange(p, v)
+#define atomic_ptr_compare_exchange(p, expected, desired) \
+    atomic_compare_exchange_weak(p, expected, desired)
 #endif
@@ -66,6 +66,7 @@ typedef struct {
 #define FS_FLAG_TEXT            0x00000400  // open in text mode if from disk
 #define FS_FLAG_DEFLATE         0x00000800  // if compressed, read raw deflate data, fail otherwise
 #define FS_FLAG_LOADFILE        0x00001000  // open non-unique handle, must be closed very quickly
+#define FS_FLAG_MAPPED          0x00002000  // LoadFile may return read-only pointer into mapped pack, not NUL terminated
 #define FS_FLAG_MASK            0x0000ff00
 
 // where to look for a file (basedir vs homedir)
@@ -118,6 +118,21 @@ typedef struct {
     const char  *(*ErrorString)(int error);
 } filesystem_api_v1_t;
 
+#define PARALLEL_API_V1 "PARALLEL_API_V1"
+
+typedef struct {
+    // number of threads RunParallel() uses, including the calling one
+    int         (*NumThreads)(void);
+    // calls func(arg, index) for each index in [0, count) concurrently and
+    // returns when all calls are done. func may only call clip() against the
+    // world entity, nothing else from game imports is thread safe.
+    void        (*RunParallel)(void (*func)(void *arg, int index), void *arg, int count);
+    // clips trace returned by clip() against the world entity to other solid
+    // entities, giving the same result as trace()
+    void        (*ClipToEntities)(trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs,
+                                  const vec3_t end, edict_t *passedict, int contentmask);
+} parallel_api_v1_t;
+
 #define DEBUG_DRAW_API_V1 "DEBUG_DRAW_API_V1"
 
 typedef struct {
@@ -777,6 +777,7 @@ typedef struct cvar_s {
     xchanged_t      changed;
     xgenerator_t    generator;
     struct cvar_s   *hashNext;
+    unsigned        hash;
 #endif
 #endif
 } cvar_t;
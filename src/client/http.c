@@ -858,6 +858,7 @@ fail2:
                 Com_EPrintf("[HTTP] Failed to rename '%s' to '%s': %s\n",
                             dl->path, dl->queue->path, strerror(errno));
             dl->path[0] = 0;
+            FS_FlushCache();
 
             //a pak file is very special...
             if (dl->queue->type == DL_PAK) {
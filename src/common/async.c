@@ -17,62 +17,166 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "shared/shared.h"
+#include "shared/atomic.h"
 #include "common/async.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/tracing.h"
 #include "common/zone.h"
 #include "system/pthread.h"
+#include "system/system.h"
+
+#define MAX_ASYNC_WORKERS   16
+
+typedef struct {
+    asyncwork_t *head;
+    asyncwork_t **tail;
+    int         depth;
+} workqueue_t;
+
+static cvar_t *com_async_threads;
 
 static bool work_initialized;
 static bool work_terminate;
 static pthread_mutex_t work_lock;
 static pthread_cond_t work_cond;
-static pthread_t work_thread;
-static asyncwork_t *pend_head;
-static asyncwork_t *done_head;
+static pthread_t work_threads[MAX_ASYNC_WORKERS];
+static int work_numthreads;
+static workqueue_t work_queues[ASYNC_NUM_PRIORITIES];
+
+// completed work is pushed here by worker threads without locking,
+// and the whole list is taken at once by the main thread
+static atomic_ptr done_head;
+
+// order in which queues are serviced
+static const asyncprio_t work_order[ASYNC_NUM_PRIORITIES] = {
+    ASYNC_HIGH, ASYNC_NORMAL, ASYNC_LOW
+};
+
+static int work_peak_depth;     // protected by work_lock
+
+// accessed by main thread only
+static struct {
+    uint64_t    completed;
+    uint64_t    total_wait, total_run, total_done;
+    unsigned    max_wait, max_run, max_done;
+} work_stats;
+
+static asyncwork_t *dequeue_work(void)
+{
+    workqueue_t *q;
+    asyncwork_t *work;
+    int i;
+
+    for (i = 0; i < ASYNC_NUM_PRIORITIES; i++) {
+        q = &work_queues[work_order[i]];
+        work = q->head;
+        if (work) {
+            q->head = work->next;
+            if (!q->head)
+                q->tail = &q->head;
+            q->depth--;
+            return work;
+        }
+    }
 
-static void append_work(asyncwork_t **head, asyncwork_t *work)
+    return NULL;
+}
+
+static void complete_work(asyncwork_t *work)
 {
-    asyncwork_t *c, **p;
-    for (p = head, c = *head; c; p = &c->next, c = c->next)
-        ;
-    work->next = NULL;
-    *p = work;
+    void *head = atomic_load(&done_head);
+
+    do {
+        work->next = head;
+    } while (!atomic_ptr_compare_exchange(&done_head, &head, work));
 }
 
 static void *work_func(void *arg)
 {
+    asyncwork_t *work;
+    uint64_t time;
+
+    Com_TraceThreadName("async worker");
+
     pthread_mutex_lock(&work_lock);
     while (1) {
-        while (!pend_head && !work_terminate)
+        while (!(work = dequeue_work()) && !work_terminate)
             pthread_cond_wait(&work_cond, &work_lock);
 
-        asyncwork_t *work = pend_head;
         if (!work)
             break;
-        pend_head = work->next;
 
         pthread_mutex_unlock(&work_lock);
+        work->started = Sys_Milliseconds();
+        time = Com_TraceTime();
         work->work_cb(work->cb_arg);
+        Com_TraceEnd(time, "async work", NULL);
+        work->finished = Sys_Milliseconds();
+        complete_work(work);
         pthread_mutex_lock(&work_lock);
-
-        append_work(&done_head, work);
     }
     pthread_mutex_unlock(&work_lock);
 
+    Com_TraceThreadExit();
     return NULL;
 }
 
-void Com_QueueAsyncWork(asyncwork_t *work)
+static void start_workers(void)
 {
-    if (!work_initialized) {
-        pthread_mutex_init(&work_lock, NULL);
-        pthread_cond_init(&work_cond, NULL);
-        if (pthread_create(&work_thread, NULL, work_func, NULL))
-            Com_Error(ERR_FATAL, "Couldn't create async work thread");
-        work_initialized = true;
+    int i, count = Cvar_ClampInteger(com_async_threads, 0, MAX_ASYNC_WORKERS);
+
+    if (!count)
+        count = Q_clip(Sys_NumCPUs() - 1, 1, MAX_ASYNC_WORKERS);
+
+    pthread_mutex_init(&work_lock, NULL);
+    pthread_cond_init(&work_cond, NULL);
+
+    for (i = 0; i < ASYNC_NUM_PRIORITIES; i++) {
+        work_queues[i].head = NULL;
+        work_queues[i].tail = &work_queues[i].head;
+        work_queues[i].depth = 0;
     }
 
+    work_terminate = false;
+    for (i = 0; i < count; i++)
+        if (pthread_create(&work_threads[i], NULL, work_func, NULL))
+            break;
+
+    if (!i)
+        Com_Error(ERR_FATAL, "Couldn't create async work thread");
+    if (i < count)
+        Com_WPrintf("Created only %d of %d async work threads\n", i, count);
+
+    work_numthreads = i;
+    work_initialized = true;
+}
+
+void Com_QueueAsyncWork(asyncwork_t *work)
+{
+    workqueue_t *q;
+    asyncwork_t *copy;
+    int i, depth;
+
+    Q_assert(work->priority >= 0 && work->priority < ASYNC_NUM_PRIORITIES);
+
+    if (!work_initialized)
+        start_workers();
+
+    copy = Z_CopyStruct(work);
+    copy->queued = Sys_Milliseconds();
+    copy->next = NULL;
+
     pthread_mutex_lock(&work_lock);
-    append_work(&pend_head, Z_CopyStruct(work));
+    q = &work_queues[copy->priority];
+    *q->tail = copy;
+    q->tail = &copy->next;
+    q->depth++;
+
+    for (i = depth = 0; i < ASYNC_NUM_PRIORITIES; i++)
+        depth += work_queues[i].depth;
+    work_peak_depth = max(work_peak_depth, depth);
     pthread_mutex_unlock(&work_lock);
 
     pthread_cond_signal(&work_cond);
@@ -80,26 +184,51 @@ void Com_QueueAsyncWork(asyncwork_t *work)
 
 void Com_CompleteAsyncWork(void)
 {
-    asyncwork_t *work, *next;
+    asyncwork_t *work, *next, *list;
+    unsigned now, wait, run, done;
 
     if (!work_initialized)
         return;
-    if (pthread_mutex_trylock(&work_lock))
+
+    work = atomic_ptr_exchange(&done_head, NULL);
+    if (q_likely(!work))
         return;
-    if (q_unlikely(done_head)) {
-        for (work = done_head; work; work = next) {
-            next = work->next;
-            if (work->done_cb)
-                work->done_cb(work->cb_arg);
-            Z_Free(work);
+
+    // reverse into completion order
+    for (list = NULL; work; work = next) {
+        next = work->next;
+        work->next = list;
+        list = work;
+    }
+
+    now = Sys_Milliseconds();
+    for (work = list; work; work = next) {
+        next = work->next;
+
+        wait = work->started - work->queued;
+        run = work->finished - work->started;
+        done = now - work->queued;
+        work_stats.completed++;
+        work_stats.total_wait += wait;
+        work_stats.total_run += run;
+        work_stats.total_done += done;
+        work_stats.max_wait = max(work_stats.max_wait, wait);
+        work_stats.max_run = max(work_stats.max_run, run);
+        work_stats.max_done = max(work_stats.max_done, done);
+
+        if (work->done_cb) {
+            uint64_t time = Com_TraceTime();
+            work->done_cb(work->cb_arg);
+            Com_TraceEnd(time, "async done", NULL);
         }
-        done_head = NULL;
+        Z_Free(work);
     }
-    pthread_mutex_unlock(&work_lock);
 }
 
 void Com_ShutdownAsyncWork(void)
 {
+    int i;
+
     if (!work_initialized)
         return;
 
@@ -107,12 +236,61 @@ void Com_ShutdownAsyncWork(void)
     work_terminate = true;
     pthread_mutex_unlock(&work_lock);
 
-    pthread_cond_signal(&work_cond);
+    pthread_cond_broadcast(&work_cond);
 
-    Q_assert(!pthread_join(work_thread, NULL));
+    for (i = 0; i < work_numthreads; i++)
+        Q_assert(!pthread_join(work_threads[i], NULL));
     Com_CompleteAsyncWork();
 
     pthread_mutex_destroy(&work_lock);
     pthread_cond_destroy(&work_cond);
+    work_numthreads = 0;
     work_initialized = false;
 }
+
+static void Com_AsyncStats_f(void)
+{
+    static const char names[ASYNC_NUM_PRIORITIES][8] = { "normal", "high", "low" };
+    int i, depth[ASYNC_NUM_PRIORITIES] = { 0 }, peak = 0;
+    uint64_t n = work_stats.completed;
+
+    if (Cmd_Argc() > 1) {
+        if (work_initialized)
+            pthread_mutex_lock(&work_lock);
+        work_peak_depth = 0;
+        if (work_initialized)
+            pthread_mutex_unlock(&work_lock);
+        memset(&work_stats, 0, sizeof(work_stats));
+        return;
+    }
+
+    if (work_initialized) {
+        pthread_mutex_lock(&work_lock);
+        for (i = 0; i < ASYNC_NUM_PRIORITIES; i++)
+            depth[i] = work_queues[i].depth;
+        peak = work_peak_depth;
+        pthread_mutex_unlock(&work_lock);
+    }
+
+    Com_Printf("Async work: %d thread%s\n", work_numthreads, work_numthreads == 1 ? "" : "s");
+    Com_Printf("Queue depth:");
+    for (i = 0; i < ASYNC_NUM_PRIORITIES; i++)
+        Com_Printf(" %s %d,", names[work_order[i]], depth[work_order[i]]);
+    Com_Printf(" peak %d\n", peak);
+    Com_Printf("Completed: %"PRIu64"\n", n);
+    if (!n)
+        return;
+
+    Com_Printf("Latency (msec)   avg   max\n"
+               "--------------- ----- -----\n");
+    Com_Printf("Queued          %5.1f %5u\n", (double)work_stats.total_wait / n, work_stats.max_wait);
+    Com_Printf("Running         %5.1f %5u\n", (double)work_stats.total_run / n, work_stats.max_run);
+    Com_Printf("Until done      %5.1f %5u\n", (double)work_stats.total_done / n, work_stats.max_done);
+}
+
+void Com_InitAsyncWork(void)
+{
+    com_async_threads = Cvar_Get("com_async_threads", "0", 0);
+
+    Cmd_AddCommand("asyncstats", Com_AsyncStats_f);
+}
@@ -30,12 +30,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/math.h"
 #include "common/mdfour.h"
 #include "common/sizebuf.h"
+#include "common/tracing.h"
 #include "common/utils.h"
 #include "system/hunk.h"
+#include "system/system.h"
 
 extern mtexinfo_t nulltexinfo;
 
 static cvar_t *map_visibility_patch;
+static cvar_t *map_visibility_matrix;
 
 /*
 ===============================================================================
@@ -62,6 +65,272 @@ static cvar_t *map_visibility_patch;
 #define BSP_EXTENDED 1
 #include "bsp_template.c"
 
+/*
+===============================================================================
+
+                    VISIBILITY
+
+Maps with up to map_visibility_matrix clusters have all PVS and PHS rows
+decompressed at load time, and rows are handed out by pointer. Larger maps
+keep a small LRU cache of recently decompressed rows instead.
+
+===============================================================================
+*/
+
+// rows are padded so that they can be accessed as size_t or SIMD vectors
+#define VIS_ROW_ALIGN   16
+
+#define VIS_CACHE_ROWS  256
+
+typedef struct {
+    list_t      entry;
+    int         key;        // cluster * 2 + vis, -1 if unused
+    byte        *row;
+} visslot_t;
+
+struct viscache_s {
+    list_t      lru;
+    int         patch;      // map_visibility_patch value rows were made with
+    uint16_t    *index;     // slot number + 1 for each key, 0 if not cached
+    visslot_t   slots[VIS_CACHE_ROWS];
+};
+
+static visrow_t         vis_all;    // filled in BSP_Init
+static const visrow_t   vis_none;
+
+static void BSP_DecompressVis(const bsp_t *bsp, byte *out, int cluster, int vis, bool patch)
+{
+    const byte  *in, *in_end;
+    byte        *out_end;
+    int         c;
+
+    in_end = (const byte *)bsp->vis + bsp->numvisibility;
+    in = (const byte *)bsp->vis + bsp->vis->bitofs[cluster][vis];
+    out_end = out + bsp->visrowsize;
+    do {
+        if (in >= in_end) {
+            goto overrun;
+        }
+        if (*in) {
+            *out++ = *in++;
+            continue;
+        }
+
+        if (in + 1 >= in_end) {
+            goto overrun;
+        }
+        c = in[1];
+        in += 2;
+        if (c > out_end - out) {
+overrun:
+            c = out_end - out;
+        }
+        while (c--) {
+            *out++ = 0;
+        }
+    } while (out < out_end);
+
+    out -= bsp->visrowsize;
+
+    // apply our ugly PVS patches
+    if (patch) {
+        if (bsp->checksum == 0x1e5b50c5) {
+            // q2dm3, pent bridge
+            if (cluster == 345 || cluster == 384) {
+                Q_SetBit(out, 466);
+                Q_SetBit(out, 484);
+                Q_SetBit(out, 692);
+            }
+        } else if (bsp->checksum == 0x04cfa792) {
+            // q2dm1, above lower RL
+            if (cluster == 395) {
+                Q_SetBit(out, 176);
+                Q_SetBit(out, 183);
+            }
+        } else if (bsp->checksum == 0x2c3ab9b0) {
+            // q2dm8, CG/RG area
+            if (cluster == 629 || cluster == 631 ||
+                cluster == 633 || cluster == 639) {
+                Q_SetBit(out, 908);
+                Q_SetBit(out, 909);
+                Q_SetBit(out, 910);
+                Q_SetBit(out, 915);
+                Q_SetBit(out, 923);
+                Q_SetBit(out, 924);
+                Q_SetBit(out, 927);
+                Q_SetBit(out, 930);
+                Q_SetBit(out, 938);
+                Q_SetBit(out, 939);
+                Q_SetBit(out, 947);
+            }
+        } else if (bsp->checksum == 0x1ebe8001) {
+            // mgu6m2, waterfall
+            Q_SetBit(out, 213);
+            Q_SetBit(out, 214);
+            Q_SetBit(out, 217);
+        }
+    }
+}
+
+static size_t BSP_VisStride(const bsp_t *bsp)
+{
+    return Q_ALIGN(bsp->visrowsize, VIS_ROW_ALIGN);
+}
+
+// returns hunk space needed for the matrix, given raw visibility lump
+static size_t BSP_VisMatrixSize(const byte *in, uint32_t count)
+{
+    uint32_t numclusters;
+
+    if (count < 4)
+        return 0;
+
+    numclusters = RL32(in);
+    if (numclusters > MAX_MAP_CLUSTERS || (int)numclusters > map_visibility_matrix->integer)
+        return 0;
+
+    return Q_ALIGN(numclusters * 2 * Q_ALIGN((numclusters + 7) >> 3, VIS_ROW_ALIGN), BSP_ALIGN);
+}
+
+static void BSP_BuildVisMatrix(bsp_t *bsp)
+{
+    int i, j, numclusters = bsp->vis->numclusters;
+    size_t stride = BSP_VisStride(bsp);
+
+    bsp->vispatch = map_visibility_patch->integer;
+    bsp->vismatrix = BSP_ALLOC(numclusters * 2 * stride);
+
+    for (i = 0; i < numclusters; i++)
+        for (j = 0; j < 2; j++)
+            BSP_DecompressVis(bsp, bsp->vismatrix + (i * 2 + j) * stride, i, j, bsp->vispatch);
+}
+
+static void BSP_InitVisCache(bsp_t *bsp)
+{
+    viscache_t *cache;
+    size_t stride = BSP_VisStride(bsp);
+    byte *rows;
+    int i;
+
+    cache = Z_Mallocz(sizeof(*cache));
+    cache->index = Z_Mallocz(sizeof(cache->index[0]) * bsp->vis->numclusters * 2);
+    rows = Z_Malloc(stride * VIS_CACHE_ROWS);
+
+    List_Init(&cache->lru);
+    for (i = 0; i < VIS_CACHE_ROWS; i++) {
+        cache->slots[i].key = -1;
+        cache->slots[i].row = rows + i * stride;
+        List_Append(&cache->lru, &cache->slots[i].entry);
+    }
+    cache->patch = map_visibility_patch->integer;
+
+    bsp->viscache = cache;
+}
+
+static void BSP_FreeVisCache(bsp_t *bsp)
+{
+    viscache_t *cache = bsp->viscache;
+
+    if (cache) {
+        Z_Free(cache->slots[0].row);
+        Z_Free(cache->index);
+        Z_Free(cache);
+        bsp->viscache = NULL;
+    }
+}
+
+// LRU is updated on every lookup, so this is main thread only
+static const byte *BSP_CachedVis(viscache_t *cache, const bsp_t *bsp, int cluster, int vis)
+{
+    int key = cluster * 2 + vis;
+    visslot_t *slot;
+    int i;
+
+    Q_assert(Sys_IsMainThread());
+
+    // flush everything if patching was toggled
+    if (cache->patch != map_visibility_patch->integer) {
+        cache->patch = map_visibility_patch->integer;
+        memset(cache->index, 0, sizeof(cache->index[0]) * bsp->vis->numclusters * 2);
+        for (i = 0; i < VIS_CACHE_ROWS; i++)
+            cache->slots[i].key = -1;
+    }
+
+    if (cache->index[key]) {
+        slot = &cache->slots[cache->index[key] - 1];
+    } else {
+        // evict least recently used row
+        slot = LIST_FIRST(visslot_t, &cache->lru, entry);
+        if (slot->key != -1)
+            cache->index[slot->key] = 0;
+        slot->key = key;
+        cache->index[key] = slot - cache->slots + 1;
+        BSP_DecompressVis(bsp, slot->row, cluster, vis, cache->patch);
+    }
+
+    List_Remove(&slot->entry);
+    List_Append(&cache->lru, &slot->entry);
+
+    return slot->row;
+}
+
+/*
+==================
+BSP_GetClusterVis
+
+Returns pointer to visibility row for the cluster. This is either a shared
+row that must not be modified, or `temp' filled with decompressed data.
+Only first visrowsize bytes (rounded up to size_t) are valid.
+Must be called from main thread on maps that use vis row cache.
+==================
+*/
+const visrow_t *BSP_GetClusterVis(const bsp_t *bsp, visrow_t *temp, int cluster, int vis)
+{
+    Q_assert(vis == DVIS_PVS || vis == DVIS_PHS);
+
+    if (!bsp || !bsp->vis) {
+        return &vis_all;
+    }
+    if (cluster == -1) {
+        return &vis_none;
+    }
+    if (cluster < 0 || cluster >= bsp->vis->numclusters) {
+        Com_Error(ERR_DROP, "%s: bad cluster", __func__);
+    }
+
+    if (bsp->vismatrix && bsp->vispatch == map_visibility_patch->integer) {
+        return (const visrow_t *)(bsp->vismatrix + (cluster * 2 + vis) * BSP_VisStride(bsp));
+    }
+
+    if (bsp->viscache) {
+        memcpy(temp, BSP_CachedVis(bsp->viscache, bsp, cluster, vis), BSP_VisStride(bsp));
+        return temp;
+    }
+
+    BSP_DecompressVis(bsp, temp->b, cluster, vis, map_visibility_patch->integer);
+    return temp;
+}
+
+/*
+==================
+BSP_ClusterVis
+
+Same as BSP_GetClusterVis, but always copies the row into `mask'.
+==================
+*/
+void BSP_ClusterVis(const bsp_t *bsp, visrow_t *mask, int cluster, int vis)
+{
+    const visrow_t *row = BSP_GetClusterVis(bsp, mask, cluster, vis);
+
+    if (row == mask)
+        return;
+
+    if (bsp && bsp->vis)
+        memcpy(mask, row, VIS_FAST_LONGS(bsp->visrowsize) * sizeof(size_t));
+    else
+        memcpy(mask, row, sizeof(*mask));
+}
+
 /*
 ===============================================================================
 
@@ -155,8 +424,13 @@ static void BSP_PrintStats(const bsp_t *bsp)
     for (int i = 0; i < q_countof(bsp_stats); i++)
         Com_Printf("%8d : %s\n", *(int *)((byte *)bsp + bsp_stats[i].ofs), bsp_stats[i].name);
 
-    if (bsp->vis)
+    if (bsp->vis) {
         Com_Printf("%8u : clusters\n", bsp->vis->numclusters);
+        if (bsp->vismatrix)
+            Com_Printf("%8zu : vis matrix bytes\n", bsp->vis->numclusters * 2 * BSP_VisStride(bsp));
+        else if (bsp->viscache)
+            Com_Printf("%8d : vis cache rows\n", VIS_CACHE_ROWS);
+    }
 
 #if USE_REF
     const lightgrid_t *grid = &bsp->lightgrid;
@@ -332,6 +606,7 @@ void BSP_Free(bsp_t *bsp)
     }
     Q_assert(bsp->refcount > 0);
     if (--bsp->refcount == 0) {
+        BSP_FreeVisCache(bsp);
         Hunk_Free(&bsp->hunk);
         List_Remove(&bsp->entry);
         Z_Free(bsp);
@@ -739,14 +1014,66 @@ static void BSP_MergeLeafContents(bsp_t *bsp)
             leaf->contents[1] |= leaf->firstleafbrush[j]->contents;
 }
 
-/*
-==================
-BSP_Load
+#if USE_BRUSH_SIMD
 
-Loads in the map and all submodels
-==================
-*/
-int BSP_Load(const char *name, bsp_t **bsp_p)
+// upper bound of SIMD brush planes size, before brushes are loaded
+static size_t BSP_BrushPlanesSize(uint32_t numbrushes, uint32_t numsides)
+{
+    uint64_t count = numsides + (uint64_t)numbrushes * (BRUSH_SIMD_WIDTH - 1);
+
+    Q_assert(count <= INT_MAX / (7 * sizeof(float)));
+    return Q_ALIGN(count * 7 * sizeof(float), BSP_ALIGN);
+}
+
+static void BSP_BuildBrushPlanes(bsp_t *bsp)
+{
+    union {
+        float       f;
+        uint32_t    u;
+    } mask;
+    const cplane_t *plane;
+    mbrush_t *brush;
+    float *out;
+    int i, j, k, n, total;
+
+    // take all space reserved by BSP_BrushPlanesSize(). brushes of malformed
+    // maps may share sides, those that don't fit keep using scalar code.
+    total = bsp->numbrushsides + bsp->numbrushes * (BRUSH_SIMD_WIDTH - 1);
+    out = BSP_ALLOC(sizeof(*out) * total * 7);
+
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++) {
+        n = BRUSH_SIMD_SIDES(brush->numsides);
+        if (!n || n > total) {
+            brush->sideplanes = NULL;
+            continue;
+        }
+        brush->sideplanes = out;
+        total -= n;
+
+        for (j = 0; j < n; j++) {
+            if (j >= brush->numsides) {
+                out[0 * n + j] = out[1 * n + j] = out[2 * n + j] = 0;
+                out[3 * n + j] = 1;
+                out[4 * n + j] = out[5 * n + j] = out[6 * n + j] = 0;
+                continue;
+            }
+
+            plane = brush->firstbrushside[j].plane;
+            for (k = 0; k < 3; k++) {
+                out[k * n + j] = plane->normal[k];
+                mask.u = (plane->signbits >> k & 1) ? ~0U : 0;
+                out[(4 + k) * n + j] = mask.f;
+            }
+            out[3 * n + j] = plane->dist;
+        }
+
+        out += n * 7;
+    }
+}
+
+#endif
+
+static int BSP_LoadFile(const char *name, bsp_t **bsp_p)
 {
     bsp_t           *bsp;
     byte            *buf;
@@ -777,7 +1104,7 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
     //
     // load the file
     //
-    filelen = FS_LoadFile(name, (void **)&buf);
+    filelen = FS_LoadFileMapped(name, (void **)&buf);
     if (!buf) {
         return filelen;
     }
@@ -841,6 +1168,14 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
         maxpos = max(maxpos, ofs + len);
     }
 
+    // reserve space for decompressed visibility (lump 0 is Visibility)
+    memsize += BSP_VisMatrixSize(buf + lump_ofs[0], lump_count[0]);
+
+#if USE_BRUSH_SIMD
+    // reserve space for SIMD brush planes (lumps 3 and 4 are BrushSides and Brushes)
+    memsize += BSP_BrushPlanesSize(lump_count[4], lump_count[3]);
+#endif
+
     // load into hunk
     len = strlen(name);
     bsp = Z_Mallocz(sizeof(*bsp) + len);
@@ -887,6 +1222,17 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
 
     BSP_MergeLeafContents(bsp);
 
+#if USE_BRUSH_SIMD
+    BSP_BuildBrushPlanes(bsp);
+#endif
+
+    if (bsp->vis && bsp->vis->numclusters) {
+        if ((int)bsp->vis->numclusters <= map_visibility_matrix->integer)
+            BSP_BuildVisMatrix(bsp);
+        else
+            BSP_InitVisCache(bsp);
+    }
+
     Hunk_End(&bsp->hunk);
 
     List_Append(&bsp_cache, &bsp->entry);
@@ -904,6 +1250,22 @@ fail2:
     return ret;
 }
 
+/*
+==================
+BSP_Load
+
+Loads in the map and all submodels
+==================
+*/
+int BSP_Load(const char *name, bsp_t **bsp_p)
+{
+    uint64_t time = Com_TraceTime();
+    int ret = BSP_LoadFile(name, bsp_p);
+
+    Com_TraceEnd(time, "BSP_Load", name);
+    return ret;
+}
+
 const char *BSP_ErrorString(int err)
 {
     switch (err) {
@@ -1036,94 +1398,6 @@ void BSP_TransformedLightPoint(lightpoint_t *point, const vec3_t start, const ve
 
 #endif
 
-void BSP_ClusterVis(const bsp_t *bsp, visrow_t *mask, int cluster, int vis)
-{
-    const byte  *in, *in_end;
-    byte        *out, *out_end;
-    int         c;
-
-    Q_assert(vis == DVIS_PVS || vis == DVIS_PHS);
-
-    if (!bsp || !bsp->vis) {
-        memset(mask, 0xff, sizeof(*mask));
-        return;
-    }
-    if (cluster == -1) {
-        memset(mask, 0, bsp->visrowsize);
-        return;
-    }
-    if (cluster < 0 || cluster >= bsp->vis->numclusters) {
-        Com_Error(ERR_DROP, "%s: bad cluster", __func__);
-    }
-
-    // decompress vis
-    in_end = (const byte *)bsp->vis + bsp->numvisibility;
-    in = (const byte *)bsp->vis + bsp->vis->bitofs[cluster][vis];
-    out_end = mask->b + bsp->visrowsize;
-    out = mask->b;
-    do {
-        if (in >= in_end) {
-            goto overrun;
-        }
-        if (*in) {
-            *out++ = *in++;
-            continue;
-        }
-
-        if (in + 1 >= in_end) {
-            goto overrun;
-        }
-        c = in[1];
-        in += 2;
-        if (c > out_end - out) {
-overrun:
-            c = out_end - out;
-        }
-        while (c--) {
-            *out++ = 0;
-        }
-    } while (out < out_end);
-
-    // apply our ugly PVS patches
-    if (map_visibility_patch->integer) {
-        if (bsp->checksum == 0x1e5b50c5) {
-            // q2dm3, pent bridge
-            if (cluster == 345 || cluster == 384) {
-                Q_SetBit(mask, 466);
-                Q_SetBit(mask, 484);
-                Q_SetBit(mask, 692);
-            }
-        } else if (bsp->checksum == 0x04cfa792) {
-            // q2dm1, above lower RL
-            if (cluster == 395) {
-                Q_SetBit(mask, 176);
-                Q_SetBit(mask, 183);
-            }
-        } else if (bsp->checksum == 0x2c3ab9b0) {
-            // q2dm8, CG/RG area
-            if (cluster == 629 || cluster == 631 ||
-                cluster == 633 || cluster == 639) {
-                Q_SetBit(mask, 908);
-                Q_SetBit(mask, 909);
-                Q_SetBit(mask, 910);
-                Q_SetBit(mask, 915);
-                Q_SetBit(mask, 923);
-                Q_SetBit(mask, 924);
-                Q_SetBit(mask, 927);
-                Q_SetBit(mask, 930);
-                Q_SetBit(mask, 938);
-                Q_SetBit(mask, 939);
-                Q_SetBit(mask, 947);
-            }
-        } else if (bsp->checksum == 0x1ebe8001) {
-            // mgu6m2, waterfall
-            Q_SetBit(mask, 213);
-            Q_SetBit(mask, 214);
-            Q_SetBit(mask, 217);
-        }
-    }
-}
-
 const mleaf_t *BSP_PointLeaf(const mnode_t *node, const vec3_t p)
 {
     float d;
@@ -1160,6 +1434,9 @@ const mmodel_t *BSP_InlineModel(const bsp_t *bsp, const char *name)
 void BSP_Init(void)
 {
     map_visibility_patch = Cvar_Get("map_visibility_patch", "1", 0);
+    map_visibility_matrix = Cvar_Get("map_visibility_matrix", "4096", 0);
+
+    memset(&vis_all, 0xff, sizeof(vis_all));
 
     Cmd_AddCommand("bsplist", BSP_List_f);
 
@@ -221,36 +221,59 @@ void Cbuf_Clear(cmdbuf_t *buf)
 ==============================================================================
 */
 
-#define ALIAS_HASH_SIZE    64
+#define ALIAS_HASH_SIZE    64     // initial size, grows with number of aliases
 
 #define FOR_EACH_ALIAS_HASH(alias, hash) \
-    LIST_FOR_EACH(cmdalias_t, alias, &cmd_aliasHash[hash], hashEntry)
+    LIST_FOR_EACH(cmdalias_t, alias, &cmd_aliasHash[(hash) & (cmd_aliasHashSize - 1)], hashEntry)
 #define FOR_EACH_ALIAS(alias) \
     LIST_FOR_EACH(cmdalias_t, alias, &cmd_alias, listEntry)
 
 typedef struct {
     list_t  hashEntry;
     list_t  listEntry;
+    unsigned hash;
     char    *value;
     char    name[1];
 } cmdalias_t;
 
 static list_t   cmd_alias;
-static list_t   cmd_aliasHash[ALIAS_HASH_SIZE];
+static list_t   *cmd_aliasHash;
+static unsigned cmd_aliasHashSize;
+static unsigned cmd_aliasCount;
+
+static void Cmd_FlushCache(void);
+
+/*
+============
+Cmd_AllocHash
+
+Allocates empty hash table of `size' list heads.
+============
+*/
+static list_t *Cmd_AllocHash(list_t *hash, unsigned size)
+{
+    unsigned i;
+
+    Z_Free(hash);
+    hash = Cmd_Malloc(size * sizeof(hash[0]));
+    for (i = 0; i < size; i++) {
+        List_Init(&hash[i]);
+    }
+
+    return hash;
+}
 
 /*
 ===============
-Cmd_AliasFind
+Cmd_AliasFindHash
 ===============
 */
-static cmdalias_t *Cmd_AliasFind(const char *name)
+static cmdalias_t *Cmd_AliasFindHash(const char *name, unsigned hash)
 {
-    unsigned hash;
     cmdalias_t *alias;
 
-    hash = Com_HashString(name, ALIAS_HASH_SIZE);
     FOR_EACH_ALIAS_HASH(alias, hash) {
-        if (!strcmp(name, alias->name)) {
+        if (alias->hash == hash && !strcmp(name, alias->name)) {
             return alias;
         }
     }
@@ -258,6 +281,48 @@ static cmdalias_t *Cmd_AliasFind(const char *name)
     return NULL;
 }
 
+/*
+===============
+Cmd_AliasFind
+===============
+*/
+static cmdalias_t *Cmd_AliasFind(const char *name)
+{
+    return Cmd_AliasFindHash(name, Com_HashStringFull(name));
+}
+
+static void Cmd_LinkAlias(cmdalias_t *alias)
+{
+    cmdalias_t *a;
+
+    if (cmd_aliasCount >= cmd_aliasHashSize) {
+        cmd_aliasHashSize *= 2;
+        cmd_aliasHash = Cmd_AllocHash(cmd_aliasHash, cmd_aliasHashSize);
+        FOR_EACH_ALIAS(a) {
+            List_Append(&cmd_aliasHash[a->hash & (cmd_aliasHashSize - 1)], &a->hashEntry);
+        }
+    }
+
+    List_Append(&cmd_alias, &alias->listEntry);
+    List_Append(&cmd_aliasHash[alias->hash & (cmd_aliasHashSize - 1)], &alias->hashEntry);
+    cmd_aliasCount++;
+
+    // new alias may shadow cached cvar
+    Cmd_FlushCache();
+}
+
+static void Cmd_UnlinkAlias(cmdalias_t *alias)
+{
+    List_Remove(&alias->listEntry);
+    List_Remove(&alias->hashEntry);
+    cmd_aliasCount--;
+
+    Cmd_FlushCache();
+
+    Z_Free(alias->value);
+    Z_Free(alias);
+}
+
 char *Cmd_AliasCommand(const char *name)
 {
     cmdalias_t *a;
@@ -277,7 +342,8 @@ void Cmd_AliasSet(const char *name, const char *cmd)
     size_t      len;
 
     // if the alias already exists, reuse it
-    a = Cmd_AliasFind(name);
+    hash = Com_HashStringFull(name);
+    a = Cmd_AliasFindHash(name, hash);
     if (a) {
         Z_Free(a->value);
         a->value = Cmd_CopyString(cmd);
@@ -287,12 +353,10 @@ void Cmd_AliasSet(const char *name, const char *cmd)
     len = strlen(name);
     a = Cmd_Malloc(sizeof(*a) + len);
     memcpy(a->name, name, len + 1);
+    a->hash = hash;
     a->value = Cmd_CopyString(cmd);
 
-    List_Append(&cmd_alias, &a->listEntry);
-
-    hash = Com_HashString(name, ALIAS_HASH_SIZE);
-    List_Append(&cmd_aliasHash[hash], &a->hashEntry);
+    Cmd_LinkAlias(a);
 }
 
 void Cmd_Alias_g(genctx_t *ctx)
@@ -363,7 +427,6 @@ static void Cmd_UnAlias_f(void)
     };
     char *s;
     cmdalias_t *a, *n;
-    unsigned hash;
     int c;
 
     while ((c = Cmd_ParseOptions(options)) != -1) {
@@ -374,13 +437,8 @@ static void Cmd_UnAlias_f(void)
             return;
         case 'a':
             LIST_FOR_EACH_SAFE(cmdalias_t, a, n, &cmd_alias, listEntry) {
-                Z_Free(a->value);
-                Z_Free(a);
+                Cmd_UnlinkAlias(a);
             }
-            for (hash = 0; hash < ALIAS_HASH_SIZE; hash++) {
-                List_Init(&cmd_aliasHash[hash]);
-            }
-            List_Init(&cmd_alias);
             Com_Printf("Removed all alias commands.\n");
             return;
         default:
@@ -401,11 +459,7 @@ static void Cmd_UnAlias_f(void)
         return;
     }
 
-    List_Remove(&a->listEntry);
-    List_Remove(&a->hashEntry);
-
-    Z_Free(a->value);
-    Z_Free(a);
+    Cmd_UnlinkAlias(a);
 }
 
 #if USE_CLIENT
@@ -778,10 +832,10 @@ void Cmd_AddMacro(const char *name, xmacro_t function)
 =============================================================================
 */
 
-#define CMD_HASH_SIZE    128
+#define CMD_HASH_SIZE    128    // initial size, grows with number of commands
 
 #define FOR_EACH_CMD_HASH(cmd, hash) \
-    LIST_FOR_EACH(cmd_function_t, cmd, &cmd_hash[hash], hashEntry)
+    LIST_FOR_EACH(cmd_function_t, cmd, &cmd_hash[(hash) & (cmd_hashSize - 1)], hashEntry)
 #define FOR_EACH_CMD(cmd) \
     LIST_FOR_EACH(cmd_function_t, cmd, &cmd_functions, listEntry)
 
@@ -791,11 +845,28 @@ typedef struct {
 
     xcommand_t      function;
     xcompleter_t    completer;
+    unsigned        hash;
     char            *name;
 } cmd_function_t;
 
 static list_t   cmd_functions;      // possible commands to execute
-static list_t   cmd_hash[CMD_HASH_SIZE];
+static list_t   *cmd_hash;
+static unsigned cmd_hashSize;
+static unsigned cmd_count;
+
+// first tokens of recently executed lines resolved to command, alias or
+// cvar. entry is valid if full hash and name match. flushed when commands
+// or aliases are added or removed, cvars are never removed.
+#define CMD_CACHE_SIZE  64
+
+typedef struct {
+    unsigned        hash;
+    cmd_function_t  *cmd;
+    cmdalias_t      *alias;
+    cvar_t          *var;
+} cmd_cache_t;
+
+static cmd_cache_t  cmd_cache[CMD_CACHE_SIZE];
 
 static int      cmd_argc;
 static char     *cmd_argv[MAX_STRING_TOKENS]; // pointers to cmd_data[]
@@ -1409,14 +1480,12 @@ end:
 Cmd_Find
 ============
 */
-static cmd_function_t *Cmd_Find(const char *name)
+static cmd_function_t *Cmd_FindHash(const char *name, unsigned hash)
 {
     cmd_function_t *cmd;
-    unsigned hash;
 
-    hash = Com_HashString(name, CMD_HASH_SIZE);
     FOR_EACH_CMD_HASH(cmd, hash) {
-        if (!strcmp(cmd->name, name)) {
+        if (cmd->hash == hash && !strcmp(cmd->name, name)) {
             return cmd;
         }
     }
@@ -1424,23 +1493,39 @@ static cmd_function_t *Cmd_Find(const char *name)
     return NULL;
 }
 
+static cmd_function_t *Cmd_Find(const char *name)
+{
+    return Cmd_FindHash(name, Com_HashStringFull(name));
+}
+
 static void Cmd_LinkCommand(cmd_function_t *cmd)
 {
     cmd_function_t *cur;
-    unsigned hash;
+
+    if (cmd_count >= cmd_hashSize) {
+        cmd_hashSize *= 2;
+        cmd_hash = Cmd_AllocHash(cmd_hash, cmd_hashSize);
+        FOR_EACH_CMD(cur) {
+            List_Append(&cmd_hash[cur->hash & (cmd_hashSize - 1)], &cur->hashEntry);
+        }
+    }
 
     FOR_EACH_CMD(cur)
         if (strcmp(cmd->name, cur->name) < 0)
             break;
     List_Append(&cur->listEntry, &cmd->listEntry);
 
-    hash = Com_HashString(cmd->name, CMD_HASH_SIZE);
-    List_Append(&cmd_hash[hash], &cmd->hashEntry);
+    List_Append(&cmd_hash[cmd->hash & (cmd_hashSize - 1)], &cmd->hashEntry);
+    cmd_count++;
+
+    // new command may shadow cached alias or cvar
+    Cmd_FlushCache();
 }
 
 static void Cmd_RegCommand(const cmdreg_t *reg)
 {
     cmd_function_t *cmd;
+    unsigned hash;
 
 // fail if the command is a variable name
     if (Cvar_Exists(reg->name, false)) {
@@ -1449,7 +1534,8 @@ static void Cmd_RegCommand(const cmdreg_t *reg)
     }
 
 // fail if the command already exists
-    cmd = Cmd_Find(reg->name);
+    hash = Com_HashStringFull(reg->name);
+    cmd = Cmd_FindHash(reg->name, hash);
     if (cmd) {
         if (cmd->function) {
             Com_WPrintf("%s: %s already defined\n", __func__, reg->name);
@@ -1464,6 +1550,7 @@ static void Cmd_RegCommand(const cmdreg_t *reg)
     cmd->name = (char *)reg->name;
     cmd->function = reg->function;
     cmd->completer = reg->completer;
+    cmd->hash = hash;
 
     Cmd_LinkCommand(cmd);
 }
@@ -1508,6 +1595,10 @@ void Cmd_RemoveCommand(const char *name)
 
     List_Remove(&cmd->listEntry);
     List_Remove(&cmd->hashEntry);
+    cmd_count--;
+
+    Cmd_FlushCache();
+
     Z_Free(cmd);
 }
 
@@ -1546,11 +1637,53 @@ void Cmd_Command_g(genctx_t *ctx)
     }
 }
 
+static void Cmd_FlushCache(void)
+{
+    memset(cmd_cache, 0, sizeof(cmd_cache));
+}
+
+/*
+============
+Cmd_Resolve
+
+Finds command, alias or cvar named by the first token, in this order.
+============
+*/
+static cmd_cache_t *Cmd_Resolve(const char *name)
+{
+    unsigned hash = Com_HashStringFull(name);
+    cmd_cache_t *c = &cmd_cache[hash & (CMD_CACHE_SIZE - 1)];
+
+    if (c->hash == hash) {
+        if (c->cmd && !strcmp(c->cmd->name, name))
+            return c;
+        if (c->alias && !strcmp(c->alias->name, name))
+            return c;
+        if (c->var && !strcmp(c->var->name, name))
+            return c;
+    }
+
+    c->hash = hash;
+    c->alias = NULL;
+    c->var = NULL;
+    if ((c->cmd = Cmd_FindHash(name, hash)))
+        return c;
+    if ((c->alias = Cmd_AliasFindHash(name, hash)))
+        return c;
+    if ((c->var = Cvar_FindVarHash(name, hash)))
+        return c;
+
+    // don't cache unknown commands, cvar may be created later
+    c->hash = 0;
+    return c;
+}
+
 void Cmd_ExecuteCommand(cmdbuf_t *buf)
 {
     cmd_function_t  *cmd;
     cmdalias_t      *a;
     cvar_t          *v;
+    cmd_cache_t     *c;
     char            *text;
 
     // execute the command line
@@ -1560,8 +1693,10 @@ void Cmd_ExecuteCommand(cmdbuf_t *buf)
 
     cmd_current = buf;
 
+    c = Cmd_Resolve(cmd_argv[0]);
+
     // check functions
-    cmd = Cmd_Find(cmd_argv[0]);
+    cmd = c->cmd;
     if (cmd) {
         if (cmd->function) {
             cmd->function();
@@ -1572,7 +1707,7 @@ void Cmd_ExecuteCommand(cmdbuf_t *buf)
     }
 
     // check aliases
-    a = Cmd_AliasFind(cmd_argv[0]);
+    a = c->alias;
     if (a) {
         if (buf->aliasCount >= ALIAS_LOOP_COUNT) {
             Com_WPrintf("Runaway alias loop\n");
@@ -1587,7 +1722,7 @@ void Cmd_ExecuteCommand(cmdbuf_t *buf)
     }
 
     // check variables
-    v = Cvar_FindVar(cmd_argv[0]);
+    v = c->var;
     if (v) {
         Cvar_Command(v);
         return;
@@ -1962,17 +2097,13 @@ Cmd_Init
 */
 void Cmd_Init(void)
 {
-    int i;
-
     List_Init(&cmd_functions);
-    for (i = 0; i < CMD_HASH_SIZE; i++) {
-        List_Init(&cmd_hash[i]);
-    }
+    cmd_hashSize = CMD_HASH_SIZE;
+    cmd_hash = Cmd_AllocHash(NULL, cmd_hashSize);
 
     List_Init(&cmd_alias);
-    for (i = 0; i < ALIAS_HASH_SIZE; i++) {
-        List_Init(&cmd_aliasHash[i]);
-    }
+    cmd_aliasHashSize = ALIAS_HASH_SIZE;
+    cmd_aliasHash = Cmd_AllocHash(NULL, cmd_aliasHashSize);
 
     List_Init(&cmd_triggers);
 
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // cmodel.c -- model loading
 
 #include "shared/shared.h"
+#include "shared/atomic.h"
 #include "common/bsp.h"
 #include "common/cmd.h"
 #include "common/cmodel.h"
@@ -27,18 +28,30 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/files.h"
 #include "common/math.h"
 #include "common/sizebuf.h"
+#include "common/tracing.h"
 #include "common/zone.h"
 #include "system/hunk.h"
 
+#if USE_BRUSH_SIMD
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#else
+#include <emmintrin.h>
+#endif
+#endif
+
 mtexinfo_t nulltexinfo;
 
 const mleaf_t       nullleaf = { .cluster = -1 };
 
 static unsigned     floodvalid;
-static unsigned     checkcount;
+static atomic_int   checkcount;         // unique value for each trace
 
 static cvar_t       *map_noareas;
 static cvar_t       *map_override_path;
+#if USE_BRUSH_SIMD
+static cvar_t       *map_brush_simd;
+#endif
 
 static void    FloodAreaConnections(const cm_t *cm);
 
@@ -353,34 +366,37 @@ const mnode_t *CM_HeadnodeForBox(const vec3_t mins, const vec3_t maxs)
 =============
 CM_BoxLeafnums
 
-Fills in a list of all the leafs touched
+Fills in a list of all the leafs touched.
+State is kept on stack, this is called from server worker threads.
 =============
 */
-static int              leaf_count, leaf_maxcount;
-static const mleaf_t    **leaf_list;
-static const vec_t      *leaf_mins, *leaf_maxs;
-static const mnode_t    *leaf_topnode;
-
-static void CM_BoxLeafs_r(const mnode_t *node)
+typedef struct {
+    int             count, maxcount;
+    const mleaf_t   **list;
+    const vec_t     *mins, *maxs;
+    const mnode_t   *topnode;
+} boxleafs_t;
+
+static void CM_BoxLeafs_r(boxleafs_t *bl, const mnode_t *node)
 {
     while (node->plane) {
-        box_plane_t s = BoxOnPlaneSideFast(leaf_mins, leaf_maxs, node->plane);
+        box_plane_t s = BoxOnPlaneSideFast(bl->mins, bl->maxs, node->plane);
         if (s == BOX_INFRONT) {
             node = node->children[0];
         } else if (s == BOX_BEHIND) {
             node = node->children[1];
         } else {
             // go down both
-            if (!leaf_topnode) {
-                leaf_topnode = node;
+            if (!bl->topnode) {
+                bl->topnode = node;
             }
-            CM_BoxLeafs_r(node->children[0]);
+            CM_BoxLeafs_r(bl, node->children[0]);
             node = node->children[1];
         }
     }
 
-    if (leaf_count < leaf_maxcount) {
-        leaf_list[leaf_count++] = (const mleaf_t *)node;
+    if (bl->count < bl->maxcount) {
+        bl->list[bl->count++] = (const mleaf_t *)node;
     }
 }
 
@@ -388,20 +404,19 @@ int CM_BoxLeafs_headnode(const vec3_t mins, const vec3_t maxs,
                          const mleaf_t **list, int listsize,
                          const mnode_t *headnode, const mnode_t **topnode)
 {
-    leaf_list = list;
-    leaf_count = 0;
-    leaf_maxcount = listsize;
-    leaf_mins = mins;
-    leaf_maxs = maxs;
+    boxleafs_t bl = {
+        .maxcount = listsize,
+        .list = list,
+        .mins = mins,
+        .maxs = maxs,
+    };
 
-    leaf_topnode = NULL;
-
-    CM_BoxLeafs_r(headnode);
+    CM_BoxLeafs_r(&bl, headnode);
 
     if (topnode)
-        *topnode = leaf_topnode;
+        *topnode = bl.topnode;
 
-    return leaf_count;
+    return bl.count;
 }
 
 /*
@@ -445,14 +460,96 @@ BOX TRACING
 // 1/32 epsilon to keep floating point happy
 #define DIST_EPSILON    0.03125f
 
-static vec3_t   trace_start, trace_end;
-static vec3_t   trace_offsets[8];
-static vec3_t   trace_extents;
+// world traces may be run concurrently by server worker threads, so trace
+// state is thread local. brush checkcount is shared, but values are unique
+// per trace, so concurrent traces can at worst clip some brush twice.
+static q_thread_local vec3_t    trace_start, trace_end;
+static q_thread_local vec3_t    trace_offsets[8];
+static q_thread_local vec3_t    trace_extents;
+
+static q_thread_local trace_t   *trace_trace;
+static q_thread_local unsigned  trace_checkcount;
+static q_thread_local int       trace_contents;
+static q_thread_local bool      trace_ispoint;      // optimized case
+static q_thread_local bool      trace_extended;     // remaster fixes
+
+#if USE_BRUSH_SIMD
+
+static q_thread_local bool      trace_simd;
+
+// brushes with more sides use scalar code
+#define MAX_SIMD_SIDES  64
+
+#ifdef __ARM_NEON
+typedef float32x4_t simd_t;
+#define simd_load(p)            vld1q_f32(p)
+#define simd_store(p, a)        vst1q_f32(p, a)
+#define simd_set1(x)            vdupq_n_f32(x)
+#define simd_add(a, b)          vaddq_f32(a, b)
+#define simd_sub(a, b)          vsubq_f32(a, b)
+#define simd_mul(a, b)          vmulq_f32(a, b)
+#define simd_select(m, a, b)    vbslq_f32(vreinterpretq_u32_f32(m), a, b)
+#else
+typedef __m128 simd_t;
+#define simd_load(p)            _mm_load_ps(p)
+#define simd_store(p, a)        _mm_storeu_ps(p, a)
+#define simd_set1(x)            _mm_set1_ps(x)
+#define simd_add(a, b)          _mm_add_ps(a, b)
+#define simd_sub(a, b)          _mm_sub_ps(a, b)
+#define simd_mul(a, b)          _mm_mul_ps(a, b)
+#define simd_select(m, a, b)    _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#endif
 
-static trace_t  *trace_trace;
-static int      trace_contents;
-static bool     trace_ispoint;      // optimized case
-static bool     trace_extended;     // remaster fixes
+/*
+================
+CM_SideDistances
+
+Computes distances from p1 (and p2, if not NULL) to all brush sides,
+BRUSH_SIMD_WIDTH sides at a time. Order of floating point operations is the
+same as in scalar code, so results are bit-identical.
+================
+*/
+static void CM_SideDistances(const mbrush_t *brush, const vec3_t p1, const vec3_t p2,
+                             float *d1, float *d2, bool ispoint)
+{
+    int n = BRUSH_SIMD_SIDES(brush->numsides);
+    const float *in = brush->sideplanes;
+    simd_t mins[3], maxs[3], a[3], b[3];
+    simd_t nx, ny, nz, dist, ox, oy, oz;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        mins[i] = simd_set1(trace_offsets[0][i]);
+        maxs[i] = simd_set1(trace_offsets[7][i]);
+        a[i] = simd_set1(p1[i]);
+        if (p2)
+            b[i] = simd_set1(p2[i]);
+    }
+
+    for (i = 0; i < n; i += BRUSH_SIMD_WIDTH, in += BRUSH_SIMD_WIDTH) {
+        nx = simd_load(in + 0 * n);
+        ny = simd_load(in + 1 * n);
+        nz = simd_load(in + 2 * n);
+        dist = simd_load(in + 3 * n);
+
+        if (!ispoint) {
+            // push the plane out appropriately for mins/maxs
+            ox = simd_select(simd_load(in + 4 * n), maxs[0], mins[0]);
+            oy = simd_select(simd_load(in + 5 * n), maxs[1], mins[1]);
+            oz = simd_select(simd_load(in + 6 * n), maxs[2], mins[2]);
+            dist = simd_sub(dist, simd_add(simd_add(simd_mul(ox, nx), simd_mul(oy, ny)), simd_mul(oz, nz)));
+        }
+
+        simd_store(d1 + i, simd_sub(simd_add(simd_add(simd_mul(a[0], nx), simd_mul(a[1], ny)), simd_mul(a[2], nz)), dist));
+        if (p2)
+            simd_store(d2 + i, simd_sub(simd_add(simd_add(simd_mul(b[0], nx), simd_mul(b[1], ny)), simd_mul(b[2], nz)), dist));
+    }
+}
+
+#define USE_SIMD(brush) \
+    (trace_simd && (brush)->sideplanes && (brush)->numsides <= MAX_SIMD_SIDES)
+
+#endif // USE_BRUSH_SIMD
 
 /*
 ================
@@ -469,10 +566,20 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
     bool        getout, startout;
     float       f;
     const mbrushside_t  *side, *leadside;
+#if USE_BRUSH_SIMD
+    float       dist1[MAX_SIMD_SIDES], dist2[MAX_SIMD_SIDES];
+    bool        simd;
+#endif
 
     if (!brush->numsides)
         return;
 
+#if USE_BRUSH_SIMD
+    simd = USE_SIMD(brush);
+    if (simd)
+        CM_SideDistances(brush, p1, p2, dist1, dist2, trace_ispoint);
+#endif
+
     enterfrac = -1;
     leavefrac = 1;
     clipplane = NULL;
@@ -485,19 +592,27 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
     for (i = 0; i < brush->numsides; i++, side++) {
         plane = side->plane;
 
-        // FIXME: special case for axial
-        if (!trace_ispoint) {
-            // general box case
-            // push the plane out appropriately for mins/maxs
-            dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
-            dist = plane->dist - dist;
-        } else {
-            // special point case
-            dist = plane->dist;
-        }
+#if USE_BRUSH_SIMD
+        if (simd) {
+            d1 = dist1[i];
+            d2 = dist2[i];
+        } else
+#endif
+        {
+            // FIXME: special case for axial
+            if (!trace_ispoint) {
+                // general box case
+                // push the plane out appropriately for mins/maxs
+                dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
+                dist = plane->dist - dist;
+            } else {
+                // special point case
+                dist = plane->dist;
+            }
 
-        d1 = DotProduct(p1, plane->normal) - dist;
-        d2 = DotProduct(p2, plane->normal) - dist;
+            d1 = DotProduct(p1, plane->normal) - dist;
+            d2 = DotProduct(p2, plane->normal) - dist;
+        }
 
         if (d2 > 0)
             getout = true; // endpoint is not in solid
@@ -567,21 +682,38 @@ static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, const mbrush_t *b
     float       dist;
     float       d1;
     const mbrushside_t  *side;
+#if USE_BRUSH_SIMD
+    float       dist1[MAX_SIMD_SIDES];
+    bool        simd;
+#endif
 
     if (!brush->numsides)
         return;
 
+#if USE_BRUSH_SIMD
+    simd = USE_SIMD(brush);
+    if (simd)
+        CM_SideDistances(brush, p1, NULL, dist1, NULL, false);
+#endif
+
     side = brush->firstbrushside;
     for (i = 0; i < brush->numsides; i++, side++) {
         plane = side->plane;
 
-        // FIXME: special case for axial
-        // general box case
-        // push the plane out appropriately for mins/maxs
-        dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
-        dist = plane->dist - dist;
+#if USE_BRUSH_SIMD
+        if (simd) {
+            d1 = dist1[i];
+        } else
+#endif
+        {
+            // FIXME: special case for axial
+            // general box case
+            // push the plane out appropriately for mins/maxs
+            dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
+            dist = plane->dist - dist;
 
-        d1 = DotProduct(p1, plane->normal) - dist;
+            d1 = DotProduct(p1, plane->normal) - dist;
+        }
 
         // if completely in front of face, no intersection
         if (d1 > 0)
@@ -610,9 +742,9 @@ static void CM_TraceToLeaf(const mleaf_t *leaf)
     leafbrush = leaf->firstleafbrush;
     for (k = 0; k < leaf->numleafbrushes; k++, leafbrush++) {
         b = *leafbrush;
-        if (b->checkcount == checkcount)
+        if (b->checkcount == trace_checkcount)
             continue;   // already checked this brush in another leaf
-        b->checkcount = checkcount;
+        b->checkcount = trace_checkcount;
 
         if (!(b->contents & trace_contents))
             continue;
@@ -638,9 +770,9 @@ static void CM_TestInLeaf(const mleaf_t *leaf)
     leafbrush = leaf->firstleafbrush;
     for (k = 0; k < leaf->numleafbrushes; k++, leafbrush++) {
         b = *leafbrush;
-        if (b->checkcount == checkcount)
+        if (b->checkcount == trace_checkcount)
             continue;   // already checked this brush in another leaf
-        b->checkcount = checkcount;
+        b->checkcount = trace_checkcount;
 
         if (!(b->contents & trace_contents))
             continue;
@@ -741,21 +873,17 @@ recheck:
 
 //======================================================================
 
-/*
-==================
-CM_BoxTrace
-==================
-*/
-void CM_BoxTrace(trace_t *trace,
-                 const vec3_t start, const vec3_t end,
-                 const vec3_t mins, const vec3_t maxs,
-                 const mnode_t *headnode, int brushmask,
-                 bool extended)
+static void CM_TraceBox(trace_t *trace,
+                        const vec3_t start, const vec3_t end,
+                        const vec3_t mins, const vec3_t maxs,
+                        const mnode_t *headnode, int brushmask,
+                        bool extended)
 {
     const vec_t *bounds[2] = { mins, maxs };
     int i, j;
 
-    checkcount++;       // for multi-check avoidance
+    // for multi-check avoidance
+    trace_checkcount = atomic_fetch_add(&checkcount, 1) + 1;
 
     // fill in a default trace
     trace_trace = trace;
@@ -768,6 +896,9 @@ void CM_BoxTrace(trace_t *trace,
 
     trace_contents = brushmask;
     trace_extended = extended;
+#if USE_BRUSH_SIMD
+    trace_simd = map_brush_simd->integer;
+#endif
     VectorCopy(start, trace_start);
     VectorCopy(end, trace_end);
     for (i = 0; i < 8; i++)
@@ -821,6 +952,24 @@ void CM_BoxTrace(trace_t *trace,
         LerpVector(start, end, trace_trace->fraction, trace_trace->endpos);
 }
 
+/*
+==================
+CM_BoxTrace
+==================
+*/
+void CM_BoxTrace(trace_t *trace,
+                 const vec3_t start, const vec3_t end,
+                 const vec3_t mins, const vec3_t maxs,
+                 const mnode_t *headnode, int brushmask,
+                 bool extended)
+{
+    uint64_t time = Com_TraceTime();
+
+    CM_TraceBox(trace, start, end, mins, maxs, headnode, brushmask, extended);
+
+    Com_TraceEndSlow(time, "CM_BoxTrace");
+}
+
 /*
 ==================
 CM_TransformedBoxTrace
@@ -1081,41 +1230,66 @@ bool CM_HeadnodeVisible(const mnode_t *node, const byte *visbits)
 
 /*
 ============
-CM_FatPVS
+CM_FatClusters
 
-The client will interpolate the view position,
-so we can't use a single PVS point
-===========
+Returns sorted list of unique clusters touched by the box around
+view origin. Identical lists result in identical fat PVS.
+============
 */
-void CM_FatPVS(const cm_t *cm, visrow_t *mask, const vec3_t org)
+int CM_FatClusters(const cm_t *cm, int *clusters, const vec3_t org)
 {
-    const bsp_t     *bsp = cm->cache;
-    const mleaf_t   *leafs[64];
-    int             clusters[64];
-    visrow_t        temp;
-    int             i, j, count, longs;
+    const mleaf_t   *leafs[MAX_FAT_CLUSTERS];
+    int             i, j, count, cluster, numclusters;
     vec3_t          mins, maxs;
 
-    if (!bsp) {   // map not loaded
-        memset(mask, 0, sizeof(*mask));
-        return;
-    }
-    if (!bsp->vis) {
-        memset(mask, 0xff, sizeof(*mask));
-        return;
-    }
+    if (!cm->cache)
+        return 0;
 
     for (i = 0; i < 3; i++) {
         mins[i] = org[i] - 8;
         maxs[i] = org[i] + 8;
     }
 
-    count = CM_BoxLeafs_headnode(mins, maxs, leafs, q_countof(leafs), bsp->nodes, NULL);
+    count = CM_BoxLeafs_headnode(mins, maxs, leafs, q_countof(leafs), cm->cache->nodes, NULL);
     Q_assert(count > 0);
 
-    // convert leafs to clusters
+    // convert leafs to clusters, skipping duplicates
+    numclusters = 0;
     for (i = 0; i < count; i++) {
-        clusters[i] = leafs[i]->cluster;
+        cluster = leafs[i]->cluster;
+        for (j = numclusters; j > 0 && clusters[j - 1] > cluster; j--)
+            ;
+        if (j > 0 && clusters[j - 1] == cluster)
+            continue; // already have the cluster we want
+        memmove(clusters + j + 1, clusters + j, sizeof(clusters[0]) * (numclusters - j));
+        clusters[j] = cluster;
+        numclusters++;
+    }
+
+    return numclusters;
+}
+
+/*
+============
+CM_ClustersVis
+
+ORs together PVS rows of the given clusters.
+============
+*/
+void CM_ClustersVis(const cm_t *cm, visrow_t *mask, const int *clusters, int count)
+{
+    const bsp_t     *bsp = cm->cache;
+    const visrow_t  *row;
+    visrow_t        temp;
+    int             i, j, longs;
+
+    if (!bsp || !count) {   // map not loaded
+        memset(mask, 0, sizeof(*mask));
+        return;
+    }
+    if (!bsp->vis) {
+        memset(mask, 0xff, sizeof(*mask));
+        return;
     }
 
     BSP_ClusterVis(bsp, mask, clusters[0], DVIS_PVS);
@@ -1123,20 +1297,28 @@ void CM_FatPVS(const cm_t *cm, visrow_t *mask, const vec3_t org)
 
     // or in all the other leaf bits
     for (i = 1; i < count; i++) {
-        for (j = 0; j < i; j++) {
-            if (clusters[i] == clusters[j]) {
-                break; // already have the cluster we want
-            }
-        }
-        if (j == i) {
-            BSP_ClusterVis(bsp, &temp, clusters[i], DVIS_PVS);
-            for (j = 0; j < longs; j++) {
-                mask->l[j] |= temp.l[j];
-            }
+        row = BSP_GetClusterVis(bsp, &temp, clusters[i], DVIS_PVS);
+        for (j = 0; j < longs; j++) {
+            mask->l[j] |= row->l[j];
         }
     }
 }
 
+/*
+============
+CM_FatPVS
+
+The client will interpolate the view position,
+so we can't use a single PVS point
+===========
+*/
+void CM_FatPVS(const cm_t *cm, visrow_t *mask, const vec3_t org)
+{
+    int clusters[MAX_FAT_CLUSTERS];
+
+    CM_ClustersVis(cm, mask, clusters, CM_FatClusters(cm, clusters, org));
+}
+
 /*
 =============
 CM_Init
@@ -1148,4 +1330,7 @@ void CM_Init(void)
 
     map_noareas = Cvar_Get("map_noareas", "0", 0);
     map_override_path = Cvar_Get("map_override_path", "", 0);
+#if USE_BRUSH_SIMD
+    map_brush_simd = Cvar_Get("map_brush_simd", "1", 0);
+#endif
 }
@@ -41,6 +41,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/tests.h"
+#include "common/tracing.h"
 #include "common/utils.h"
 #include "common/zone.h"
 
@@ -61,7 +62,7 @@ static void     (*com_abort_func)(void *);
 static void     *com_abort_arg;
 
 static bool     com_errorEntered;
-static char     com_errorMsg[MAXERRORMSG]; // from Com_Printf/Com_Error
+static q_thread_local char com_errorMsg[MAXERRORMSG]; // from Com_Printf/Com_Error
 
 static int      com_printEntered;
 
@@ -634,6 +635,7 @@ void Com_Quit(const char *reason, error_type_t type)
     logfile_close();
     FS_Shutdown();
     Com_ShutdownAsyncWork();
+    Com_ShutdownTracing();
 
     Sys_Quit();
     // doesn't get there
@@ -1011,6 +1013,8 @@ void Qcommon_Init(int argc, char **argv)
     NET_Init();
     BSP_Init();
     CM_Init();
+    Com_InitAsyncWork();
+    Com_InitTracing();
     SV_Init();
     CL_Init();
     TST_Init();
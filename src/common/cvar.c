@@ -33,24 +33,29 @@ int     cvar_modified;
 
 #define Cvar_Malloc(size)   Z_TagMalloc(size, TAG_CVAR)
 
-#define CVARHASH_SIZE    256
+#define CVARHASH_SIZE    256    // initial size, grows with number of cvars
 
-static cvar_t *cvarHash[CVARHASH_SIZE];
+static cvar_t   **cvarHash;
+static unsigned cvarHashSize;
+static unsigned cvarCount;
 
 /*
 ============
-Cvar_FindVar
+Cvar_FindVarHash
+
+Finds cvar given name and its full hash computed by Com_HashStringFull.
 ============
 */
-cvar_t *Cvar_FindVar(const char *var_name)
+cvar_t *Cvar_FindVarHash(const char *var_name, unsigned hash)
 {
     cvar_t *var;
-    unsigned hash;
 
-    hash = Com_HashString(var_name, CVARHASH_SIZE);
+    if (!cvarHashSize) {
+        return NULL;
+    }
 
-    for (var = cvarHash[hash]; var; var = var->hashNext) {
-        if (!strcmp(var_name, var->name)) {
+    for (var = cvarHash[hash & (cvarHashSize - 1)]; var; var = var->hashNext) {
+        if (var->hash == hash && !strcmp(var_name, var->name)) {
             return var;
         }
     }
@@ -58,6 +63,51 @@ cvar_t *Cvar_FindVar(const char *var_name)
     return NULL;
 }
 
+/*
+============
+Cvar_FindVar
+============
+*/
+cvar_t *Cvar_FindVar(const char *var_name)
+{
+    return Cvar_FindVarHash(var_name, Com_HashStringFull(var_name));
+}
+
+static void Cvar_LinkVar(cvar_t *var)
+{
+    cvar_t *c, **p;
+    unsigned i;
+
+    // keep chains short by doubling table size when it gets full
+    if (cvarCount >= cvarHashSize) {
+        cvarHashSize = cvarHashSize ? cvarHashSize * 2 : CVARHASH_SIZE;
+        Z_Free(cvarHash);
+        cvarHash = Z_TagMallocz(cvarHashSize * sizeof(cvarHash[0]), TAG_CVAR);
+        for (c = cvar_vars; c; c = c->next) {
+            if (c == var)
+                continue;
+            i = c->hash & (cvarHashSize - 1);
+            c->hashNext = cvarHash[i];
+            cvarHash[i] = c;
+        }
+    }
+
+    // sort the variable in
+    for (c = cvar_vars, p = &cvar_vars; c; p = &c->next, c = c->next) {
+        if (strcmp(var->name, c->name) < 0) {
+            break;
+        }
+    }
+    var->next = c;
+    *p = var;
+
+    // link the variable in
+    i = var->hash & (cvarHashSize - 1);
+    var->hashNext = cvarHash[i];
+    cvarHash[i] = var;
+    cvarCount++;
+}
+
 xgenerator_t Cvar_FindGenerator(const char *var_name)
 {
     cvar_t *var = Cvar_FindVar(var_name);
@@ -259,14 +309,16 @@ The flags will be or'ed in if the variable exists.
 */
 cvar_t *Cvar_Get(const char *var_name, const char *var_value, int flags)
 {
-    cvar_t *var, *c, **p;
+    cvar_t *var;
     unsigned hash;
     size_t length;
 
     Q_assert(var_name);
 
+    hash = Com_HashStringFull(var_name);
+
     if (!var_value) {
-        return Cvar_FindVar(var_name);
+        return Cvar_FindVarHash(var_name, hash);
     }
 
     if (flags & CVAR_INFOMASK) {
@@ -278,7 +330,7 @@ cvar_t *Cvar_Get(const char *var_name, const char *var_value, int flags)
         }
     }
 
-    var = Cvar_FindVar(var_name);
+    var = Cvar_FindVarHash(var_name, hash);
     if (var) {
         if (!(flags & (CVAR_WEAK | CVAR_CUSTOM))) {
             get_engine_cvar(var, var_value, flags);
@@ -300,20 +352,9 @@ cvar_t *Cvar_Get(const char *var_name, const char *var_value, int flags)
     var->changed = NULL;
     var->generator = Cvar_Default_g;
     var->modified = true;
+    var->hash = hash;
 
-    // sort the variable in
-    for (c = cvar_vars, p = &cvar_vars; c; p = &c->next, c = c->next) {
-        if (strcmp(var->name, c->name) < 0) {
-            break;
-        }
-    }
-    var->next = c;
-    *p = var;
-
-    // link the variable in
-    hash = Com_HashString(var_name, CVARHASH_SIZE);
-    var->hashNext = cvarHash[hash];
-    cvarHash[hash] = var;
+    Cvar_LinkVar(var);
 
     return var;
 }
@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "shared/shared.h"
+#include "shared/atomic.h"
 #include "shared/list.h"
 #include "common/common.h"
 #include "common/cvar.h"
@@ -24,7 +25,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/files.h"
 #include "common/prompt.h"
 #include "common/intreadwrite.h"
+#include "common/mdfour.h"
+#include "common/tracing.h"
 #include "system/system.h"
+#include "system/pthread.h"
 #include "client/client.h"
 #include "server/server.h"
 #include "format/pak.h"
@@ -88,6 +92,9 @@ QUAKE FILESYSTEM
 #define IS_UNIQUE(file) \
     q_unlikely(!((file)->mode & FS_FLAG_LOADFILE))
 
+// used by FS_GetFileInfo to find the file without opening it
+#define FS_FLAG_INFO    0x00008000
+
 //
 // in memory
 //
@@ -124,10 +131,21 @@ typedef struct packfile_s {
     struct packfile_s *hash_next;
 } packfile_t;
 
+// memory mapped pack file, shared by pack_t and buffers returned by
+// FS_LoadFile with FS_FLAG_MAPPED. may outlive the pack.
+typedef struct {
+    list_t      entry;
+    byte        *base;
+    size_t      size;
+    unsigned    refcount;   // protected by fs_mapLock
+} packmap_t;
+
 typedef struct {
     filetype_t  type;       // FS_PAK or FS_ZIP
     unsigned    refcount;   // for tracking pack users
     FILE        *fp;
+    packmap_t   *map;       // NULL if not mapped
+    int64_t     mtime;      // of pack file on disk
     unsigned    num_files;
     unsigned    hash_size;
     packfile_t  *files;
@@ -155,6 +173,7 @@ typedef struct {
     int         error;      // stream error indicator from read/write operation
     int64_t     position;   // reading position for FS_PAK/FS_ZIP
     int64_t     length;     // total cached file length
+    int64_t     mtime;      // only set for FS_FLAG_INFO lookups
 } file_t;
 
 typedef struct {
@@ -180,23 +199,45 @@ static int          fs_num_files;
 
 static bool         fs_non_uniq_open;
 
+static pthread_mutex_t  fs_mapLock = PTHREAD_MUTEX_INITIALIZER;
+static list_t           fs_maps;
+
+// mapped buffers returned by FS_LoadFile and not yet freed
+#define MAX_MAPPED_BUFFERS  16
+static atomic_ptr       fs_mapBuffers[MAX_MAPPED_BUFFERS];
+
 #if USE_DEBUG
 static unsigned     fs_count_read;
 static unsigned     fs_count_open;
 static unsigned     fs_count_strcmp;
 static unsigned     fs_count_strlwr;
+static unsigned     fs_count_packhit;
+static unsigned     fs_count_diskhit;
+static unsigned     fs_count_misshit;
+static unsigned     fs_count_notfound;
 #define FS_COUNT_READ       fs_count_read++
 #define FS_COUNT_OPEN       fs_count_open++
 #define FS_COUNT_STRCMP     fs_count_strcmp++
 #define FS_COUNT_STRLWR     fs_count_strlwr++
+#define FS_COUNT_PACKHIT    fs_count_packhit++
+#define FS_COUNT_DISKHIT    fs_count_diskhit++
+#define FS_COUNT_MISSHIT    fs_count_misshit++
+#define FS_COUNT_NOTFOUND   fs_count_notfound++
 #else
 #define FS_COUNT_READ       (void)0
 #define FS_COUNT_OPEN       (void)0
 #define FS_COUNT_STRCMP     (void)0
 #define FS_COUNT_STRLWR     (void)0
+#define FS_COUNT_PACKHIT    (void)0
+#define FS_COUNT_DISKHIT    (void)0
+#define FS_COUNT_MISSHIT    (void)0
+#define FS_COUNT_NOTFOUND   (void)0
 #endif
 
 static cvar_t       *fs_autoexec;
+static cvar_t       *fs_mmap;
+static cvar_t       *fs_pack_index;
+static cvar_t       *fs_lookup_cache;
 
 #if USE_DEBUG
 static cvar_t       *fs_debug;
@@ -214,6 +255,8 @@ static int read_zip_file(file_t *file, void *buf, size_t len);
 static int seek_zip_file(file_t *file, int64_t offset, int whence);
 #endif
 
+static void flush_lookup_misses(void);
+
 // for tracking users of pack_t instance
 // allows FS to be restarted while reading something from pack
 static pack_t *pack_get(pack_t *pack);
@@ -909,6 +952,9 @@ static int64_t open_file_write(file_t *file, const char *name)
         goto fail;
     }
 
+    // file may have been remembered as missing
+    flush_lookup_misses();
+
     FS_DPrintf("%s: %s: %"PRId64" bytes\n", __func__, fullpath, pos);
     return pos;
 
@@ -1130,6 +1176,13 @@ static int64_t open_from_pack(file_t *file, pack_t *pack, packfile_t *entry)
     FILE *fp;
     int ret;
 
+    if (file->mode & FS_FLAG_INFO) {
+        file->type = pack->type;
+        file->length = entry->filelen;
+        file->mtime = pack->mtime;
+        return file->length;
+    }
+
     if (IS_UNIQUE(file)) {
         fp = fopen(pack->filename, "rb");
         if (!fp) {
@@ -1262,6 +1315,16 @@ static int64_t open_from_disk(file_t *file, const char *fullpath)
     file_info_t info;
     int ret;
 
+    if (file->mode & FS_FLAG_INFO) {
+        ret = get_path_info(fullpath, &info);
+        if (ret)
+            goto fail;
+        file->type = FS_REAL;
+        file->length = info.size;
+        file->mtime = info.mtime;
+        return file->length;
+    }
+
     FS_COUNT_OPEN;
 
     fp = fopen(fullpath, "rb");
@@ -1309,12 +1372,317 @@ fail:
     return ret;
 }
 
+static bool search_matches(const file_t *file, const searchpath_t *search)
+{
+    return (file->mode & search->mode & FS_PATH_MASK) &&
+           (file->mode & search->mode & FS_DIR_MASK);
+}
+
+// opens file from directory search path, retrying with lower case name
+static int64_t open_from_dir(file_t *file, const searchpath_t *search,
+                             const char *normalized, path_valid_t valid)
+{
+    char    fullpath[MAX_OSPATH];
+    int64_t ret;
+
+    if (Q_concat(fullpath, sizeof(fullpath), search->filename,
+                 "/", normalized) >= sizeof(fullpath)) {
+        return Q_ERR(ENAMETOOLONG);
+    }
+
+    ret = open_from_disk(file, fullpath);
+
+#ifndef _WIN32
+    if (ret == Q_ERR(ENOENT) && valid == PATH_MIXED_CASE) {
+        // convert to lower case and retry
+        FS_COUNT_STRLWR;
+        Q_strlwr(fullpath + strlen(search->filename) + 1);
+        ret = open_from_disk(file, fullpath);
+    }
+#endif
+
+    return ret;
+}
+
+/*
+=============================================================================
+
+LOOKUP INDEX
+
+Entries of all packs in the search path are merged into a single hash table,
+so that a file can be found with one lookup instead of one per pack. Paths
+known to be missing from directory search paths are remembered, so that
+probing for alternative file formats doesn't hit the disk repeatedly.
+
+The index is rebuilt when the search path changes. Remembered misses are
+forgotten when the search path changes and when files are written through
+the filesystem. Files added by other means are not seen until FS_FlushCache
+is called or the filesystem is restarted.
+
+=============================================================================
+*/
+
+#define LOOKUP_MAX_DIRS     32
+#define LOOKUP_MISS_HASH    1024
+#define LOOKUP_MAX_MISSES   4096
+
+typedef struct lookupnode_s {
+    struct lookupnode_s *next;
+    searchpath_t    *search;
+    packfile_t      *entry;
+    unsigned        order;      // position in search path
+} lookupnode_t;
+
+typedef struct {
+    searchpath_t    *search;
+    unsigned        order;
+} lookupdir_t;
+
+typedef struct lookupmiss_s {
+    struct lookupmiss_s *next;
+    unsigned        dirs;       // bit mask of lookup directories
+    char            name[1];
+} lookupmiss_t;
+
+static struct {
+    bool            valid;      // false if search path has changed
+    unsigned        hash_size;
+    lookupnode_t    **hash;     // NULL if index can't be used
+    lookupnode_t    *nodes;
+    unsigned        num_dirs;
+    lookupdir_t     dirs[LOOKUP_MAX_DIRS];
+    unsigned        num_misses;
+    lookupmiss_t    *misses[LOOKUP_MISS_HASH];
+} fs_lookup;
+
+static void flush_lookup_misses(void)
+{
+    lookupmiss_t *miss, *next;
+    int i;
+
+    if (!fs_lookup.num_misses)
+        return;
+
+    for (i = 0; i < LOOKUP_MISS_HASH; i++) {
+        for (miss = fs_lookup.misses[i]; miss; miss = next) {
+            next = miss->next;
+            Z_Free(miss);
+        }
+        fs_lookup.misses[i] = NULL;
+    }
+
+    fs_lookup.num_misses = 0;
+}
+
+// called each time search path is modified
+static void invalidate_lookup(void)
+{
+    Z_Freep(&fs_lookup.hash);
+    Z_Freep(&fs_lookup.nodes);
+    fs_lookup.hash_size = 0;
+    fs_lookup.num_dirs = 0;
+    fs_lookup.valid = false;
+
+    flush_lookup_misses();
+}
+
+/*
+================
+FS_FlushCache
+
+Forgets remembered lookup misses. Should be called after creating files
+in game directories bypassing the filesystem.
+================
+*/
+void FS_FlushCache(void)
+{
+    flush_lookup_misses();
+}
+
+// returns false if lookup index can't be used
+static bool build_lookup(void)
+{
+    searchpath_t    *search;
+    lookupnode_t    *node, ***tails;
+    packfile_t      *entry;
+    unsigned        i, order, num_files, num_dirs, hash;
+
+    if (fs_lookup.valid)
+        return fs_lookup.hash != NULL;
+
+    invalidate_lookup();
+    fs_lookup.valid = true;
+
+    num_files = num_dirs = 0;
+    for (search = fs_searchpaths; search; search = search->next) {
+        if (search->pack)
+            num_files += search->pack->num_files;
+        else
+            num_dirs++;
+    }
+
+    if (num_dirs > LOOKUP_MAX_DIRS) {
+        Com_DPrintf("%s: too many directories in search path\n", __func__);
+        return false;
+    }
+
+    fs_lookup.hash_size = Q_npot32(max(num_files / 3, 1));
+    fs_lookup.hash = FS_Mallocz(fs_lookup.hash_size * sizeof(fs_lookup.hash[0]));
+    fs_lookup.nodes = FS_Malloc(num_files * sizeof(fs_lookup.nodes[0]));
+
+    // chains are kept in search path order
+    tails = FS_AllocTempMem(fs_lookup.hash_size * sizeof(tails[0]));
+    for (i = 0; i < fs_lookup.hash_size; i++)
+        tails[i] = &fs_lookup.hash[i];
+
+    node = fs_lookup.nodes;
+    for (search = fs_searchpaths, order = 0; search; search = search->next, order++) {
+        if (!search->pack) {
+            fs_lookup.dirs[fs_lookup.num_dirs].search = search;
+            fs_lookup.dirs[fs_lookup.num_dirs].order = order;
+            fs_lookup.num_dirs++;
+            continue;
+        }
+
+        for (i = 0, entry = search->pack->files; i < search->pack->num_files; i++, entry++) {
+            hash = FS_HashPath(search->pack->names + entry->nameofs, fs_lookup.hash_size);
+            node->next = NULL;
+            node->search = search;
+            node->entry = entry;
+            node->order = order;
+            *tails[hash] = node;
+            tails[hash] = &node->next;
+            node++;
+        }
+    }
+
+    FS_FreeTempMem(tails);
+    return true;
+}
+
+static lookupmiss_t *find_lookup_miss(const char *normalized, unsigned hash)
+{
+    lookupmiss_t *miss;
+
+    for (miss = fs_lookup.misses[hash]; miss; miss = miss->next)
+        if (!strcmp(miss->name, normalized))
+            return miss;
+
+    return NULL;
+}
+
+static void add_lookup_miss(const char *normalized, size_t namelen, unsigned hash, unsigned dir)
+{
+    lookupmiss_t *miss;
+
+    miss = find_lookup_miss(normalized, hash);
+    if (!miss) {
+        if (fs_lookup.num_misses >= LOOKUP_MAX_MISSES)
+            flush_lookup_misses();
+        miss = FS_Malloc(sizeof(*miss) + namelen);
+        miss->dirs = 0;
+        memcpy(miss->name, normalized, namelen + 1);
+        miss->next = fs_lookup.misses[hash];
+        fs_lookup.misses[hash] = miss;
+        fs_lookup.num_misses++;
+    }
+
+    miss->dirs |= BIT(dir);
+}
+
+// same as open_file_read, but uses lookup index
+static int64_t lookup_file_read(file_t *file, const char *normalized, size_t namelen)
+{
+    lookupnode_t    *node, *found;
+    lookupmiss_t    *miss;
+    lookupdir_t     *dir;
+    unsigned        i, hash, misshash;
+    int64_t         ret;
+    path_valid_t    valid;
+    bool            cache;
+
+    hash = FS_HashPath(normalized, 0);
+    misshash = hash & (LOOKUP_MISS_HASH - 1);
+
+    valid = PATH_NOT_CHECKED;
+
+// find the first pack entry in search path order
+    found = NULL;
+    if ((file->mode & FS_TYPE_MASK) != FS_TYPE_REAL && namelen < MAX_QPATH) {
+        node = fs_lookup.hash[hash & (fs_lookup.hash_size - 1)];
+        for (; node; node = node->next) {
+            if (node->entry->namelen != namelen) {
+                continue;
+            }
+            if (!search_matches(file, node->search)) {
+                continue;
+            }
+            FS_COUNT_STRCMP;
+            if (!FS_pathcmp(node->search->pack->names + node->entry->nameofs, normalized)) {
+                found = node;
+                break;
+            }
+        }
+    }
+
+// check directories preceding it
+    if ((file->mode & FS_TYPE_MASK) != FS_TYPE_PAK) {
+        // don't remember misses for disk only lookups (savegames, etc)
+        cache = (file->mode & FS_TYPE_MASK) != FS_TYPE_REAL;
+        miss = NULL;
+
+        for (i = 0, dir = fs_lookup.dirs; i < fs_lookup.num_dirs; i++, dir++) {
+            if (found && dir->order > found->order) {
+                break;
+            }
+            if (!search_matches(file, dir->search)) {
+                continue;
+            }
+            if (valid == PATH_NOT_CHECKED) {
+                valid = FS_ValidatePath(normalized);
+                if (cache)
+                    miss = find_lookup_miss(normalized, misshash);
+            }
+            if (valid == PATH_INVALID) {
+                break;
+            }
+            if (miss && miss->dirs & BIT(i)) {
+                FS_COUNT_MISSHIT;
+                continue;
+            }
+
+            ret = open_from_dir(file, dir->search, normalized, valid);
+            if (ret != Q_ERR(ENOENT)) {
+                if (ret >= 0)
+                    FS_COUNT_DISKHIT;
+                return ret;
+            }
+
+            if (cache) {
+                add_lookup_miss(normalized, namelen, misshash, i);
+                miss = find_lookup_miss(normalized, misshash);
+            }
+        }
+    }
+
+    if (found) {
+        FS_COUNT_PACKHIT;
+        return open_from_pack(file, found->search->pack, found->entry);
+    }
+
+    // return error if path was checked and found to be invalid
+    ret = valid ? Q_ERR(ENOENT) : Q_ERR_INVALID_PATH;
+
+    FS_COUNT_NOTFOUND;
+    FS_DPrintf("%s: %s: %s\n", __func__, normalized, Q_ErrorString(ret));
+    return ret;
+}
+
 // Finds the file in the search path.
 // Fills file_t and returns file length.
 // Used for streaming data out of either a pak file or a separate file.
 static int64_t open_file_read(file_t *file, const char *normalized, size_t namelen)
 {
-    char            fullpath[MAX_OSPATH];
     searchpath_t    *search;
     pack_t          *pak;
     unsigned        hash;
@@ -1327,14 +1695,16 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
     if (!namelen)
         return Q_ERR_INVALID_PATH;
 
+    if (fs_lookup_cache->integer && build_lookup())
+        return lookup_file_read(file, normalized, namelen);
+
     hash = FS_HashPath(normalized, 0);
 
     valid = PATH_NOT_CHECKED;
 
 // search through the path, one element at a time
     for (search = fs_searchpaths; search; search = search->next) {
-        if ((file->mode & search->mode & FS_PATH_MASK) == 0 ||
-            (file->mode & search->mode & FS_DIR_MASK ) == 0) {
+        if (!search_matches(file, search)) {
             continue;
         }
 
@@ -1374,33 +1744,15 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
                 continue;
             }
             // check a file in the directory tree
-            if (Q_concat(fullpath, sizeof(fullpath), search->filename,
-                         "/", normalized) >= sizeof(fullpath)) {
-                ret = Q_ERR(ENAMETOOLONG);
-                goto fail;
-            }
-
-            ret = open_from_disk(file, fullpath);
+            ret = open_from_dir(file, search, normalized, valid);
             if (ret != Q_ERR(ENOENT))
                 return ret;
-
-#ifndef _WIN32
-            if (valid == PATH_MIXED_CASE) {
-                // convert to lower case and retry
-                FS_COUNT_STRLWR;
-                Q_strlwr(fullpath + strlen(search->filename) + 1);
-                ret = open_from_disk(file, fullpath);
-                if (ret != Q_ERR(ENOENT))
-                    return ret;
-            }
-#endif
         }
     }
 
     // return error if path was checked and found to be invalid
     ret = valid ? Q_ERR(ENOENT) : Q_ERR_INVALID_PATH;
 
-fail:
     FS_DPrintf("%s: %s: %s\n", __func__, normalized, Q_ErrorString(ret));
     return ret;
 }
@@ -1675,12 +2027,16 @@ int64_t FS_OpenFile(const char *name, qhandle_t *f, unsigned mode)
 
     file->mode = default_lookup_flags(mode);
 
+    uint64_t time = Com_TraceTime();
+
     if ((mode & FS_MODE_MASK) == FS_MODE_READ) {
         ret = expand_open_file_read(file, name);
     } else {
         ret = open_file_write(file, name);
     }
 
+    Com_TraceEnd(time, "FS_OpenFile", name);
+
     if (ret >= 0) {
         *f = handle;
     }
@@ -1688,6 +2044,42 @@ int64_t FS_OpenFile(const char *name, qhandle_t *f, unsigned mode)
     return ret;
 }
 
+/*
+============
+FS_GetFileInfo
+
+Finds the file in the search path like FS_LoadFile does, but doesn't open
+it. Returns size of the file and modification time of the file on disk it
+would be read from. For files inside packs, this is the time of the pack.
+Creation time is not filled in.
+============
+*/
+int FS_GetFileInfo(const char *path, file_info_t *info)
+{
+    file_t file;
+    int64_t ret;
+
+    Q_assert(path);
+    Q_assert(info);
+
+    if (!fs_searchpaths) {
+        return Q_ERR(EAGAIN); // not yet initialized
+    }
+
+    memset(&file, 0, sizeof(file));
+    file.mode = default_lookup_flags(0) | FS_MODE_READ | FS_FLAG_INFO;
+
+    ret = expand_open_file_read(&file, path);
+    if (ret < 0) {
+        return ret;
+    }
+
+    info->size = file.length;
+    info->ctime = 0;
+    info->mtime = file.mtime;
+    return Q_ERR_SUCCESS;
+}
+
 // reading from outside of source directory is allowed, extension is optional
 static qhandle_t easy_open_read(char *buf, size_t size, unsigned mode,
                                 const char *dir, const char *name, const char *ext)
@@ -1825,15 +2217,159 @@ static void fuzz_data(const char *path, byte *buf, int size)
 }
 #endif
 
+/*
+=============================================================================
+
+MAPPED PACKS
+
+Uncompressed entries of memory mapped packs can be returned by FS_LoadFile
+without copying. Mappings are reference counted, and returned buffers may
+be freed with FS_FreeFile from any thread. Outstanding mapped buffers are
+remembered in a small lock-free table, so that freeing ordinary buffers
+doesn't need to take the lock. Loaders free mapped buffers as soon as they
+are parsed, and files are copied if the table is full.
+
+=============================================================================
+*/
+
+static void pack_map(pack_t *pack)
+{
+    packmap_t *map;
+    size_t size;
+    void *base;
+
+    if (!fs_mmap->integer)
+        return;
+
+    base = Sys_MapFile(pack->filename, &size, false);
+    if (!base) {
+        FS_DPrintf("%s: couldn't map %s\n", __func__, pack->filename);
+        return;
+    }
+
+    map = FS_Malloc(sizeof(*map));
+    map->base = base;
+    map->size = size;
+    map->refcount = 1;
+
+    pthread_mutex_lock(&fs_mapLock);
+    List_Append(&fs_maps, &map->entry);
+    pthread_mutex_unlock(&fs_mapLock);
+
+    pack->map = map;
+}
+
+// stores the pointer in a free slot of mapped buffer table
+static bool add_mapped_buffer(void *buf)
+{
+    for (int i = 0; i < MAX_MAPPED_BUFFERS; i++) {
+        void *expected = NULL;
+        while (!atomic_load(&fs_mapBuffers[i])) {
+            if (atomic_ptr_compare_exchange(&fs_mapBuffers[i], &expected, buf))
+                return true;
+            expected = NULL;
+        }
+    }
+    return false;
+}
+
+// removes the pointer from mapped buffer table, returns false if not found
+static bool remove_mapped_buffer(void *buf)
+{
+    for (int i = 0; i < MAX_MAPPED_BUFFERS; i++) {
+        void *expected = buf;
+        while (atomic_load(&fs_mapBuffers[i]) == buf) {
+            if (atomic_ptr_compare_exchange(&fs_mapBuffers[i], &expected, NULL))
+                return true;
+            expected = buf;
+        }
+    }
+    return false;
+}
+
+// must be called with fs_mapLock held
+static void map_put_locked(packmap_t *map)
+{
+    Q_assert(map->refcount > 0);
+    if (--map->refcount)
+        return;
+
+    List_Remove(&map->entry);
+    Sys_UnmapFile(map->base, map->size);
+    Z_Free(map);
+}
+
+static void map_put(packmap_t *map)
+{
+    pthread_mutex_lock(&fs_mapLock);
+    map_put_locked(map);
+    pthread_mutex_unlock(&fs_mapLock);
+}
+
+// returns pointer to file data inside mapped pack, or NULL
+static void *map_file_data(file_t *file, int64_t len)
+{
+    packmap_t *map;
+    int64_t pos;
+
+    // only uncompressed entries (including stored zip entries)
+    if (file->type != FS_PAK || !file->pack || !(map = file->pack->map))
+        return NULL;
+
+    // keep data aligned for loaders that access structures directly
+    pos = file->entry->filepos;
+    if (pos & 3)
+        return NULL;
+
+    // pack may have been truncated since it was opened
+    if (pos + len > map->size)
+        return NULL;
+
+#if USE_TESTS
+    if (fs_fuzz_factor->value > 0)
+        return NULL;
+#endif
+
+    if (!add_mapped_buffer(map->base + pos))
+        return NULL;
+
+    pthread_mutex_lock(&fs_mapLock);
+    map->refcount++;
+    pthread_mutex_unlock(&fs_mapLock);
+
+    return map->base + pos;
+}
+
 /*
 ============
-FS_LoadFile
+FS_FreeFile
 
-opens non-unique file handle as an optimization
-a NULL buffer will just return the file length without loading
+Frees buffer returned by FS_LoadFile, which may point into mapped pack.
 ============
 */
-int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
+void FS_FreeFile(void *buf)
+{
+    packmap_t *map;
+
+    if (!buf)
+        return;
+
+    if (!remove_mapped_buffer(buf)) {
+        Z_Free(buf);
+        return;
+    }
+
+    pthread_mutex_lock(&fs_mapLock);
+    LIST_FOR_EACH(packmap_t, map, &fs_maps, entry) {
+        if ((byte *)buf >= map->base && (byte *)buf < map->base + map->size) {
+            map_put_locked(map);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fs_mapLock);
+}
+
+static int load_file(const char *path, void **buffer, unsigned flags, memtag_t tag)
 {
     file_t *file;
     qhandle_t f;
@@ -1880,6 +2416,15 @@ int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
         goto done;
     }
 
+    // return pointer into mapped pack if allowed
+    if (flags & FS_FLAG_MAPPED) {
+        buf = map_file_data(file, len);
+        if (buf) {
+            *buffer = buf;
+            goto done;
+        }
+    }
+
     // allocate chunk of memory, +1 for NUL
     buf = Z_TagMalloc(len + 1, tag);
 
@@ -1903,6 +2448,23 @@ done:
     return len;
 }
 
+/*
+============
+FS_LoadFile
+
+opens non-unique file handle as an optimization
+a NULL buffer will just return the file length without loading
+============
+*/
+int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
+{
+    uint64_t time = Com_TraceTime();
+    int ret = load_file(path, buffer, flags, tag);
+
+    Com_TraceEnd(time, "FS_LoadFile", path);
+    return ret;
+}
+
 static int write_and_close(const void *data, size_t len, qhandle_t f)
 {
     int ret1 = FS_Write(data, len, f);
@@ -1995,6 +2557,7 @@ int FS_RenameFile(const char *from, const char *to)
     if (rename(frompath, topath))
         return Q_ERRNO;
 
+    flush_lookup_misses();
     return Q_ERR_SUCCESS;
 }
 
@@ -2024,6 +2587,8 @@ int FS_FPrintf(qhandle_t f, const char *format, ...)
 
 static void pack_free(pack_t *pack)
 {
+    if (pack->map)
+        map_put(pack->map);
     fclose(pack->fp);
     Z_Free(pack->names);
     Z_Free(pack->file_hash);
@@ -2056,6 +2621,7 @@ static pack_t *pack_alloc(FILE *fp, filetype_t type, const char *name,
                           unsigned num_files, size_t names_len)
 {
     pack_t *pack;
+    file_info_t info;
     size_t len;
 
     len = strlen(name);
@@ -2063,6 +2629,8 @@ static pack_t *pack_alloc(FILE *fp, filetype_t type, const char *name,
     pack->type = type;
     pack->refcount = 0;
     pack->fp = fp;
+    pack->map = NULL;
+    pack->mtime = get_fp_info(fp, &info) ? 0 : info.mtime;
     pack->num_files = num_files;
     pack->files = FS_Malloc(num_files * sizeof(pack->files[0]));
     pack->hash_size = 0;
@@ -2193,6 +2761,7 @@ static pack_t *load_pak_file(const char *packfile)
     }
 
     pack_calc_hashes(pack);
+    pack_map(pack);
 
     FS_DPrintf("%s: %u files, %u hash\n",
                packfile, pack->num_files, pack->hash_size);
@@ -2510,6 +3079,7 @@ static pack_t *load_zip_file(const char *packfile)
     pack->names = Z_Realloc(pack->names, names_len);
 
     pack_calc_hashes(pack);
+    pack_map(pack);
 
     FS_DPrintf("%s: %u files, %u skipped, %u hash%s\n",
                packfile, pack->num_files, (int)(num_files_cd - num_files),
@@ -2527,6 +3097,296 @@ fail2:
 }
 #endif
 
+/*
+=============================================================================
+
+PACK INDEX
+
+Parsed pack directories are cached in binary form under home directory, so
+that packs can be added without reading and parsing their directories on
+each restart. Index files are keyed by pack path, size and modification
+time. Local file headers of zip entries are still checked when each file
+is opened for the first time.
+
+=============================================================================
+*/
+
+#define PACKINDEX_IDENT     MakeLittleLong('Q','2','P','I')
+#define PACKINDEX_VERSION   1
+#define PACKINDEX_DIR       "packindex"
+
+typedef struct {
+    uint32_t    ident;
+    uint32_t    version;
+    uint32_t    type;
+    uint32_t    checksum;   // of everything following the header
+    int64_t     size;       // of pack file
+    int64_t     mtime;
+    uint32_t    num_files;
+    uint32_t    names_len;
+    uint32_t    path_len;   // including terminating NUL
+    uint32_t    unused;
+} packindex_header_t;
+
+typedef struct {
+    int64_t     filepos;
+    int64_t     filelen;
+    int64_t     complen;
+    uint32_t    nameofs;
+    uint16_t    compmtd;
+    uint8_t     namelen;
+    uint8_t     coherent;
+} packindex_file_t;
+
+// index file layout: header, files, pack path, names
+static size_t pack_index_size(const packindex_header_t *h)
+{
+    return h->num_files * sizeof(packindex_file_t) + h->path_len + h->names_len;
+}
+
+static bool pack_index_path(char *buf, size_t size, const char *packfile)
+{
+    const char *root = sys_homedir->string[0] ? sys_homedir->string : sys_basedir->string;
+    uint32_t hash = Com_BlockChecksum(packfile, strlen(packfile));
+
+    return Q_snprintf(buf, size, "%s/" PACKINDEX_DIR "/%08x.idx", root, hash) < size;
+}
+
+static bool check_pack_index(const packindex_header_t *h, filetype_t type,
+                             const file_info_t *info, const char *packfile)
+{
+    if (h->ident != PACKINDEX_IDENT || h->version != PACKINDEX_VERSION)
+        return false;
+    if (h->type != type || h->size != info->size || h->mtime != info->mtime)
+        return false;
+    if (h->num_files < 1 || h->num_files > MAX_FILES_IN_PACK)
+        return false;
+    if (h->names_len < 1 || h->names_len > h->num_files * MAX_QPATH)
+        return false;
+    if (h->path_len != strlen(packfile) + 1)
+        return false;
+    return true;
+}
+
+// tries to create pack from index file, returns NULL if index is
+// missing or doesn't match the pack
+static pack_t *load_pack_index(const char *packfile, filetype_t type)
+{
+    char                path[MAX_OSPATH];
+    packindex_header_t  header;
+    packindex_file_t    *dfile;
+    packfile_t          *file;
+    file_info_t         info;
+    pack_t              *pack;
+    FILE                *fp, *index;
+    byte                *data;
+    char                *names;
+    size_t              len;
+    unsigned            i;
+
+    if (!fs_pack_index->integer)
+        return NULL;
+
+    if (!pack_index_path(path, sizeof(path), packfile))
+        return NULL;
+
+    fp = fopen(packfile, "rb");
+    if (!fp)
+        return NULL;
+
+    if (get_fp_info(fp, &info))
+        goto fail1;
+
+    index = fopen(path, "rb");
+    if (!index)
+        goto fail1;
+
+    if (!fread(&header, sizeof(header), 1, index))
+        goto fail2;
+
+    if (!check_pack_index(&header, type, &info, packfile))
+        goto fail2;
+
+    len = pack_index_size(&header);
+    data = FS_AllocTempMem(len);
+    if (!fread(data, len, 1, index))
+        goto fail3;
+
+    if (Com_BlockChecksum(data, len) != header.checksum)
+        goto fail3;
+
+    dfile = (packindex_file_t *)data;
+    names = (char *)(dfile + header.num_files);
+    if (memcmp(names, packfile, header.path_len))
+        goto fail3;
+
+    names += header.path_len;
+    if (names[header.names_len - 1])
+        goto fail3;
+
+// allocate the pack
+    pack = pack_alloc(fp, type, packfile, header.num_files, header.names_len);
+    memcpy(pack->names, names, header.names_len);
+
+    file = pack->files;
+    for (i = 0; i < header.num_files; i++, dfile++, file++) {
+        if ((uint64_t)dfile->nameofs + dfile->namelen >= header.names_len ||
+            names[dfile->nameofs + dfile->namelen])
+            goto fail4;
+        if (dfile->filepos < 0 || dfile->filelen < 0 || dfile->complen < 0 ||
+            dfile->filepos > info.size || dfile->complen > info.size - dfile->filepos)
+            goto fail4;
+
+        file->filepos = dfile->filepos;
+        file->filelen = dfile->filelen;
+#if USE_ZLIB
+        file->complen = dfile->complen;
+        file->compmtd = dfile->compmtd;
+        file->coherent = dfile->coherent;
+#endif
+        file->namelen = dfile->namelen;
+        file->nameofs = dfile->nameofs;
+    }
+
+    FS_FreeTempMem(data);
+    fclose(index);
+
+    pack_calc_hashes(pack);
+    pack_map(pack);
+
+    FS_DPrintf("%s: %u files, %u hash, from index\n",
+               packfile, pack->num_files, pack->hash_size);
+
+    return pack;
+
+fail4:
+    pack_free(pack);    // closes pack file
+    FS_FreeTempMem(data);
+    fclose(index);
+    Com_DPrintf("%s: %s is invalid\n", __func__, path);
+    return NULL;
+
+fail3:
+    FS_FreeTempMem(data);
+fail2:
+    fclose(index);
+fail1:
+    fclose(fp);
+    return NULL;
+}
+
+// writes index file for freshly loaded pack
+static void save_pack_index(const pack_t *pack)
+{
+    char                path[MAX_OSPATH], temp[MAX_OSPATH];
+    packindex_header_t  header;
+    packindex_file_t    *dfile;
+    const packfile_t    *file;
+    file_info_t         info;
+    size_t              len, names_len;
+    byte                *data;
+    FILE                *fp;
+    unsigned            i;
+    bool                ok;
+
+    if (!fs_pack_index->integer)
+        return;
+
+    if (!pack_index_path(path, sizeof(path), pack->filename))
+        return;
+    if (Q_concat(temp, sizeof(temp), path, ".tmp") >= sizeof(temp))
+        return;
+
+    if (get_fp_info(pack->fp, &info))
+        return;
+
+    // pak names may be shorter than allocated after normalization
+    names_len = 0;
+    for (i = 0, file = pack->files; i < pack->num_files; i++, file++)
+        names_len = max(names_len, file->nameofs + file->namelen + 1);
+
+    memset(&header, 0, sizeof(header));
+    header.ident = PACKINDEX_IDENT;
+    header.version = PACKINDEX_VERSION;
+    header.type = pack->type;
+    header.size = info.size;
+    header.mtime = info.mtime;
+    header.num_files = pack->num_files;
+    header.names_len = names_len;
+    header.path_len = strlen(pack->filename) + 1;
+
+    len = pack_index_size(&header);
+    data = FS_AllocTempMem(len);
+
+    dfile = (packindex_file_t *)data;
+    for (i = 0, file = pack->files; i < pack->num_files; i++, file++, dfile++) {
+        memset(dfile, 0, sizeof(*dfile));
+        dfile->filepos = file->filepos;
+        dfile->filelen = file->filelen;
+#if USE_ZLIB
+        dfile->complen = file->complen;
+        dfile->compmtd = file->compmtd;
+        dfile->coherent = file->coherent;
+#else
+        dfile->complen = file->filelen;
+        dfile->coherent = true;
+#endif
+        dfile->namelen = file->namelen;
+        dfile->nameofs = file->nameofs;
+    }
+
+    memcpy(dfile, pack->filename, header.path_len);
+    memcpy((byte *)dfile + header.path_len, pack->names, names_len);
+
+    header.checksum = Com_BlockChecksum(data, len);
+
+    // write to temporary file first, so that other processes sharing the
+    // same home directory never see partially written index
+    FS_CreatePath(temp);
+    fp = fopen(temp, "wb");
+    if (!fp) {
+        FS_DPrintf("%s: couldn't open %s: %s\n", __func__, temp, strerror(errno));
+        FS_FreeTempMem(data);
+        return;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, fp) && fwrite(data, len, 1, fp);
+    ok &= !fclose(fp);
+    FS_FreeTempMem(data);
+
+#ifdef _WIN32
+    if (ok)
+        remove(path);
+#endif
+    if (!ok || rename(temp, path)) {
+        FS_DPrintf("%s: couldn't write %s\n", __func__, path);
+        remove(temp);
+    }
+}
+
+// loads pack directory from index file if possible,
+// otherwise parses the pack and updates the index
+static pack_t *load_pack_file(const char *packfile, filetype_t type)
+{
+    pack_t *pack;
+
+    pack = load_pack_index(packfile, type);
+    if (pack)
+        return pack;
+
+#if USE_ZLIB
+    if (type == FS_ZIP)
+        pack = load_zip_file(packfile);
+    else
+#endif
+        pack = load_pak_file(packfile);
+
+    if (pack)
+        save_pack_index(pack);
+
+    return pack;
+}
+
 // this is complicated as we need pakXX.pak loaded first,
 // sorted in numerical order, then the rest of the paks in
 // alphabetical order, e.g. pak0.pak, pak2.pak, pak17.pak, abc.pak...
@@ -2563,6 +3423,7 @@ static void add_game_dir(unsigned mode, const char *base, const char *game, bool
 {
     searchpath_t    *search;
     pack_t          *pack;
+    filetype_t      type;
     listfiles_t     list;
     int             i;
     char            path[MAX_OSPATH];
@@ -2590,6 +3451,7 @@ static void add_game_dir(unsigned mode, const char *base, const char *game, bool
     memcpy(search->filename, fs_gamedir, len + 1);
     search->next = fs_searchpaths;
     fs_searchpaths = search;
+    invalidate_lookup();
 
     // add any pack files
     memset(&list, 0, sizeof(list));
@@ -2612,13 +3474,13 @@ static void add_game_dir(unsigned mode, const char *base, const char *game, bool
             Com_EPrintf("%s: refusing oversize path\n", __func__);
             continue;
         }
+        type = FS_PAK;
 #if USE_ZLIB
         // FIXME: guess packfile type by contents instead?
         if (len > 4 && !Q_stricmp(path + len - 4, ".pkz"))
-            pack = load_zip_file(path);
-        else
+            type = FS_ZIP;
 #endif
-            pack = load_pak_file(path);
+        pack = load_pack_file(path, type);
         if (!pack) {
             Com_EPrintf("Couldn't load %s: %s\n", path, Com_GetLastError());
             continue;
@@ -3264,7 +4126,8 @@ static void FS_Path_f(void)
             else
 #endif
                 numFilesInPAK += s->pack->num_files;
-            Com_Printf("%s (%i files)\n", s->pack->filename, s->pack->num_files);
+            Com_Printf("%s (%i files%s)\n", s->pack->filename, s->pack->num_files,
+                       s->pack->map ? ", mapped" : "");
         } else {
             Com_Printf("%s\n", s->filename);
         }
@@ -3295,6 +4158,7 @@ static void FS_Stats_f(void)
     int i;
     int len, maxLen = 0;
     int totalHashSize, totalLen;
+    unsigned lookups;
 
     totalHashSize = totalLen = 0;
     for (path = fs_searchpaths; path; path = path->next) {
@@ -3326,6 +4190,17 @@ static void FS_Stats_f(void)
     Com_Printf("Total calls to open_from_disk: %u\n", fs_count_open);
     Com_Printf("Total mixed-case reopens: %u\n", fs_count_strlwr);
 
+    lookups = fs_count_packhit + fs_count_diskhit + fs_count_notfound;
+    if (lookups) {
+        Com_Printf("Indexed lookups: %u (%.1f%% pack, %.1f%% disk, %.1f%% not found)\n",
+                   lookups, fs_count_packhit * 100.0f / lookups,
+                   fs_count_diskhit * 100.0f / lookups, fs_count_notfound * 100.0f / lookups);
+        Com_Printf("Disk lookups avoided by miss cache: %u of %u (%.1f%%)\n",
+                   fs_count_misshit, fs_count_misshit + fs_count_open,
+                   fs_count_misshit * 100.0f / max(fs_count_misshit + fs_count_open, 1));
+        Com_Printf("Remembered misses: %u\n", fs_lookup.num_misses);
+    }
+
     if (!totalHashSize) {
         Com_Printf("No stats to display\n");
         return;
@@ -3508,6 +4383,7 @@ static void free_all_paths(void)
     }
 
     fs_searchpaths = NULL;
+    invalidate_lookup();
 }
 
 static void free_game_paths(void)
@@ -3520,6 +4396,7 @@ static void free_game_paths(void)
     }
 
     fs_searchpaths = fs_base_searchpaths;
+    invalidate_lookup();
 }
 
 // game needs this for localized map messages
@@ -3543,6 +4420,7 @@ static void add_game_kpf(unsigned mode, const char *dir)
     search->pack = pack_get(pack);
     search->next = fs_searchpaths;
     fs_searchpaths = search;
+    invalidate_lookup();
 #endif
 }
 
@@ -3802,10 +4680,14 @@ void FS_Init(void)
 
     List_Init(&fs_hard_links);
     List_Init(&fs_soft_links);
+    List_Init(&fs_maps);
 
     Cmd_Register(c_fs);
 
     fs_autoexec = Cvar_Get("fs_autoexec", "1", 0);
+    fs_mmap = Cvar_Get("fs_mmap", "1", 0);
+    fs_pack_index = Cvar_Get("fs_pack_index", "1", 0);
+    fs_lookup_cache = Cvar_Get("fs_lookup_cache", "1", 0);
 
 #if USE_DEBUG
     fs_debug = Cvar_Get("fs_debug", "0", 0);
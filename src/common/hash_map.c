@@ -22,9 +22,22 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "common/zone.h"
 #include "common/hash_map.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_HASH_SIMD   1
+#include <emmintrin.h>
+#else
+#define USE_HASH_SIMD   0
+#endif
+
 #define MIN_KEY_VALUE_STORAGE_SIZE 16
 #define MIN_HASH_SIZE              32
 
+// flat maps keep one control byte per slot: either CTRL_EMPTY or top 7
+// bits of the hash. first GROUP_WIDTH - 1 control bytes are cloned past
+// the end of the table, so that any group can be loaded unaligned.
+#define GROUP_WIDTH     16
+#define CTRL_EMPTY      0x80
+
 typedef struct hash_map_s {
     uint32_t num_entries;
     uint32_t hash_size;
@@ -32,14 +45,19 @@ typedef struct hash_map_s {
     uint32_t key_size;
     uint32_t value_size;
     memtag_t tag;
+    bool     flat;
     uint32_t (*hasher)(const void *const);
     bool     (*comp)(const void *const, const void *const);
-    uint32_t *hash_to_index;
-    uint32_t *index_chain;
+    uint32_t *hash_to_index;    // flat: storage index for each slot
+    uint32_t *index_chain;      // flat: full hash for each storage index
+    uint8_t  *ctrl;             // flat only
     void     *keys;
     void     *values;
 } hash_map_t;
 
+#define HashMap_KeysEqual(map, a, b) \
+    ((map)->comp ? (map)->comp(a, b) : (memcmp(a, b, (map)->key_size) == 0))
+
 /*
 =================
 HashMap_GetKeyImpl
@@ -65,10 +83,16 @@ void *HashMap_GetValueImpl(const hash_map_t *map, uint32_t index)
 HashMap_Rehash
 =================
 */
+static void HashMap_FlatRehash(hash_map_t *map, uint32_t new_size);
+
 static void HashMap_Rehash(hash_map_t *map, const uint32_t new_size)
 {
     if (map->hash_size >= new_size)
         return;
+    if (map->flat) {
+        HashMap_FlatRehash(map, new_size);
+        return;
+    }
     map->hash_size = new_size;
     map->hash_to_index = Z_ReallocArray(map->hash_to_index, map->hash_size, sizeof(uint32_t), map->tag);
     memset(map->hash_to_index, 0xFF, map->hash_size * sizeof(uint32_t));
@@ -94,6 +118,217 @@ static void HashMap_ExpandKeyValueStorage(hash_map_t *map, const uint32_t new_si
     map->key_value_storage_size = new_size;
 }
 
+/*
+==============================================================================
+
+FLAT MAP
+
+Open addressing with linear probing over a table of control bytes, scanned
+GROUP_WIDTH slots at a time. Keys and values stay in the same dense storage
+as chained maps, slots only hold storage indices. Erasing shifts following
+entries of the probe run back instead of leaving tombstones, so lookups
+never degrade after many erases.
+
+==============================================================================
+*/
+
+static inline uint32_t HashMap_LowestBit(uint32_t mask)
+{
+#if q_has_builtin(__builtin_ctz)
+    return __builtin_ctz(mask);
+#elif (defined _MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    uint32_t i;
+    for (i = 0; !(mask & 1); i++)
+        mask >>= 1;
+    return i;
+#endif
+}
+
+// returns bitmask of control bytes in group that are equal to `c'
+static inline uint32_t HashMap_MatchGroup(const uint8_t *group, const uint8_t c)
+{
+#if USE_HASH_SIMD
+    const __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++)
+        mask |= (uint32_t)(group[i] == c) << i;
+    return mask;
+#endif
+}
+
+static inline void HashMap_FlatSetCtrl(hash_map_t *map, const uint32_t slot, const uint8_t c)
+{
+    map->ctrl[slot] = c;
+    if (slot < GROUP_WIDTH - 1)
+        map->ctrl[map->hash_size + slot] = c;
+}
+
+/*
+=================
+HashMap_FlatFind
+
+Returns slot holding `key', or UINT32_MAX if not found. In the latter case
+also returns first empty slot of the probe run, where the key would be
+inserted.
+=================
+*/
+static uint32_t HashMap_FlatFind(const hash_map_t *map, const void *const key, const uint32_t hash, uint32_t *empty_slot)
+{
+    const uint32_t mask = map->hash_size - 1;
+    const uint8_t  h2 = hash >> 25;
+    uint32_t       pos = hash & mask;
+
+    while (1) {
+        const uint8_t *group = map->ctrl + pos;
+        uint32_t       match = HashMap_MatchGroup(group, h2);
+        const uint32_t empty = HashMap_MatchGroup(group, CTRL_EMPTY);
+
+        // slots after first empty one belong to other probe runs
+        if (empty)
+            match &= (empty & (0U - empty)) - 1;
+
+        while (match) {
+            const uint32_t slot = (pos + HashMap_LowestBit(match)) & mask;
+            const uint32_t storage_index = map->hash_to_index[slot];
+            if (map->index_chain[storage_index] == hash &&
+                HashMap_KeysEqual(map, key, HashMap_GetKeyImpl(map, storage_index)))
+                return slot;
+            match &= match - 1;
+        }
+
+        if (empty) {
+            if (empty_slot)
+                *empty_slot = (pos + HashMap_LowestBit(empty)) & mask;
+            return UINT32_MAX;
+        }
+
+        pos = (pos + GROUP_WIDTH) & mask;
+    }
+}
+
+/*
+=================
+HashMap_FlatRehash
+=================
+*/
+static void HashMap_FlatRehash(hash_map_t *map, uint32_t new_size)
+{
+    // probing works on whole groups, so table can't be smaller than one
+    map->hash_size = max(new_size, GROUP_WIDTH);
+    map->hash_to_index = Z_ReallocArray(map->hash_to_index, map->hash_size, sizeof(uint32_t), map->tag);
+    map->ctrl = Z_ReallocArray(map->ctrl, map->hash_size + GROUP_WIDTH - 1, 1, map->tag);
+    memset(map->ctrl, CTRL_EMPTY, map->hash_size + GROUP_WIDTH - 1);
+
+    // full hashes are stored, so there is no need to call hasher again.
+    // keys are unique, so the first empty slot can be taken directly.
+    const uint32_t mask = map->hash_size - 1;
+    for (uint32_t i = 0; i < map->num_entries; ++i) {
+        const uint32_t hash = map->index_chain[i];
+        uint32_t       pos = hash & mask;
+        uint32_t       empty;
+        while (!(empty = HashMap_MatchGroup(map->ctrl + pos, CTRL_EMPTY)))
+            pos = (pos + GROUP_WIDTH) & mask;
+        const uint32_t slot = (pos + HashMap_LowestBit(empty)) & mask;
+        HashMap_FlatSetCtrl(map, slot, hash >> 25);
+        map->hash_to_index[slot] = i;
+    }
+}
+
+/*
+=================
+HashMap_FlatInsert
+=================
+*/
+static bool HashMap_FlatInsert(hash_map_t *map, const void *const key, const void *const value)
+{
+    const uint32_t hash = map->hasher(key);
+    uint32_t       slot;
+    uint32_t       found = HashMap_FlatFind(map, key, hash, &slot);
+
+    if (found != UINT32_MAX) {
+        memcpy(HashMap_GetValueImpl(map, map->hash_to_index[found]), value, map->value_size);
+        return true;
+    }
+
+    HashMap_FlatSetCtrl(map, slot, hash >> 25);
+    map->hash_to_index[slot] = map->num_entries;
+    map->index_chain[map->num_entries] = hash;
+    memcpy(HashMap_GetKeyImpl(map, map->num_entries), key, map->key_size);
+    memcpy(HashMap_GetValueImpl(map, map->num_entries), value, map->value_size);
+    ++map->num_entries;
+
+    return false;
+}
+
+/*
+=================
+HashMap_FlatEraseSlot
+
+Empties `slot' and moves back entries that follow it in the probe run,
+unless that would move them before their home slot.
+=================
+*/
+static void HashMap_FlatEraseSlot(hash_map_t *map, uint32_t slot)
+{
+    const uint32_t mask = map->hash_size - 1;
+    uint32_t       pos = slot;
+
+    while (1) {
+        pos = (pos + 1) & mask;
+        if (map->ctrl[pos] == CTRL_EMPTY)
+            break;
+
+        const uint32_t home = map->index_chain[map->hash_to_index[pos]] & mask;
+        if (((pos - home) & mask) < ((pos - slot) & mask))
+            continue;
+
+        HashMap_FlatSetCtrl(map, slot, map->ctrl[pos]);
+        map->hash_to_index[slot] = map->hash_to_index[pos];
+        slot = pos;
+    }
+
+    HashMap_FlatSetCtrl(map, slot, CTRL_EMPTY);
+}
+
+/*
+=================
+HashMap_FlatErase
+=================
+*/
+static bool HashMap_FlatErase(hash_map_t *map, const void *const key)
+{
+    const uint32_t slot = HashMap_FlatFind(map, key, map->hasher(key), NULL);
+    if (slot == UINT32_MAX)
+        return false;
+
+    const uint32_t storage_index = map->hash_to_index[slot];
+    const uint32_t last_index = map->num_entries - 1;
+
+    HashMap_FlatEraseSlot(map, slot);
+
+    if (storage_index != last_index) {
+        // Move last key to erased position and repoint its slot
+        const uint32_t mask = map->hash_size - 1;
+        uint32_t       last_slot = map->index_chain[last_index] & mask;
+        while (map->ctrl[last_slot] == CTRL_EMPTY || map->hash_to_index[last_slot] != last_index)
+            last_slot = (last_slot + 1) & mask;
+        map->hash_to_index[last_slot] = storage_index;
+
+        memcpy(HashMap_GetKeyImpl(map, storage_index), HashMap_GetKeyImpl(map, last_index), map->key_size);
+        memcpy(HashMap_GetValueImpl(map, storage_index), HashMap_GetValueImpl(map, last_index), map->value_size);
+        map->index_chain[storage_index] = map->index_chain[last_index];
+    }
+
+    --map->num_entries;
+    return true;
+}
+
 /*
 =================
 HashMap_CreateImpl
@@ -113,6 +348,21 @@ hash_map_t *HashMap_CreateImpl(const uint32_t key_size, const uint32_t value_siz
     return map;
 }
 
+/*
+=================
+HashMap_CreateFlatImpl
+=================
+*/
+hash_map_t *HashMap_CreateFlatImpl(const uint32_t key_size, const uint32_t value_size,
+                                   uint32_t (*hasher)(const void *const),
+                                   bool (*comp)(const void *const, const void *const),
+                                   memtag_t tag)
+{
+    hash_map_t *map = HashMap_CreateImpl(key_size, value_size, hasher, comp, tag);
+    map->flat = true;
+    return map;
+}
+
 /*
 =================
 HashMap_Destroy
@@ -120,6 +370,7 @@ HashMap_Destroy
 */
 void HashMap_Destroy(hash_map_t *map)
 {
+    Z_Free(map->ctrl);
     Z_Free(map->hash_to_index);
     Z_Free(map->index_chain);
     Z_Free(map->keys);
@@ -157,6 +408,9 @@ bool HashMap_InsertImpl(hash_map_t *map, const uint32_t key_size, const uint32_t
     if ((map->num_entries + (map->num_entries / 4)) >= map->hash_size)
         HashMap_Rehash(map, max(map->hash_size * 2, MIN_HASH_SIZE));
 
+    if (map->flat)
+        return HashMap_FlatInsert(map, key, value);
+
     const uint32_t hash = map->hasher(key);
     const uint32_t hash_index = hash & (map->hash_size - 1);
     {
@@ -190,6 +444,8 @@ bool HashMap_EraseImpl(hash_map_t *map, const uint32_t key_size, const void *con
     Q_assert(key_size == map->key_size);
     if (map->num_entries == 0)
         return false;
+    if (map->flat)
+        return HashMap_FlatErase(map, key);
 
     const uint32_t hash = map->hasher(key);
     const uint32_t hash_index = hash & (map->hash_size - 1);
@@ -261,6 +517,12 @@ void *HashMap_LookupImpl(const hash_map_t *map, const uint32_t key_size, const v
     Q_assert(map->key_size == key_size);
     if (map->num_entries == 0)
         return NULL;
+    if (map->flat) {
+        const uint32_t slot = HashMap_FlatFind(map, key, map->hasher(key), NULL);
+        if (slot == UINT32_MAX)
+            return NULL;
+        return HashMap_GetValueImpl(map, map->hash_to_index[slot]);
+    }
 
     const uint32_t hash = map->hasher(key);
     const uint32_t hash_index = hash & (map->hash_size - 1);
@@ -32,7 +32,9 @@ Handles byte ordering and avoids alignment errors
 ==============================================================================
 */
 
-sizebuf_t   msg_write;
+// thread local so that server frames can be encoded by worker threads,
+// each of which points msg_write to its own buffer
+q_thread_local sizebuf_t msg_write;
 byte        msg_write_buffer[MAX_MSGLEN];
 
 sizebuf_t   msg_read;
@@ -233,7 +235,7 @@ void MSG_WriteAngle(float f)
     MSG_WriteByte(ANGLE2BYTE(f));
 }
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 
 /*
 =============
@@ -466,7 +468,7 @@ int MSG_WriteDeltaUsercmd_Enhanced(const usercmd_t *from,
     return bits;
 }
 
-#endif // USE_CLIENT
+#endif // USE_CLIENT || USE_LOADGEN
 
 void MSG_WriteDir(const vec3_t dir)
 {
@@ -1792,7 +1794,7 @@ size_t MSG_ReadStringLine(char *dest, size_t size)
     return len;
 }
 
-#if USE_CLIENT || USE_MVD_CLIENT
+#if USE_CLIENT || USE_MVD_CLIENT || USE_LOADGEN
 
 static inline float MSG_ReadCoord(void)
 {
@@ -2078,7 +2080,7 @@ void MSG_ReadDeltaUsercmd_Enhanced(const usercmd_t *from, usercmd_t *to)
     }
 }
 
-#if USE_CLIENT || USE_MVD_CLIENT
+#if USE_CLIENT || USE_MVD_CLIENT || USE_LOADGEN
 
 /*
 =================
@@ -2248,7 +2250,7 @@ void MSG_ParseDeltaEntity(entity_state_t            *to,
     }
 }
 
-#endif // USE_CLIENT || USE_MVD_CLIENT
+#endif // USE_CLIENT || USE_MVD_CLIENT || USE_LOADGEN
 
 static uint64_t MSG_ReadVarInt64(void)
 {
@@ -211,9 +211,9 @@ static int NetchanOld_Transmit(netchan_t *chan, size_t length, const void *data,
     SZ_WriteLong(&send, w1);
     SZ_WriteLong(&send, w2);
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
     // send the qport if we are a client
-    if (chan->sock == NS_CLIENT) {
+    if (chan->sock != NS_SERVER) {
         if (chan->protocol < PROTOCOL_VERSION_R1Q2) {
             SZ_WriteShort(&send, chan->qport);
         } else if (chan->qport) {
@@ -386,9 +386,9 @@ int Netchan_TransmitNextFragment(netchan_t *chan)
     SZ_WriteLong(&send, w1);
     SZ_WriteLong(&send, w2);
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
     // send the qport if we are a client
-    if (chan->sock == NS_CLIENT && chan->qport) {
+    if (chan->sock != NS_SERVER && chan->qport) {
         SZ_WriteByte(&send, chan->qport);
     }
 #endif
@@ -502,9 +502,9 @@ static int NetchanNew_Transmit(netchan_t *chan, size_t length, const void *data,
     SZ_WriteLong(&send, w1);
     SZ_WriteLong(&send, w2);
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
     // send the qport if we are a client
-    if (chan->sock == NS_CLIENT && chan->qport) {
+    if (chan->sock != NS_SERVER && chan->qport) {
         SZ_WriteByte(&send, chan->qport);
     }
 #endif
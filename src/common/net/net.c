@@ -54,6 +54,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <arpa/inet.h>
 #include <poll.h>
 #include <errno.h>
+#if USE_EPOLL
+#include <sys/epoll.h>
+#endif
 #if USE_ICMP
 #include <linux/errqueue.h>
 #else
@@ -110,10 +113,16 @@ static cvar_t   *net_ignore_icmp;
 static netflag_t    net_active;
 static int          net_error;
 
-static struct pollfd    *udp_sockets[NS_COUNT];
+#if USE_LOADGEN
+#define NS_TOTAL    (NS_COUNT + NS_MAX_LOADGEN)
+#else
+#define NS_TOTAL    NS_COUNT
+#endif
+
+static struct pollfd    *udp_sockets[NS_TOTAL];
 static struct pollfd    *tcp_socket;
 
-static struct pollfd    *udp6_sockets[NS_COUNT];
+static struct pollfd    *udp6_sockets[NS_TOTAL];
 static struct pollfd    *tcp6_socket;
 
 #if USE_DEBUG
@@ -125,6 +134,63 @@ static qhandle_t    net_logFile;
 static struct pollfd    io_entries[MAX_POLL_FDS];
 static int              io_numfds;
 
+#if USE_EPOLL
+
+// kernel side registration state of io entry
+typedef struct {
+    qsocket_t   fd;
+    short       events;
+    bool        registered;
+    bool        pollable;   // false for regular files epoll can't handle
+    bool        dirty;
+} ioreg_t;
+
+static int              io_epfd = -1;
+static bool             io_epoll_failed;
+static ioreg_t          io_regs[MAX_POLL_FDS];
+
+// entries that need to be synced with kernel before next wait
+static int              io_dirty[MAX_POLL_FDS];
+static int              io_numdirty;
+
+// entries whose revents were set by last wait
+static int              io_ready[MAX_POLL_FDS];
+static int              io_numready;
+
+// number of registered entries epoll can't handle
+static int              io_numunpollable;
+
+static struct epoll_event   io_events[MAX_POLL_FDS];
+
+#endif
+
+#if USE_MMSG
+
+#define MAX_PACKET_BATCH    64
+
+typedef struct {
+    struct mmsghdr          hdrs[MAX_PACKET_BATCH];
+    struct iovec            iovs[MAX_PACKET_BATCH];
+    struct sockaddr_storage addrs[MAX_PACKET_BATCH];
+    byte                    data[MAX_PACKET_BATCH][MAX_PACKETLEN];
+} udpbatch_t;
+
+// ring of buffers incoming datagrams are drained into
+static udpbatch_t       udp_recv;
+
+// outgoing datagrams queued between NET_BeginPacketBatch and
+// NET_FlushPacketBatch
+static udpbatch_t       udp_send;
+static netadr_t         udp_send_adrs[MAX_PACKET_BATCH];
+static qsocket_t        udp_send_fds[MAX_PACKET_BATCH];
+static int              udp_send_count;
+static bool             udp_send_batch;
+
+// cleared if kernel doesn't support batching syscalls
+static bool             udp_mmsg_ok = true;
+
+#endif
+
 // current rate measurement
 static unsigned     net_rate_time;
 static size_t       net_rate_rcvd;
@@ -142,6 +208,10 @@ static uint64_t     net_bytes_rcvd;
 static uint64_t     net_bytes_sent;
 static uint64_t     net_packets_rcvd;
 static uint64_t     net_packets_sent;
+#if USE_MMSG
+static uint64_t     net_recv_batches;
+static uint64_t     net_send_batches;
+#endif
 
 //=============================================================================
 
@@ -514,6 +584,10 @@ static void NET_Stats_f(void)
                net_packets_sent, net_packets_sent / diff);
     Com_Printf("Packets rcvd: %"PRIu64" (%"PRIu64" packets/sec)\n",
                net_packets_rcvd, net_packets_rcvd / diff);
+#if USE_MMSG
+    Com_Printf("Batched syscalls: %"PRIu64"/%"PRIu64" (send/recv)\n",
+               net_send_batches, net_recv_batches);
+#endif
 #if USE_ICMP
     Com_Printf("Total errors: %"PRIu64"/%"PRIu64"/%"PRIu64" (send/recv/icmp)\n",
                net_send_errors, net_recv_errors, net_icmp_errors);
@@ -657,9 +731,160 @@ const char *NET_ErrorString(void)
     return os_error_string(net_error);
 }
 
+#if USE_EPOLL
+
+/*
+=============
+NET_DirtyPollFd
+
+Schedules io entry to be synced with epoll set before next wait.
+=============
+*/
+static void NET_DirtyPollFd(struct pollfd *e)
+{
+    int i = e - io_entries;
+
+    if (io_epfd == -1 || io_regs[i].dirty)
+        return;
+
+    io_regs[i].dirty = true;
+    io_dirty[io_numdirty++] = i;
+}
+
+static void NET_UnregisterPollFd(int i)
+{
+    ioreg_t *r = &io_regs[i];
+
+    if (!r->registered)
+        return;
+
+    if (r->pollable)
+        os_epoll_del(io_epfd, r->fd);
+    else
+        io_numunpollable--;
+
+    r->registered = false;
+}
+
+/*
+=============
+NET_SyncPollFds
+
+Applies all pending changes to epoll set. Only entries that were allocated,
+freed or had their events changed since last wait are visited.
+=============
+*/
+static void NET_SyncPollFds(void)
+{
+    struct pollfd *e;
+    ioreg_t *r;
+    int i, j;
+
+    for (i = 0; i < io_numdirty; i++) {
+        j = io_dirty[i];
+        e = &io_entries[j];
+        r = &io_regs[j];
+
+        r->dirty = false;
+
+        if (j >= io_numfds || e->fd == -1) {
+            NET_UnregisterPollFd(j);
+            continue;
+        }
+
+        if (r->registered && r->fd == e->fd && r->events == e->events)
+            continue;
+
+        if (r->registered && r->fd != e->fd)
+            NET_UnregisterPollFd(j);
+
+        if (r->registered && !r->pollable) {
+            r->events = e->events;
+            continue;
+        }
+
+        if (os_epoll_set(io_epfd, e->fd, e->events, j, !r->registered)) {
+            // regular files are always ready, handle them like poll() does
+            if (net_error != EPERM) {
+                Com_EPrintf("%s: %s\n", __func__, NET_ErrorString());
+                continue;
+            }
+            if (!r->registered || r->pollable)
+                io_numunpollable++;
+            r->pollable = false;
+        } else {
+            r->pollable = true;
+        }
+
+        r->fd = e->fd;
+        r->events = e->events;
+        r->registered = true;
+    }
+
+    io_numdirty = 0;
+}
+
+static int NET_SleepEpoll(int msec)
+{
+    struct pollfd *e;
+    int i, j, ret;
+
+    NET_SyncPollFds();
+
+    // clear results of previous wait
+    for (i = 0; i < io_numready; i++)
+        io_entries[io_ready[i]].revents = 0;
+    io_numready = 0;
+
+    // report entries epoll can't handle as ready without waiting
+    if (io_numunpollable) {
+        for (i = 0, e = io_entries; i < io_numfds; i++, e++) {
+            if (e->fd == -1 || !io_regs[i].registered || io_regs[i].pollable)
+                continue;
+            e->revents = e->events & (POLLIN | POLLOUT);
+            if (e->revents)
+                io_ready[io_numready++] = i;
+        }
+        if (io_numready)
+            msec = 0;
+    }
+
+    ret = os_epoll_wait(io_epfd, io_events, MAX_POLL_FDS, msec);
+    if (ret == -1) {
+        Com_EPrintf("%s: %s\n", __func__, NET_ErrorString());
+        return -1;
+    }
+
+    for (i = 0; i < ret; i++) {
+        j = io_events[i].data.u32;
+        e = &io_entries[j];
+        if (j >= io_numfds || e->fd == -1)
+            continue;
+        e->revents = os_epoll_to_poll(io_events[i].events);
+        io_ready[io_numready++] = j;
+    }
+
+    return io_numready;
+}
+
+#else
+#define NET_DirtyPollFd(e)  (void)0
+#endif // USE_EPOLL
+
+static void NET_SetPollEvents(struct pollfd *e, int events)
+{
+    if (e->events != events) {
+        e->events = events;
+        NET_DirtyPollFd(e);
+    }
+}
+
 /*
 =============
 NET_AllocPollFd
+
+Caller is expected to fill in descriptor and events before next NET_Sleep
+call. Later changes to events must go through NET_SetPollEvents.
 =============
 */
 struct pollfd *NET_AllocPollFd(void)
@@ -667,6 +892,16 @@ struct pollfd *NET_AllocPollFd(void)
     struct pollfd *e;
     int i;
 
+#if USE_EPOLL
+    if (io_epfd == -1 && !io_epoll_failed) {
+        io_epfd = os_epoll_create();
+        if (io_epfd == -1) {
+            Com_WPrintf("Couldn't create epoll instance: %s\n", NET_ErrorString());
+            io_epoll_failed = true;
+        }
+    }
+#endif
+
     for (i = 0, e = io_entries; i < io_numfds; i++, e++)
         if (e->fd == -1)
             break;
@@ -678,6 +913,7 @@ struct pollfd *NET_AllocPollFd(void)
     }
 
     e->events = e->revents = 0;
+    NET_DirtyPollFd(e);
     return e;
 }
 
@@ -690,6 +926,12 @@ void NET_FreePollFd(struct pollfd *e)
 {
     int i;
 
+#if USE_EPOLL
+    // unregister immediately, descriptor may be reused before next wait
+    if (io_epfd != -1)
+        NET_UnregisterPollFd(e - io_entries);
+#endif
+
     e->fd = -1;
     e->events = e->revents = 0;
 
@@ -719,6 +961,11 @@ int NET_Sleep(int msec)
         return 0;
     }
 
+#if USE_EPOLL
+    if (io_epfd != -1)
+        return NET_SleepEpoll(msec);
+#endif
+
     ret = os_poll(io_entries, io_numfds, msec);
     if (ret == -1)
         Com_EPrintf("%s: %s\n", __func__, NET_ErrorString());
@@ -748,6 +995,81 @@ int NET_Sleep1(int msec, struct pollfd *e)
 
 //=============================================================================
 
+#if USE_MMSG
+
+/*
+=============
+NET_GetUdpBatch
+
+Drains socket with recvmmsg() into ring of buffers. Returns false if
+batching is not supported and caller should fall back to recvfrom().
+=============
+*/
+static bool NET_GetUdpBatch(struct pollfd *sock, void (*packet_cb)(void))
+{
+    struct mmsghdr *hdr;
+    int i, ret, len;
+
+    while (1) {
+        for (i = 0, hdr = udp_recv.hdrs; i < MAX_PACKET_BATCH; i++, hdr++) {
+            udp_recv.iovs[i].iov_base = udp_recv.data[i];
+            udp_recv.iovs[i].iov_len = MAX_PACKETLEN;
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->msg_hdr.msg_name = &udp_recv.addrs[i];
+            hdr->msg_hdr.msg_namelen = sizeof(udp_recv.addrs[i]);
+            hdr->msg_hdr.msg_iov = &udp_recv.iovs[i];
+            hdr->msg_hdr.msg_iovlen = 1;
+        }
+
+        ret = os_udp_recv_many(sock->fd, udp_recv.hdrs, MAX_PACKET_BATCH);
+        if (ret == NET_AGAIN) {
+            sock->revents = 0;
+            break;
+        }
+
+        if (ret == NET_ERROR) {
+            if (net_error == ENOSYS) {
+                Com_DPrintf("%s: batching not supported\n", __func__);
+                udp_mmsg_ok = false;
+                return false;
+            }
+            Com_DPrintf("%s: %s\n", __func__, NET_ErrorString());
+            net_recv_errors++;
+            break;
+        }
+
+        net_recv_batches++;
+
+        for (i = 0, hdr = udp_recv.hdrs; i < ret; i++, hdr++) {
+            len = hdr->msg_len;
+
+            NET_SockadrToNetadr(&udp_recv.addrs[i], &net_from);
+
+            NET_LogPacket(&net_from, "UDP recv", udp_recv.data[i], len);
+
+            net_rate_rcvd += len;
+            net_bytes_rcvd += len;
+            net_packets_rcvd++;
+
+            // callbacks expect msg_read to be backed by msg_read_buffer
+            memcpy(msg_read_buffer, udp_recv.data[i], len);
+            SZ_InitRead(&msg_read, msg_read_buffer, len);
+
+            (*packet_cb)();
+        }
+
+        // socket is drained, don't waste another syscall
+        if (ret < MAX_PACKET_BATCH) {
+            sock->revents = 0;
+            break;
+        }
+    }
+
+    return true;
+}
+
+#endif // USE_MMSG
+
 static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
 {
     int ret;
@@ -760,6 +1082,11 @@ static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
     if (!(sock->revents & (POLLIN | POLLERR)))
         return;
 
+#if USE_MMSG
+    if (udp_mmsg_ok && NET_GetUdpBatch(sock, packet_cb))
+        return;
+#endif
+
     while (1) {
         ret = os_udp_recv(sock->fd, msg_read_buffer, MAX_PACKETLEN, &net_from);
         if (ret == NET_AGAIN) {
@@ -811,6 +1138,147 @@ void NET_GetPackets(netsrc_t sock, void (*packet_cb)(void))
     NET_GetUdpPackets(udp6_sockets[sock], packet_cb);
 }
 
+static void NET_UdpPacketSent(const netadr_t *to, const void *data,
+                              size_t len, size_t ret)
+{
+    if (ret < len)
+        Com_WPrintf("%s: short send to %s\n", __func__,
+                    NET_AdrToString(to));
+
+    NET_LogPacket(to, "UDP send", data, ret);
+
+    net_rate_sent += ret;
+    net_bytes_sent += ret;
+    net_packets_sent++;
+}
+
+#if USE_MMSG
+
+/*
+=============
+NET_SendUdpBatch
+
+Sends queued datagrams with sendmmsg(), one syscall per run of datagrams
+going through the same socket.
+=============
+*/
+static void NET_SendUdpBatch(void)
+{
+    int i, j, k, ret;
+
+    for (i = 0; i < udp_send_count; i = j) {
+        for (j = i + 1; j < udp_send_count; j++)
+            if (udp_send_fds[j] != udp_send_fds[i])
+                break;
+
+        while (i < j) {
+            ret = os_udp_send_many(udp_send_fds[i], &udp_send.hdrs[i],
+                                   j - i, &udp_send_adrs[i]);
+            if (ret == NET_AGAIN) {
+                // socket buffer is full, rest of the run is lost
+                Com_DPrintf("%s: dropped %d datagrams\n", __func__, j - i);
+                net_send_errors += j - i;
+                break;
+            }
+
+            if (ret == NET_ERROR) {
+                if (net_error == ENOSYS) {
+                    Com_DPrintf("%s: batching not supported\n", __func__);
+                    udp_mmsg_ok = false;
+                    // send the rest one by one
+                    for (k = i; k < j; k++) {
+                        ret = os_udp_send(udp_send_fds[k], udp_send.data[k],
+                                          udp_send.iovs[k].iov_len, &udp_send_adrs[k]);
+                        if (ret == NET_AGAIN || ret == NET_ERROR) {
+                            Com_DPrintf("%s: %s to %s\n", __func__,
+                                        ret == NET_AGAIN ? "dropped" : NET_ErrorString(),
+                                        NET_AdrToString(&udp_send_adrs[k]));
+                            net_send_errors++;
+                            continue;
+                        }
+                        NET_UdpPacketSent(&udp_send_adrs[k], udp_send.data[k],
+                                          udp_send.iovs[k].iov_len, ret);
+                    }
+                    break;
+                }
+                // skip offending datagram and continue with the rest
+                Com_DPrintf("%s: %s to %s\n", __func__,
+                            NET_ErrorString(), NET_AdrToString(&udp_send_adrs[i]));
+                net_send_errors++;
+                i++;
+                continue;
+            }
+
+            net_send_batches++;
+
+            for (k = i; k < i + ret; k++)
+                NET_UdpPacketSent(&udp_send_adrs[k], udp_send.data[k],
+                                  udp_send.iovs[k].iov_len, udp_send.hdrs[k].msg_len);
+
+            i += ret;
+        }
+    }
+
+    udp_send_count = 0;
+}
+
+static bool NET_QueueUdpPacket(qsocket_t fd, const void *data,
+                               size_t len, const netadr_t *to)
+{
+    struct mmsghdr *hdr;
+    int i;
+
+    if (udp_send_count == MAX_PACKET_BATCH)
+        NET_SendUdpBatch();
+
+    i = udp_send_count++;
+    hdr = &udp_send.hdrs[i];
+
+    memcpy(udp_send.data[i], data, len);
+    udp_send.iovs[i].iov_base = udp_send.data[i];
+    udp_send.iovs[i].iov_len = len;
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_hdr.msg_name = &udp_send.addrs[i];
+    hdr->msg_hdr.msg_namelen = NET_NetadrToSockadr(to, &udp_send.addrs[i]);
+    hdr->msg_hdr.msg_iov = &udp_send.iovs[i];
+    hdr->msg_hdr.msg_iovlen = 1;
+
+    udp_send_adrs[i] = *to;
+    udp_send_fds[i] = fd;
+
+    return true;
+}
+
+/*
+=============
+NET_BeginPacketBatch
+
+Starts queuing outgoing UDP datagrams instead of sending them immediately.
+=============
+*/
+void NET_BeginPacketBatch(void)
+{
+    udp_send_batch = true;
+}
+
+/*
+=============
+NET_FlushPacketBatch
+
+Sends all queued datagrams and stops queuing.
+=============
+*/
+void NET_FlushPacketBatch(void)
+{
+    if (udp_send_count)
+        NET_SendUdpBatch();
+
+    udp_send_batch = false;
+}
+
+#endif // USE_MMSG
+
 /*
 =============
 NET_SendPacket
@@ -853,6 +1321,11 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
     if (!s)
         return false;
 
+#if USE_MMSG
+    if (udp_send_batch && udp_mmsg_ok)
+        return NET_QueueUdpPacket(s->fd, data, len, to);
+#endif
+
     ret = os_udp_send(s->fd, data, len, to);
     if (ret == NET_AGAIN)
         return false;
@@ -864,16 +1337,7 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
         return false;
     }
 
-    if (ret < len)
-        Com_WPrintf("%s: short send to %s\n", __func__,
-                    NET_AdrToString(to));
-
-    NET_LogPacket(to, "UDP send", data, ret);
-
-    net_rate_sent += ret;
-    net_bytes_sent += ret;
-    net_packets_sent++;
-
+    NET_UdpPacketSent(to, data, len, ret);
     return true;
 }
 
@@ -1004,7 +1468,7 @@ static struct pollfd *UDP_OpenSocket(const char *iface, int port, int family)
         }
 
         sock->fd = s;
-        sock->events = POLLIN;
+        NET_SetPollEvents(sock, POLLIN);
         break;
     }
 
@@ -1113,7 +1577,7 @@ static struct pollfd *TCP_OpenSocket(const char *iface, int port, int family, ne
         }
 
         sock->fd = s;
-        sock->events = POLLIN;
+        NET_SetPollEvents(sock, POLLIN);
         break;
     }
 
@@ -1213,6 +1677,65 @@ static void NET_OpenClient6(void)
 }
 #endif
 
+#if USE_LOADGEN
+
+/*
+====================
+NET_OpenLoadgenSocket
+
+Opens UDP socket bound to random port for talking to server of given
+address type. Server identifies clients by qport, but sends replies to
+source port of each client, so each simulated client needs its own socket
+to tell the replies apart. Returns socket number usable as netsrc_t, or -1
+on failure.
+====================
+*/
+int NET_OpenLoadgenSocket(netadrtype_t type)
+{
+    struct pollfd *s;
+    int i;
+
+    for (i = NS_COUNT; i < NS_TOTAL; i++)
+        if (!udp_sockets[i] && !udp6_sockets[i])
+            break;
+
+    if (i == NS_TOTAL) {
+        Com_EPrintf("%s: too many sockets\n", __func__);
+        return -1;
+    }
+
+    if (type == NA_IP6) {
+        s = UDP_OpenSocket(net_ip6->string, PORT_ANY, AF_INET6);
+        udp6_sockets[i] = s;
+    } else {
+        s = UDP_OpenSocket(net_ip->string, PORT_ANY, AF_INET);
+        udp_sockets[i] = s;
+    }
+
+    return s ? i : -1;
+}
+
+/*
+====================
+NET_CloseLoadgenSocket
+====================
+*/
+void NET_CloseLoadgenSocket(netsrc_t sock)
+{
+    Q_assert(sock >= NS_COUNT && sock < NS_TOTAL);
+
+    if (udp_sockets[sock]) {
+        NET_CloseSocket(udp_sockets[sock]);
+        udp_sockets[sock] = NULL;
+    }
+    if (udp6_sockets[sock]) {
+        NET_CloseSocket(udp6_sockets[sock]);
+        udp6_sockets[sock] = NULL;
+    }
+}
+
+#endif // USE_LOADGEN
+
 /*
 ====================
 NET_Config
@@ -1409,7 +1932,7 @@ static neterr_t NET_AcceptSocket(netstream_t *s, struct pollfd *sock)
 
     // initialize io entry
     newsock->fd = newsocket;
-    newsock->events = POLLIN;
+    NET_SetPollEvents(newsock, POLLIN);
 
     // initialize stream
     memset(s, 0, sizeof(*s));
@@ -1461,7 +1984,7 @@ neterr_t NET_Connect(const netadr_t *peer, netstream_t *s)
     }
 
     // initialize io entry
-    socket->events = POLLOUT;
+    NET_SetPollEvents(socket, POLLOUT);
 
     // initialize stream
     memset(s, 0, sizeof(*s));
@@ -1492,13 +2015,13 @@ neterr_t NET_RunConnect(netstream_t *s)
 
     if (e->revents & POLLHUP) {
         s->state = NS_CLOSED;
-        e->events = 0;
+        NET_SetPollEvents(e, 0);
         return NET_CLOSED;
     }
 
     if (e->revents & POLLOUT) {
         s->state = NS_CONNECTED;
-        e->events = POLLIN;
+        NET_SetPollEvents(e, POLLIN);
         return NET_OK;
     }
 
@@ -1506,7 +2029,7 @@ neterr_t NET_RunConnect(netstream_t *s)
 
 fail:
     s->state = NS_BROKEN;
-    e->events = 0;
+    NET_SetPollEvents(e, 0);
     return NET_ERROR;
 }
 
@@ -1522,15 +2045,15 @@ void NET_UpdateStream(netstream_t *s)
 
     FIFO_Reserve(&s->recv, &len);
     if (len)
-        e->events |= POLLIN;
+        NET_SetPollEvents(e, e->events | POLLIN);
     else
-        e->events &= ~POLLIN;
+        NET_SetPollEvents(e, e->events & ~POLLIN);
 
     FIFO_Peek(&s->send, &len);
     if (len)
-        e->events |= POLLOUT;
+        NET_SetPollEvents(e, e->events | POLLOUT);
     else
-        e->events &= ~POLLOUT;
+        NET_SetPollEvents(e, e->events & ~POLLOUT);
 }
 
 // returns NET_OK only when there was some data read
@@ -1583,7 +2106,7 @@ neterr_t NET_RunStream(netstream_t *s)
                 // now see if there's more space to read
                 FIFO_Reserve(&s->recv, &len);
                 if (!len) {
-                    e->events &= ~POLLIN;
+                    NET_SetPollEvents(e, e->events & ~POLLIN);
                 }
             }
         }
@@ -1615,7 +2138,7 @@ neterr_t NET_RunStream(netstream_t *s)
                 // now see if there's more data to write
                 FIFO_Peek(&s->send, &len);
                 if (!len) {
-                    e->events &= ~POLLOUT;
+                    NET_SetPollEvents(e, e->events & ~POLLOUT);
                 }
             }
         }
@@ -1625,12 +2148,12 @@ neterr_t NET_RunStream(netstream_t *s)
 
 closed:
     s->state = NS_CLOSED;
-    e->events &= ~POLLIN;
+    NET_SetPollEvents(e, e->events & ~POLLIN);
     return NET_CLOSED;
 
 error:
     s->state = NS_BROKEN;
-    e->events = 0;
+    NET_SetPollEvents(e, 0);
     return NET_ERROR;
 }
 
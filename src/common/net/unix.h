@@ -163,6 +163,60 @@ static int os_udp_send(qsocket_t sock, const void *data,
     return NET_ERROR;
 }
 
+#if USE_MMSG
+
+// receives up to `count' datagrams, returns number of datagrams received
+static int os_udp_recv_many(qsocket_t sock, struct mmsghdr *msgs, int count)
+{
+    int ret;
+    int tries;
+
+    for (tries = 0; tries < MAX_ERROR_RETRIES; tries++) {
+        ret = recvmmsg(sock, msgs, count, MSG_DONTWAIT, NULL);
+        if (ret >= 0)
+            return ret;
+
+        net_error = errno;
+
+        // wouldblock is silent
+        if (net_error == EWOULDBLOCK)
+            return NET_AGAIN;
+
+        if (!process_error_queue(sock, NULL))
+            break;
+    }
+
+    return NET_ERROR;
+}
+
+// sends up to `count' datagrams, returns number of datagrams sent.
+// on error, `to' is the destination of the first datagram.
+static int os_udp_send_many(qsocket_t sock, struct mmsghdr *msgs, int count,
+                            const netadr_t *to)
+{
+    int ret;
+    int tries;
+
+    for (tries = 0; tries < MAX_ERROR_RETRIES; tries++) {
+        ret = sendmmsg(sock, msgs, count, 0);
+        if (ret >= 0)
+            return ret;
+
+        net_error = errno;
+
+        // wouldblock is silent
+        if (net_error == EWOULDBLOCK)
+            return NET_AGAIN;
+
+        if (!process_error_queue(sock, to))
+            break;
+    }
+
+    return NET_ERROR;
+}
+
+#endif // USE_MMSG
+
 static neterr_t os_get_error(void)
 {
     net_error = errno;
@@ -329,6 +383,89 @@ static int os_poll(struct pollfd *fds, int nfds, int timeout)
     return ret;
 }
 
+#if USE_EPOLL
+
+static int os_epoll_create(void)
+{
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (fd == -1)
+        net_error = errno;
+
+    return fd;
+}
+
+static uint32_t os_poll_to_epoll(int events)
+{
+    uint32_t ev = 0;
+
+    if (events & POLLIN)
+        ev |= EPOLLIN;
+    if (events & POLLOUT)
+        ev |= EPOLLOUT;
+
+    return ev;
+}
+
+static int os_epoll_to_poll(uint32_t ev)
+{
+    int events = 0;
+
+    if (ev & EPOLLIN)
+        events |= POLLIN;
+    if (ev & EPOLLOUT)
+        events |= POLLOUT;
+    if (ev & EPOLLERR)
+        events |= POLLERR;
+    if (ev & EPOLLHUP)
+        events |= POLLHUP;
+
+    return events;
+}
+
+// adds or modifies registration of `fd', tolerating stale state
+// left by descriptors that were closed and reused
+static neterr_t os_epoll_set(int epfd, qsocket_t fd, int events,
+                             uint32_t index, bool add)
+{
+    struct epoll_event ev = {
+        .events = os_poll_to_epoll(events),
+        .data.u32 = index
+    };
+
+    if (epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) == 0)
+        return NET_OK;
+
+    if (errno == (add ? EEXIST : ENOENT) &&
+        epoll_ctl(epfd, add ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == 0)
+        return NET_OK;
+
+    net_error = errno;
+    return NET_ERROR;
+}
+
+static void os_epoll_del(int epfd, qsocket_t fd)
+{
+    // descriptor may be already closed, ignore errors
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int os_epoll_wait(int epfd, struct epoll_event *events,
+                         int maxevents, int timeout)
+{
+    int ret = epoll_wait(epfd, events, maxevents, timeout);
+
+    if (ret == -1) {
+        net_error = errno;
+        if (net_error == EINTR)
+            return 0;
+    }
+
+    return ret;
+}
+
+#endif // USE_EPOLL
+
 static neterr_t os_connect_hack(struct pollfd *e)
 {
     return NET_OK;
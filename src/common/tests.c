@@ -19,8 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shared/shared.h"
 #include "common/bsp.h"
 #include "common/cmd.h"
+#include "common/cmodel.h"
 #include "common/common.h"
 #include "common/files.h"
+#include "common/hash_map.h"
 #include "common/mdfour.h"
 #include "common/tests.h"
 #include "common/utils.h"
@@ -196,6 +198,379 @@ static void BSP_Test_f(void)
     FS_FreeList(list);
 }
 
+// trace benchmark file is TRACEBENCH_IDENT followed by
+// little endian floats: start, end, mins, maxs for each trace
+#define TRACEBENCH_IDENT    MakeLittleLong('T','R','C','B')
+
+typedef struct {
+    vec3_t  start, end, mins, maxs;
+} tracetest_t;
+
+static const cmd_option_t o_tracebench[] = {
+    { "h", "help", "display this message" },
+    { "n:count", "count", "generate <count> random traces (default 100000)" },
+    { "s:seed", "seed", "use <seed> for random traces (default 0)" },
+    { "r:number", "repeat", "run all traces <number> of times (default 1)" },
+    { "i:file", "input", "replay traces recorded in <file>" },
+    { "o:file", "output", "record generated traces to <file>" },
+    { "c", "compare", "check that SIMD and scalar brush clipping give "
+      "bit-identical results" },
+    { NULL }
+};
+
+static void Com_GenerateTraces(const bsp_t *bsp, tracetest_t *tests, int count)
+{
+    const mmodel_t *world = &bsp->models[0];
+    tracetest_t *t;
+    int i, j;
+
+    for (i = 0, t = tests; i < count; i++, t++) {
+        for (j = 0; j < 3; j++)
+            t->start[j] = world->mins[j] + frand() * (world->maxs[j] - world->mins[j]);
+
+        // 1/8 position tests, the rest are sweeps of up to 512 units
+        if (Q_rand_uniform(8))
+            for (j = 0; j < 3; j++)
+                t->end[j] = t->start[j] + crand() * 512;
+        else
+            VectorCopy(t->start, t->end);
+
+        // half are player hulls, quarter are points, quarter are random boxes
+        switch (Q_rand_uniform(4)) {
+        case 0:
+        case 1:
+            VectorSet(t->mins, -16, -16, -24);
+            VectorSet(t->maxs, 16, 16, 32);
+            break;
+        case 2:
+            VectorClear(t->mins);
+            VectorClear(t->maxs);
+            break;
+        default:
+            for (j = 0; j < 3; j++) {
+                t->mins[j] = -frand() * 32;
+                t->maxs[j] = frand() * 32;
+            }
+            break;
+        }
+    }
+}
+
+static void Com_ChecksumTrace(struct mdfour *md, const trace_t *tr)
+{
+    float buf[8];
+    int flags[4];
+
+    buf[0] = LittleFloat(tr->fraction);
+    buf[1] = LittleFloat(tr->endpos[0]);
+    buf[2] = LittleFloat(tr->endpos[1]);
+    buf[3] = LittleFloat(tr->endpos[2]);
+    buf[4] = LittleFloat(tr->plane.normal[0]);
+    buf[5] = LittleFloat(tr->plane.normal[1]);
+    buf[6] = LittleFloat(tr->plane.normal[2]);
+    buf[7] = LittleFloat(tr->plane.dist);
+    flags[0] = LittleLong(tr->allsolid);
+    flags[1] = LittleLong(tr->startsolid);
+    flags[2] = LittleLong(tr->contents);
+    flags[3] = LittleLong(tr->surface->flags);
+
+    mdfour_update(md, (uint8_t *)buf, sizeof(buf));
+    mdfour_update(md, (uint8_t *)flags, sizeof(flags));
+    mdfour_update(md, (uint8_t *)tr->surface->name, strlen(tr->surface->name));
+}
+
+static bool Com_TracesEqual(const trace_t *a, const trace_t *b)
+{
+    return !memcmp(&a->fraction, &b->fraction, sizeof(a->fraction))
+        && !memcmp(a->endpos, b->endpos, sizeof(a->endpos))
+        && !memcmp(a->plane.normal, b->plane.normal, sizeof(a->plane.normal))
+        && !memcmp(&a->plane.dist, &b->plane.dist, sizeof(a->plane.dist))
+        && a->allsolid == b->allsolid
+        && a->startsolid == b->startsolid
+        && a->contents == b->contents
+        && a->surface == b->surface;
+}
+
+// runs each trace with SIMD brush clipping on and off, returns number of
+// traces with different results
+static int Com_CompareTraces(const cm_t *cm, const tracetest_t *tests, int count)
+{
+    cvar_t *var = Cvar_FindVar("map_brush_simd");
+    int i, simd, errors = 0;
+    trace_t tr[2];
+
+    if (!var) {
+        Com_Printf("SIMD brush clipping not compiled in.\n");
+        return 0;
+    }
+
+    simd = var->integer;
+    for (i = 0; i < count; i++) {
+        Cvar_SetInteger(var, 1, FROM_CODE);
+        CM_BoxTrace(&tr[0], tests[i].start, tests[i].end, tests[i].mins, tests[i].maxs,
+                    cm->cache->nodes, MASK_PLAYERSOLID, false);
+        Cvar_SetInteger(var, 0, FROM_CODE);
+        CM_BoxTrace(&tr[1], tests[i].start, tests[i].end, tests[i].mins, tests[i].maxs,
+                    cm->cache->nodes, MASK_PLAYERSOLID, false);
+        if (!Com_TracesEqual(&tr[0], &tr[1])) {
+            if (errors++ < 10)
+                Com_Printf("Trace %d differs: fraction %.9g vs %.9g\n",
+                           i, tr[0].fraction, tr[1].fraction);
+        }
+    }
+    Cvar_SetInteger(var, simd, FROM_CODE);
+
+    return errors;
+}
+
+static void Com_TraceBench_f(void)
+{
+    char *input = NULL, *output = NULL;
+    int c, i, count = 100000, seed = 0, repeat = 1;
+    bool compare = false;
+    tracetest_t *tests = NULL;
+    struct mdfour md;
+    uint8_t digest[16];
+    unsigned start, msec;
+    trace_t tr;
+    cm_t cm;
+    float *in;
+    int ret, len;
+
+    while ((c = Cmd_ParseOptions(o_tracebench)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_tracebench, "<mapname>");
+            Com_Printf("Benchmark collision detection on the given map.\n");
+            Cmd_PrintHelp(o_tracebench);
+            return;
+        case 'n':
+            count = Q_atoi(cmd_optarg);
+            break;
+        case 's':
+            seed = Q_atoi(cmd_optarg);
+            break;
+        case 'r':
+            repeat = Q_atoi(cmd_optarg);
+            break;
+        case 'i':
+            input = cmd_optarg;
+            break;
+        case 'o':
+            output = cmd_optarg;
+            break;
+        case 'c':
+            compare = true;
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (cmd_optind == Cmd_Argc()) {
+        Com_Printf("Missing map name argument.\n");
+        Cmd_PrintHint();
+        return;
+    }
+
+    if (count < 1 || repeat < 1) {
+        Com_Printf("Bad count or repeat value.\n");
+        return;
+    }
+
+    ret = CM_LoadMap(&cm, va("maps/%s.bsp", Cmd_Argv(cmd_optind)));
+    if (ret) {
+        Com_EPrintf("Couldn't load %s: %s\n", Cmd_Argv(cmd_optind), BSP_ErrorString(ret));
+        return;
+    }
+
+    if (input) {
+        len = FS_LoadFile(input, (void **)&in);
+        if (!in) {
+            Com_EPrintf("Couldn't load %s: %s\n", input, Q_ErrorString(len));
+            goto fail;
+        }
+        if (len < 4 || (len - 4) % sizeof(tracetest_t) || LittleLong(*(uint32_t *)in) != TRACEBENCH_IDENT) {
+            Com_EPrintf("%s is not a trace benchmark file\n", input);
+            FS_FreeFile(in);
+            goto fail;
+        }
+        count = (len - 4) / sizeof(tracetest_t);
+        tests = Z_Malloc(count * sizeof(tests[0]));
+        for (i = 0; i < count * 12; i++)
+            ((float *)tests)[i] = LittleFloat(in[i + 1]);
+        FS_FreeFile(in);
+    } else {
+        tests = Z_Malloc(count * sizeof(tests[0]));
+        Q_srand(seed);
+        Com_GenerateTraces(cm.cache, tests, count);
+    }
+
+    if (output) {
+        len = 4 + count * sizeof(tests[0]);
+        in = Z_Malloc(len);
+        *(uint32_t *)in = LittleLong(TRACEBENCH_IDENT);
+        for (i = 0; i < count * 12; i++)
+            in[i + 1] = LittleFloat(((float *)tests)[i]);
+        ret = FS_WriteFile(output, in, len);
+        Z_Free(in);
+        if (ret)
+            Com_EPrintf("Couldn't write %s: %s\n", output, Q_ErrorString(ret));
+        else
+            Com_Printf("Wrote %d traces to %s\n", count, output);
+    }
+
+    if (compare) {
+        c = Com_CompareTraces(&cm, tests, count);
+        Com_Printf("%d of %d traces differ between SIMD and scalar code\n", c, count);
+        goto done;
+    }
+
+    start = Sys_Milliseconds();
+    for (c = 0; c < repeat; c++)
+        for (i = 0; i < count; i++)
+            CM_BoxTrace(&tr, tests[i].start, tests[i].end, tests[i].mins, tests[i].maxs,
+                        cm.cache->nodes, MASK_PLAYERSOLID, false);
+    msec = Sys_Milliseconds() - start;
+
+    // checksum is computed separately to not affect timing
+    mdfour_begin(&md);
+    for (i = 0; i < count; i++) {
+        CM_BoxTrace(&tr, tests[i].start, tests[i].end, tests[i].mins, tests[i].maxs,
+                    cm.cache->nodes, MASK_PLAYERSOLID, false);
+        Com_ChecksumTrace(&md, &tr);
+    }
+    mdfour_result(&md, digest);
+
+    Com_Printf("%d traces in %u msec, %.0f traces/sec\n", count * repeat, msec,
+               msec ? count * repeat * 1000.0 / msec : 0.0);
+    Com_Printf("Checksum: ");
+    for (i = 0; i < 16; i++)
+        Com_Printf("%02x", digest[i]);
+    Com_Printf("\n");
+
+done:
+    Z_Free(tests);
+fail:
+    CM_FreeMap(&cm);
+}
+
+static const cmd_option_t o_hashbench[] = {
+    { "h", "help", "display this message" },
+    { "n:count", "count", "use <count> random keys (default 1000000)" },
+    { "s:seed", "seed", "use <seed> for random keys (default 0)" },
+    { NULL }
+};
+
+enum {
+    HB_INSERT,
+    HB_LOOKUP,
+    HB_MISS,
+    HB_ERASE,
+    HB_MIXED,
+
+    HB_NUM_TESTS
+};
+
+static const char *const hashbench_names[HB_NUM_TESTS] = {
+    "insert", "lookup", "miss", "erase", "mixed"
+};
+
+// keys below `count' are inserted, the rest are only looked up.
+// returns checksum of all operation results to compare maps.
+static uint32_t Com_RunHashBench(hash_map_t *map, const uint32_t *keys, int count, unsigned *msec)
+{
+    uint32_t sum = 0, *val;
+    unsigned start;
+    int i;
+
+    start = Sys_Milliseconds();
+    for (i = 0; i < count; i++)
+        sum += HashMap_Insert(map, &keys[i], &i);
+    msec[HB_INSERT] = Sys_Milliseconds() - start;
+
+    start = Sys_Milliseconds();
+    for (i = 0; i < count; i++)
+        if ((val = HashMap_Lookup(uint32_t, map, &keys[i])))
+            sum += *val;
+    msec[HB_LOOKUP] = Sys_Milliseconds() - start;
+
+    start = Sys_Milliseconds();
+    for (i = count; i < count * 2; i++)
+        if ((val = HashMap_Lookup(uint32_t, map, &keys[i])))
+            sum += *val;
+    msec[HB_MISS] = Sys_Milliseconds() - start;
+
+    start = Sys_Milliseconds();
+    for (i = 0; i < count; i += 2)
+        sum += HashMap_Erase(map, &keys[i]);
+    msec[HB_ERASE] = Sys_Milliseconds() - start;
+
+    start = Sys_Milliseconds();
+    for (i = 0; i < count * 2; i++)
+        if ((val = HashMap_Lookup(uint32_t, map, &keys[i])))
+            sum += *val;
+    msec[HB_MIXED] = Sys_Milliseconds() - start;
+
+    return sum + HashMap_Size(map);
+}
+
+static void Com_HashBench_f(void)
+{
+    unsigned msec[2][HB_NUM_TESTS];
+    uint32_t sum[2], *keys;
+    hash_map_t *map;
+    int c, i, count = 1000000, seed = 0;
+
+    while ((c = Cmd_ParseOptions(o_hashbench)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_hashbench, NULL);
+            Com_Printf("Compare performance of chained and flat hash maps.\n");
+            Cmd_PrintHelp(o_hashbench);
+            return;
+        case 'n':
+            count = Q_atoi(cmd_optarg);
+            break;
+        case 's':
+            seed = Q_atoi(cmd_optarg);
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (count < 1 || count > INT_MAX / 8) {
+        Com_Printf("Bad count value.\n");
+        return;
+    }
+
+    keys = Z_Malloc(count * 2 * sizeof(keys[0]));
+    Q_srand(seed);
+    for (i = 0; i < count * 2; i++)
+        keys[i] = Q_rand();
+
+    for (i = 0; i < 2; i++) {
+        if (i)
+            map = HashMap_CreateFlat(uint32_t, uint32_t, HashInt32, NULL);
+        else
+            map = HashMap_Create(uint32_t, uint32_t, HashInt32, NULL);
+        sum[i] = Com_RunHashBench(map, keys, count, msec[i]);
+        HashMap_Destroy(map);
+    }
+
+    Z_Free(keys);
+
+    Com_Printf("%-8s %8s %8s\n", "test", "chained", "flat");
+    for (i = 0; i < HB_NUM_TESTS; i++)
+        Com_Printf("%-8s %8u %8u\n", hashbench_names[i], msec[0][i], msec[1][i]);
+
+    if (sum[0] != sum[1])
+        Com_EPrintf("Checksum mismatch: %08x != %08x\n", sum[0], sum[1]);
+    else
+        Com_Printf("Checksum: %08x\n", sum[0]);
+}
+
 typedef struct {
     const char *filter;
     const char *string;
@@ -901,6 +1276,8 @@ static const cmdreg_t c_test[] = {
     { "doublefree", Com_DoubleFree_f },
     { "printjunk", Com_PrintJunk_f },
     { "bsptest", BSP_Test_f },
+    { "tracebench", Com_TraceBench_f },
+    { "hashbench", Com_HashBench_f },
     { "wildtest", Com_TestWild_f },
     { "normtest", Com_TestNorm_f },
     { "infotest", Com_TestInfo_f },
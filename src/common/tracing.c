@@ -0,0 +1,333 @@
+/*
+Copyright (C) 2026 Q2PRO contributors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "shared/shared.h"
+#include "shared/atomic.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/files.h"
+#include "common/tracing.h"
+#include "common/zone.h"
+#include "system/pthread.h"
+
+/*
+===============================================================================
+
+Each thread records events into its own ring buffer, allocated on the first
+event. Buffers of exited threads are reused by new threads. Only the owning
+thread writes to the buffer, publishing new events by advancing the head
+counter. When a buffer wraps around, the oldest events are lost, so the trace
+always ends with the most recent events.
+
+Writer raises `writing' flag of its buffer before checking that tracing is
+enabled. trace_stop disables tracing and then waits for all flags to clear,
+so once it reads the buffers nobody writes to them until the next
+trace_start. Both sides use atomic read-modify-write operations, so one of
+them is guaranteed to see the other.
+
+Output is JSON understood by chrome://tracing and Perfetto.
+
+===============================================================================
+*/
+
+#define TRACE_EVENTS    16384   // per thread, must be power of two
+#define TRACE_ARGLEN    40
+
+typedef struct {
+    uint64_t    start;
+    uint32_t    duration;
+    const char  *name;
+    char        arg[TRACE_ARGLEN];
+} traceevent_t;
+
+typedef struct tracebuf_s {
+    struct tracebuf_s   *next;
+    atomic_int  head;
+    atomic_int  writing;
+    bool        inuse;      // protected by trace_lock
+    int         tid;
+    char        threadname[32];
+    traceevent_t    events[TRACE_EVENTS];
+} tracebuf_t;
+
+bool    com_tracing;    // unsynchronized hint, trace_enabled is the real thing
+
+static atomic_int   trace_enabled;
+static cvar_t       *trace_threshold;
+
+static pthread_mutex_t  trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static tracebuf_t       *trace_buffers;     // protected by trace_lock
+static int              trace_numbuffers;   // protected by trace_lock
+
+static q_thread_local tracebuf_t    *trace_buffer;
+static q_thread_local const char    *trace_threadname;
+
+static tracebuf_t *alloc_buffer(void)
+{
+    tracebuf_t *buf;
+
+    pthread_mutex_lock(&trace_lock);
+    for (buf = trace_buffers; buf; buf = buf->next)
+        if (!buf->inuse)
+            break;
+    if (buf) {
+        // events of previous owner are lost
+        atomic_store(&buf->head, 0);
+    } else {
+        buf = Z_TagMallocz(sizeof(*buf), TAG_GENERAL);
+        buf->tid = ++trace_numbuffers;
+        buf->next = trace_buffers;
+        trace_buffers = buf;
+    }
+    buf->inuse = true;
+    pthread_mutex_unlock(&trace_lock);
+
+    if (trace_threadname)
+        Q_strlcpy(buf->threadname, trace_threadname, sizeof(buf->threadname));
+    else
+        Q_snprintf(buf->threadname, sizeof(buf->threadname), "thread %d", buf->tid);
+
+    return trace_buffer = buf;
+}
+
+/*
+=============
+Com_TraceEvent
+=============
+*/
+void Com_TraceEvent(uint64_t start, uint64_t end, const char *name, const char *arg)
+{
+    tracebuf_t *buf = trace_buffer;
+    traceevent_t *ev;
+    int head;
+
+    if (!com_tracing || !start)
+        return;
+
+    if (!buf)
+        buf = alloc_buffer();
+
+    atomic_fetch_add(&buf->writing, 1);
+    if (!atomic_fetch_add(&trace_enabled, 0)) {
+        atomic_fetch_add(&buf->writing, -1);
+        return;
+    }
+
+    head = atomic_load(&buf->head);
+    ev = &buf->events[head & (TRACE_EVENTS - 1)];
+    ev->start = start;
+    ev->duration = end - start;
+    ev->name = name;
+    if (arg)
+        Q_strlcpy(ev->arg, arg, sizeof(ev->arg));
+    else
+        ev->arg[0] = 0;
+    atomic_store(&buf->head, head + 1);
+
+    atomic_fetch_add(&buf->writing, -1);
+}
+
+void Com_TraceEnd(uint64_t start, const char *name, const char *arg)
+{
+    if (start)
+        Com_TraceEvent(start, Sys_Microseconds(), name, arg);
+}
+
+void Com_TraceEndSlow(uint64_t start, const char *name)
+{
+    uint64_t end;
+
+    if (!start)
+        return;
+
+    end = Sys_Microseconds();
+    if (end - start >= trace_threshold->integer)
+        Com_TraceEvent(start, end, name, NULL);
+}
+
+void Com_TraceThreadName(const char *name)
+{
+    trace_threadname = name;
+    if (trace_buffer)
+        Q_strlcpy(trace_buffer->threadname, name, sizeof(trace_buffer->threadname));
+}
+
+void Com_TraceThreadExit(void)
+{
+    if (!trace_buffer)
+        return;
+
+    pthread_mutex_lock(&trace_lock);
+    trace_buffer->inuse = false;
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_buffer = NULL;
+}
+
+static void write_string(qhandle_t f, const char *s)
+{
+    char buffer[TRACE_ARGLEN * 6 + 1], *p = buffer;
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            *p++ = '\\';
+            *p++ = *s;
+        } else if (Q_isprint(*s)) {
+            *p++ = *s;
+        } else {
+            p += Q_snprintf(p, 7, "\\u%04x", (byte)*s);
+        }
+    }
+    *p = 0;
+
+    FS_FPrintf(f, "\"%s\"", buffer);
+}
+
+static int write_trace(qhandle_t f, uint64_t base)
+{
+    const tracebuf_t *buf;
+    const traceevent_t *ev;
+    int head, count, total = 0;
+    const char *sep = "";
+
+    FS_FPrintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&trace_lock);
+    for (buf = trace_buffers; buf; buf = buf->next) {
+        FS_FPrintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"name\":", sep, buf->tid);
+        write_string(f, buf->threadname);
+        FS_FPrintf(f, "}}");
+        sep = ",\n";
+
+        head = atomic_load(&buf->head);
+        count = min(head, TRACE_EVENTS);
+        for (int i = head - count; i < head; i++) {
+            ev = &buf->events[i & (TRACE_EVENTS - 1)];
+            if (ev->start < base)
+                continue;
+            FS_FPrintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%"PRIu64",\"dur\":%u", ev->name, buf->tid,
+                       ev->start - base, ev->duration);
+            if (ev->arg[0]) {
+                FS_FPrintf(f, ",\"args\":{\"arg\":");
+                write_string(f, ev->arg);
+                FS_FPrintf(f, "}");
+            }
+            FS_FPrintf(f, "}");
+            total++;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    FS_FPrintf(f, "\n]}\n");
+    return total;
+}
+
+static uint64_t trace_started;
+
+static void Com_TraceStart_f(void)
+{
+    tracebuf_t *buf;
+
+    if (com_tracing) {
+        Com_Printf("Already tracing.\n");
+        return;
+    }
+
+    // nobody writes while tracing is disabled
+    pthread_mutex_lock(&trace_lock);
+    for (buf = trace_buffers; buf; buf = buf->next)
+        atomic_store(&buf->head, 0);
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_started = Sys_Microseconds();
+    atomic_fetch_add(&trace_enabled, 1);
+    com_tracing = true;
+    Com_Printf("Tracing started.\n");
+}
+
+static void Com_TraceStop_f(void)
+{
+    tracebuf_t *buf;
+    char buffer[MAX_OSPATH];
+    qhandle_t f;
+    int count, ret;
+
+    if (!com_tracing) {
+        Com_Printf("Not tracing.\n");
+        return;
+    }
+
+    com_tracing = false;
+    atomic_fetch_add(&trace_enabled, -1);
+
+    // wait for events being written
+    pthread_mutex_lock(&trace_lock);
+    for (buf = trace_buffers; buf; buf = buf->next)
+        while (atomic_fetch_add(&buf->writing, 0))
+            ;
+    pthread_mutex_unlock(&trace_lock);
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                        "traces/", Cmd_Argc() > 1 ? Cmd_Argv(1) : "trace", ".json");
+    if (!f)
+        return;
+
+    count = write_trace(f, trace_started);
+
+    ret = FS_CloseFile(f);
+    if (ret)
+        Com_EPrintf("Error writing %s: %s\n", buffer, Q_ErrorString(ret));
+    else
+        Com_Printf("Wrote %d events to %s.\n", count, buffer);
+}
+
+static const cmdreg_t c_tracing[] = {
+    { "trace_start", Com_TraceStart_f },
+    { "trace_stop", Com_TraceStop_f },
+    { NULL }
+};
+
+void Com_InitTracing(void)
+{
+    trace_threshold = Cvar_Get("trace_threshold", "100", 0);
+
+    Com_TraceThreadName("main");
+
+    Cmd_Register(c_tracing);
+}
+
+void Com_ShutdownTracing(void)
+{
+    tracebuf_t *buf, *next;
+
+    if (com_tracing)
+        atomic_fetch_add(&trace_enabled, -1);
+    com_tracing = false;
+
+    // worker threads are gone by now
+    for (buf = trace_buffers; buf; buf = next) {
+        next = buf->next;
+        Z_Free(buf);
+    }
+    trace_buffers = NULL;
+    trace_numbuffers = 0;
+    trace_buffer = NULL;
+}
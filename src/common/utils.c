@@ -379,10 +379,13 @@ bool Com_ParseTimespec(const char *s, int *frames)
 
 /*
 ================
-Com_HashString
+Com_HashStringFull
+
+Returns full hash value, for tables that store it to avoid string compares
+and rehashing on resize.
 ================
 */
-unsigned Com_HashString(const char *s, unsigned size)
+unsigned Com_HashStringFull(const char *s)
 {
     unsigned hash, c;
 
@@ -392,8 +395,17 @@ unsigned Com_HashString(const char *s, unsigned size)
         hash = 127 * hash + c;
     }
 
-    hash = (hash >> 20) ^ (hash >> 10) ^ hash;
-    return hash & (size - 1);
+    return (hash >> 20) ^ (hash >> 10) ^ hash;
+}
+
+/*
+================
+Com_HashString
+================
+*/
+unsigned Com_HashString(const char *s, unsigned size)
+{
+    return Com_HashStringFull(s) & (size - 1);
 }
 
 /*
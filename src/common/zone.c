@@ -17,19 +17,58 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "shared/shared.h"
+#include "shared/atomic.h"
 #include "shared/list.h"
 #include "common/common.h"
 #include "common/zone.h"
 
 #define Z_MAGIC     0x1d0d
+#define Z_DEAD      0xdead
+
+// small blocks are carved out of slabs owned by per-tag arenas, so that
+// they don't churn system allocator and can be freed in bulk
+#define Z_SLAB_SIZE     0x8000
+#define Z_NUM_CLASSES   q_countof(z_classes)
+
+// sizeclass of blocks allocated by other threads
+#define Z_DETACHED      0xffff
+
+// block sizes, including header
+static const uint16_t z_classes[] = {
+    32, 48, 64, 96, 128, 192, 256, 384, 512
+};
 
 typedef struct {
-    uint16_t        magic;
-    uint16_t        tag;        // for group free
-    size_t          size;
-    list_t          entry;
+    uint16_t    magic;
+    uint16_t    tag;        // for group free
+    uint16_t    sizeclass;  // 1-based slab size class, 0 for large blocks
+    uint16_t    unused;
+    uint32_t    size;       // including header
+    uint32_t    unused2;
 } zhead_t;
 
+// large blocks are allocated individually and linked into arena
+typedef struct {
+    union {
+        list_t  entry;
+        uint8_t pad[16];
+    };
+    zhead_t     z;
+} zlarge_t;
+
+#define Z_LARGE(z)  ((zlarge_t *)((byte *)(z) - offsetof(zlarge_t, z)))
+
+// free small blocks are linked into arena free lists
+typedef struct zfree_s {
+    zhead_t     z;
+    struct zfree_s  *next;
+} zfree_t;
+
+typedef union zslab_u {
+    union zslab_u   *next;
+    uint8_t     pad[16];
+} zslab_t;
+
 typedef struct {
     zhead_t     z;
     char        data[2];
@@ -38,10 +77,38 @@ typedef struct {
 typedef struct {
     size_t      count;
     size_t      bytes;
+    size_t      peak;       // maximum of bytes
+    size_t      slab;       // bytes in slabs
+    size_t      used;       // bytes of slabs in use by blocks
 } zstats_t;
 
-static list_t       z_chain;
-static zstats_t     z_stats[TAG_MAX];
+typedef struct zarena_s {
+    struct zarena_s *next;  // game tags only
+    unsigned    tag;
+    zstats_t    stats;
+    zfree_t     *free[Z_NUM_CLASSES];
+    zslab_t     *slabs;
+    byte        *cursor;    // free space in the current slab
+    byte        *end;
+    list_t      large;
+} zarena_t;
+
+/*
+Arenas are only accessed by the main thread. Other threads (async work, send
+workers) allocate standalone detached blocks, which are not linked anywhere
+and are only counted in atomic per-tag stats, so Z_FreeTags() doesn't release
+them. Static string copies are counted in the same atomic stats by all
+threads. Arena blocks freed by other threads are pushed onto lock-free list and
+actually freed by the main thread on its next zone call.
+*/
+static zarena_t         z_arenas[TAG_MAX];
+static zarena_t         *z_game_arenas;
+
+static atomic_int       z_detached_count[TAG_MAX];  // game tags go to TAG_FREE
+static atomic_int       z_detached_bytes[TAG_MAX];
+static atomic_ptr       z_deferred;
+
+static q_thread_local bool  z_main_thread;
 
 #define S(d) \
     { .z = { .magic = Z_MAGIC, .tag = TAG_STATIC, .size = sizeof(zstatic_t) }, .data = d }
@@ -69,42 +136,197 @@ static const char *const z_tagnames[TAG_MAX] = {
 
 #define TAG_INDEX(tag)  ((tag) < TAG_MAX ? (tag) : TAG_FREE)
 
-static inline void Z_CountFree(const zhead_t *z)
+static inline void Z_CountFree(zarena_t *a, const zhead_t *z)
 {
-    zstats_t *s = &z_stats[TAG_INDEX(z->tag)];
+    zstats_t *s = &a->stats;
     s->count--;
     s->bytes -= z->size;
+    if (z->sizeclass)
+        s->used -= z_classes[z->sizeclass - 1];
 }
 
-static inline void Z_CountAlloc(const zhead_t *z)
+static inline void Z_CountAlloc(zarena_t *a, const zhead_t *z)
 {
-    zstats_t *s = &z_stats[TAG_INDEX(z->tag)];
+    zstats_t *s = &a->stats;
     s->count++;
     s->bytes += z->size;
+    s->peak = max(s->peak, s->bytes);
+    if (z->sizeclass)
+        s->used += z_classes[z->sizeclass - 1];
+}
+
+static inline void Z_CountDetached(const zhead_t *z, int sign)
+{
+    atomic_fetch_add(&z_detached_count[TAG_INDEX(z->tag)], sign);
+    atomic_fetch_add(&z_detached_bytes[TAG_INDEX(z->tag)], sign * (int)z->size);
 }
 
 #define Z_Validate(z) \
     Q_assert((z)->magic == Z_MAGIC && (z)->tag != TAG_FREE)
 
+static zarena_t *Z_GetArena(unsigned tag)
+{
+    zarena_t *a;
+
+    if (tag < TAG_MAX)
+        return &z_arenas[tag];
+
+    for (a = z_game_arenas; a; a = a->next)
+        if (a->tag == tag)
+            return a;
+
+    a = calloc(1, sizeof(*a));
+    if (!a) {
+        Com_Error(ERR_FATAL, "%s: couldn't allocate arena", __func__);
+    }
+    a->tag = tag;
+    List_Init(&a->large);
+    a->next = z_game_arenas;
+    z_game_arenas = a;
+    return a;
+}
+
+static int Z_SizeClass(size_t size)
+{
+    int i;
+
+    for (i = 0; i < Z_NUM_CLASSES; i++)
+        if (size <= z_classes[i])
+            return i + 1;
+
+    return 0;
+}
+
+static zhead_t *Z_SlabAlloc(zarena_t *a, int sizeclass)
+{
+    size_t size = z_classes[sizeclass - 1];
+    zfree_t *f;
+    zslab_t *slab;
+    byte *p;
+
+    f = a->free[sizeclass - 1];
+    if (f) {
+        a->free[sizeclass - 1] = f->next;
+        return &f->z;
+    }
+
+    if (a->end - a->cursor < size) {
+        slab = malloc(Z_SLAB_SIZE);
+        if (!slab) {
+            Com_Error(ERR_FATAL, "%s: couldn't allocate %d bytes", __func__, Z_SLAB_SIZE);
+        }
+        slab->next = a->slabs;
+        a->slabs = slab;
+        a->cursor = (byte *)(slab + 1);
+        a->end = (byte *)slab + Z_SLAB_SIZE;
+        a->stats.slab += Z_SLAB_SIZE;
+    }
+
+    p = a->cursor;
+    a->cursor += size;
+    return (zhead_t *)p;
+}
+
+// must be called by the main thread
+static void Z_FreeBlock(zhead_t *z)
+{
+    zarena_t *a = Z_GetArena(z->tag);
+    zlarge_t *l = NULL;
+
+    Z_CountFree(a, z);
+
+    if (z->sizeclass) {
+        zfree_t *f = (zfree_t *)z;
+        f->next = a->free[z->sizeclass - 1];
+        a->free[z->sizeclass - 1] = f;
+    } else {
+        l = Z_LARGE(z);
+        List_Remove(&l->entry);
+    }
+    z->magic = Z_DEAD;
+    z->tag = TAG_FREE;
+
+    free(l);
+}
+
+static void Z_DeferFree(zhead_t *z)
+{
+    zfree_t *f = (zfree_t *)z;
+    void *next = atomic_load(&z_deferred);
+
+    do {
+        f->next = next;
+    } while (!atomic_ptr_compare_exchange(&z_deferred, &next, f));
+}
+
+// must be called by the main thread
+static void Z_FreeDeferred(void)
+{
+    zfree_t *f, *next;
+
+    if (!atomic_load(&z_deferred))
+        return;
+
+    for (f = atomic_ptr_exchange(&z_deferred, NULL); f; f = next) {
+        next = f->next;
+        Z_FreeBlock(&f->z);
+    }
+}
+
+static void Z_AddStats(zstats_t *out, const zstats_t *in)
+{
+    out->count += in->count;
+    out->bytes += in->bytes;
+    out->peak += in->peak;
+    out->slab += in->slab;
+    out->used += in->used;
+}
+
+// returns stats for internal tag, or all game tags for TAG_FREE
+static void Z_GetStats(memtag_t tag, zstats_t *out)
+{
+    const zarena_t *a;
+
+    memset(out, 0, sizeof(*out));
+
+    Z_FreeDeferred();
+
+    if (tag == TAG_FREE) {
+        for (a = z_game_arenas; a; a = a->next)
+            Z_AddStats(out, &a->stats);
+    } else {
+        *out = z_arenas[tag].stats;
+    }
+
+    out->count += atomic_load(&z_detached_count[tag]);
+    out->bytes += atomic_load(&z_detached_bytes[tag]);
+}
+
 void Z_LeakTest(memtag_t tag)
 {
-    zhead_t *z;
-    size_t numLeaks = 0, numBytes = 0;
+    zstats_t s;
 
-    LIST_FOR_EACH(zhead_t, z, &z_chain, entry) {
-        Z_Validate(z);
-        if (z->tag == tag || (tag == TAG_FREE && z->tag >= TAG_MAX)) {
-            numLeaks++;
-            numBytes += z->size;
+    if (tag < TAG_MAX) {
+        Z_GetStats(tag, &s);
+    } else {
+        const zarena_t *a;
+
+        memset(&s, 0, sizeof(s));
+        Z_FreeDeferred();
+        for (a = z_game_arenas; a; a = a->next) {
+            if (a->tag == tag) {
+                s = a->stats;
+                break;
+            }
         }
     }
 
-    if (numLeaks) {
+    if (s.count) {
         Com_WPrintf("************* Z_LeakTest *************\n"
                     "%s leaked %zu bytes of memory (%zu object%s)\n"
                     "**************************************\n",
                     z_tagnames[TAG_INDEX(tag)],
-                    numBytes, numLeaks, numLeaks == 1 ? "" : "s");
+                    s.bytes, s.count, s.count == 1 ? "" : "s");
     }
 }
 
@@ -125,14 +347,27 @@ void Z_Free(void *ptr)
 
     Z_Validate(z);
 
-    Z_CountFree(z);
+    // static copies may be freed by a different thread than made them
+    if (z->tag == TAG_STATIC) {
+        Z_CountDetached(z, -1);
+        return;
+    }
 
-    if (z->tag != TAG_STATIC) {
-        List_Remove(&z->entry);
-        z->magic = 0xdead;
+    if (z->sizeclass == Z_DETACHED) {
+        Z_CountDetached(z, -1);
+        z->magic = Z_DEAD;
         z->tag = TAG_FREE;
-        free(z);
+        free(Z_LARGE(z));
+        return;
     }
+
+    if (!z_main_thread) {
+        Z_DeferFree(z);
+        return;
+    }
+
+    Z_FreeDeferred();
+    Z_FreeBlock(z);
 }
 
 /*
@@ -159,6 +394,9 @@ Z_Realloc
 void *Z_Realloc(void *ptr, size_t size)
 {
     zhead_t *z;
+    zarena_t *a;
+    zlarge_t *l;
+    void *copy;
 
     if (!ptr) {
         return Z_Malloc(size);
@@ -182,17 +420,49 @@ void *Z_Realloc(void *ptr, size_t size)
 
     Q_assert(z->tag != TAG_STATIC);
 
-    Z_CountFree(z);
+    if (z->sizeclass == Z_DETACHED) {
+        Z_CountDetached(z, -1);
+        l = realloc(Z_LARGE(z), sizeof(*l) - sizeof(*z) + size);
+        if (!l) {
+            Com_Error(ERR_FATAL, "%s: couldn't realloc %zu bytes", __func__, size);
+        }
+        z = &l->z;
+        z->size = size;
+        Z_CountDetached(z, 1);
+        return z + 1;
+    }
+
+    // small blocks are resized in place if size class matches, otherwise
+    // moved to a new block. other threads always move arena blocks.
+    if (!z_main_thread || (z->sizeclass && Z_SizeClass(size) != z->sizeclass)) {
+        copy = Z_TagMalloc(size - sizeof(*z), z->tag);
+        memcpy(copy, ptr, min(size, z->size) - sizeof(*z));
+        Z_Free(ptr);
+        return copy;
+    }
+
+    a = Z_GetArena(z->tag);
+    Z_CountFree(a, z);
 
-    z = realloc(z, size);
-    if (!z) {
+    if (z->sizeclass) {
+        z->size = size;
+        Z_CountAlloc(a, z);
+        return z + 1;
+    }
+
+    l = Z_LARGE(z);
+    List_Remove(&l->entry);
+
+    l = realloc(l, sizeof(*l) - sizeof(*z) + size);
+    if (!l) {
         Com_Error(ERR_FATAL, "%s: couldn't realloc %zu bytes", __func__, size);
     }
 
+    z = &l->z;
     z->size = size;
-    List_Relink(&z->entry);
 
-    Z_CountAlloc(z);
+    List_Insert(&a->large, &l->entry);
+    Z_CountAlloc(a, z);
 
     return z + 1;
 }
@@ -208,45 +478,80 @@ void *Z_ReallocArray(void *ptr, size_t nmemb, size_t size, memtag_t tag)
 /*
 ========================
 Z_Stats_f
+
+Fragmentation is the percentage of slab memory not used by blocks.
 ========================
 */
 void Z_Stats_f(void)
 {
-    size_t bytes = 0, count = 0;
-    zstats_t *s;
+    zstats_t stats[TAG_MAX], *s, total;
     int i;
 
-    Com_Printf("    bytes blocks name\n"
-               "--------- ------ -------\n");
+    for (i = 0; i < TAG_MAX; i++)
+        Z_GetStats(i, &stats[i]);
+
+    memset(&total, 0, sizeof(total));
+
+    Com_Printf("    bytes blocks      peak     slabs frag name\n"
+               "--------- ------ --------- --------- ---- -------\n");
 
-    for (i = 0, s = z_stats; i < TAG_MAX; i++, s++) {
-        if (!s->count) {
+    for (i = 0, s = stats; i < TAG_MAX; i++, s++) {
+        if (!s->count && !s->slab) {
             continue;
         }
-        Com_Printf("%9zu %6zu %s\n", s->bytes, s->count, z_tagnames[i]);
-        bytes += s->bytes;
-        count += s->count;
+        Com_Printf("%9zu %6zu %9zu %9zu %3d%% %s\n", s->bytes, s->count,
+                   s->peak, s->slab, s->slab ? (int)((s->slab - s->used) * 100 / s->slab) : 0,
+                   z_tagnames[i]);
+        Z_AddStats(&total, s);
     }
 
-    Com_Printf("--------- ------ -------\n"
-               "%9zu %6zu total\n",
-               bytes, count);
+    Com_Printf("--------- ------ --------- --------- ---- -------\n"
+               "%9zu %6zu %9zu %9zu %3d%% total\n",
+               total.bytes, total.count, total.peak, total.slab,
+               total.slab ? (int)((total.slab - total.used) * 100 / total.slab) : 0);
 }
 
 /*
 ========================
 Z_FreeTags
+
+Releases all slabs and large blocks of the tag arena at once.
+Detached blocks must be freed individually.
 ========================
 */
 void Z_FreeTags(memtag_t tag)
 {
-    zhead_t *z, *n;
+    zarena_t *a;
+    zslab_t *slab, *next;
+    zlarge_t *l, *n;
+    list_t large;
 
-    LIST_FOR_EACH_SAFE(zhead_t, z, n, &z_chain, entry) {
-        Z_Validate(z);
-        if (z->tag == tag) {
-            Z_Free(z + 1);
-        }
+    Z_FreeDeferred();
+
+    a = Z_GetArena(tag);
+    slab = a->slabs;
+    if (LIST_EMPTY(&a->large)) {
+        List_Init(&large);
+    } else {
+        large = a->large;
+        List_Relink(&large);
+    }
+    memset(a->free, 0, sizeof(a->free));
+    a->slabs = NULL;
+    a->cursor = a->end = NULL;
+    a->stats.count = a->stats.bytes = 0;
+    a->stats.slab = a->stats.used = 0;
+    List_Init(&a->large);
+
+    for (; slab; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+
+    LIST_FOR_EACH_SAFE(zlarge_t, l, n, &large, entry) {
+        l->z.magic = Z_DEAD;
+        l->z.tag = TAG_FREE;
+        free(l);
     }
 }
 
@@ -258,6 +563,9 @@ Z_TagMalloc
 static void *Z_TagMallocInternal(size_t size, memtag_t tag, bool init)
 {
     zhead_t *z;
+    zarena_t *a = NULL;
+    zlarge_t *l = NULL;
+    int sizeclass;
 
     if (!size) {
         return NULL;
@@ -267,23 +575,44 @@ static void *Z_TagMallocInternal(size_t size, memtag_t tag, bool init)
     Q_assert(tag > TAG_FREE && tag <= UINT16_MAX);
 
     size += sizeof(*z);
-    z = init ? calloc(1, size) : malloc(size);
-    if (!z) {
-        Com_Error(ERR_FATAL, "%s: couldn't allocate %zu bytes", __func__, size);
+    sizeclass = z_main_thread ? Z_SizeClass(size) : Z_DETACHED;
+    if (!sizeclass || sizeclass == Z_DETACHED) {
+        size_t len = sizeof(*l) - sizeof(*z) + size;
+        l = init ? calloc(1, len) : malloc(len);
+        if (!l) {
+            Com_Error(ERR_FATAL, "%s: couldn't allocate %zu bytes", __func__, size);
+        }
+    }
+
+    if (sizeclass == Z_DETACHED) {
+        z = &l->z;
+    } else {
+        Z_FreeDeferred();
+        a = Z_GetArena(tag);
+        if (l) {
+            z = &l->z;
+            List_Insert(&a->large, &l->entry);
+        } else {
+            z = Z_SlabAlloc(a, sizeclass);
+        }
     }
     z->magic = Z_MAGIC;
     z->tag = tag;
+    z->sizeclass = sizeclass;
     z->size = size;
-
-    List_Insert(&z_chain, &z->entry);
-
+    if (a)
+        Z_CountAlloc(a, z);
+    else
+        Z_CountDetached(z, 1);
+
+    if (init) {
+        if (a && sizeclass)
+            memset(z + 1, 0, size - sizeof(*z));
 #if USE_TESTS
-    if (!init && z_perturb && z_perturb->integer) {
+    } else if (z_perturb && z_perturb->integer) {
         memset(z + 1, z_perturb->integer, size - sizeof(*z));
-    }
 #endif
-
-    Z_CountAlloc(z);
+    }
 
     return z + 1;
 }
@@ -315,7 +644,14 @@ Z_Init
 */
 void Z_Init(void)
 {
-    List_Init(&z_chain);
+    int i;
+
+    for (i = 0; i < TAG_MAX; i++) {
+        z_arenas[i].tag = i;
+        List_Init(&z_arenas[i].large);
+    }
+
+    z_main_thread = true;
 }
 
 /*
@@ -357,8 +693,8 @@ char *Z_CvarCopyString(const char *in)
         return Z_TagCopyString(in, TAG_CVAR);
     }
 
-    // return static storage
+    // return static storage, always counted in atomic stats
     z = &z_static[i];
-    Z_CountAlloc(&z->z);
+    Z_CountDetached(&z->z, 1);
     return (char *)z->data;
 }
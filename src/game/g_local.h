@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // because we define the full size ones in this file
 #define GAME_INCLUDE
 #include "shared/game.h"
+#include "shared/gameext.h"
 
 // features this game supports
 #define G_FEATURES  (GMF_PROPERINUSE|GMF_WANT_ALL_DISCONNECTS|GMF_ENHANCED_SAVEGAMES)
@@ -443,6 +444,8 @@ extern  game_locals_t   game;
 extern  level_locals_t  level;
 extern  game_import_t   gi;
 extern  game_export_t   globals;
+extern  const game_import_ex_t  *gix;
+extern  const parallel_api_v1_t *parallel_api;
 extern  spawn_temp_t    st;
 
 extern  int sm_meat_index;
@@ -514,6 +517,8 @@ extern  cvar_t  *needpass;
 extern  cvar_t  *g_select_empty;
 extern  cvar_t  *dedicated;
 extern  cvar_t  *aimfix;
+extern  cvar_t  *g_seed;
+extern  cvar_t  *g_parallel_physics;
 
 extern  cvar_t  *filterban;
 
@@ -784,6 +789,7 @@ void M_ChangeYaw(edict_t *ent);
 // g_phys.c
 //
 void G_RunEntity(edict_t *ent);
+void G_PrepareParallelPhysics(void);
 
 //
 // g_chase.c
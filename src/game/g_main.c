@@ -22,6 +22,8 @@ game_locals_t   game;
 level_locals_t  level;
 game_import_t   gi;
 game_export_t   globals;
+const game_import_ex_t  *gix;
+const parallel_api_v1_t *parallel_api;
 spawn_temp_t    st;
 
 int sm_meat_index;
@@ -45,6 +47,8 @@ cvar_t  *g_select_empty;
 cvar_t  *g_protocol_extensions;
 cvar_t  *dedicated;
 cvar_t  *aimfix;
+cvar_t  *g_seed;
+cvar_t  *g_parallel_physics;
 
 cvar_t  *filterban;
 
@@ -138,6 +142,8 @@ static void InitGame(void)
     needpass = gi.cvar("needpass", "0", CVAR_SERVERINFO);
     filterban = gi.cvar("filterban", "1", 0);
     aimfix = gi.cvar("aimfix", "0", 0);
+    g_seed = gi.cvar("g_seed", "0", 0);
+    g_parallel_physics = gi.cvar("g_parallel_physics", "0", 0);
 
     g_select_empty = gi.cvar("g_select_empty", "0", CVAR_ARCHIVE);
     g_protocol_extensions = gi.cvar("g_protocol_extensions", "0", CVAR_LATCH);
@@ -170,6 +176,9 @@ static void InitGame(void)
     // export our own features
     gi.cvar_forceset("g_features", va("%d", features));
 
+    // worker threads for physics, if server has them
+    parallel_api = gix ? gix->GetExtension(PARALLEL_API_V1) : NULL;
+
     // items
     InitItems();
 
@@ -226,6 +235,25 @@ q_exported game_export_t *GetGameAPI(game_import_t *import)
     return &globals;
 }
 
+/*
+=================
+GetGameAPIEx
+
+Returns a pointer to the structure with extended entry points
+=================
+*/
+q_exported const game_export_ex_t *GetGameAPIEx(const game_import_ex_t *import)
+{
+    static const game_export_ex_t gex = {
+        .apiversion = GAME_API_VERSION_EX,
+        .structsize = sizeof(gex),
+    };
+
+    gix = import;
+
+    return &gex;
+}
+
 #ifndef GAME_HARD_LINKED
 // this is only here so the functions in q_shared.c can link
 void Com_LPrintf(print_type_t type, const char *fmt, ...)
@@ -473,6 +501,9 @@ static void G_RunFrame(void)
         return;
     }
 
+    // trace moves of independent entities ahead of time
+    G_PrepareParallelPhysics();
+
     //
     // treat each object in turn
     // even the world gets a chance to think
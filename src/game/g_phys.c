@@ -304,6 +304,170 @@ static void SV_AddGravity(edict_t *ent)
 /*
 ===============================================================================
 
+PARALLEL PHYSICS
+
+World traces of toss and fly entities don't depend on each other, so they can
+be done ahead of time on server worker threads. Entities are still moved,
+clipped to other entities and touched one by one in edict order. Precomputed
+world trace is only used if the entity is about to make exactly the predicted
+move, so results are the same as without this.
+
+===============================================================================
+*/
+
+#define MIN_PREMOVES    16
+
+typedef struct {
+    unsigned    sequence;
+    int         mask;
+    vec3_t      start, end;
+    vec3_t      mins, maxs;
+    trace_t     trace;
+} premove_t;
+
+static premove_t    premoves[MAX_EDICTS];
+static edict_t      *premove_ents[MAX_EDICTS];
+static int          num_premoves;
+static unsigned     premove_sequence;
+
+/*
+============
+SV_PredictMove
+
+Returns true if entity is going to move this frame as a free toss or fly
+object without running any game code first, and predicts its move.
+============
+*/
+static bool SV_PredictMove(edict_t *ent, vec3_t start, vec3_t end)
+{
+    float   speed = sv_maxvelocity->value;
+    vec3_t  velocity, move;
+
+    switch (ent->movetype) {
+    case MOVETYPE_TOSS:
+    case MOVETYPE_BOUNCE:
+    case MOVETYPE_FLY:
+    case MOVETYPE_FLYMISSILE:
+        break;
+    default:
+        return false;
+    }
+
+    if (ent->prethink)
+        return false;
+    if (ent->nextthink > 0 && ent->nextthink <= level.framenum)
+        return false;
+    if (ent->flags & FL_TEAMSLAVE)
+        return false;
+    if (ent->groundentity && ent->velocity[2] <= 0)
+        return false;
+
+    // same math as in SV_Physics_Toss
+    velocity[0] = Q_clipf(ent->velocity[0], -speed, speed);
+    velocity[1] = Q_clipf(ent->velocity[1], -speed, speed);
+    velocity[2] = Q_clipf(ent->velocity[2], -speed, speed);
+
+    if (ent->movetype != MOVETYPE_FLY && ent->movetype != MOVETYPE_FLYMISSILE)
+        velocity[2] -= ent->gravity * sv_gravity->value * FRAMETIME;
+
+    VectorCopy(ent->s.origin, start);
+    VectorScale(velocity, FRAMETIME, move);
+    VectorAdd(start, move, end);
+    return true;
+}
+
+static void SV_RunPremoves(void *arg, int index)
+{
+    int count = *(int *)arg;
+    int first = num_premoves * index / count;
+    int last = num_premoves * (index + 1) / count;
+    premove_t *pm;
+    int i;
+
+    for (i = first; i < last; i++) {
+        pm = &premoves[premove_ents[i] - g_edicts];
+        pm->trace = gix->clip(pm->start, pm->mins, pm->maxs, pm->end, g_edicts, pm->mask);
+    }
+}
+
+/*
+============
+G_PrepareParallelPhysics
+
+Called at the start of each frame. Traces predicted moves of all candidate
+entities against the world in parallel.
+============
+*/
+void G_PrepareParallelPhysics(void)
+{
+    edict_t     *ent;
+    premove_t   *pm;
+    int         i, count;
+
+    premove_sequence++;
+    num_premoves = 0;
+
+    if (!parallel_api || !g_parallel_physics->value)
+        return;
+
+    count = parallel_api->NumThreads();
+    if (count < 2)
+        return;
+
+    ent = &g_edicts[game.maxclients + 1];
+    for (i = game.maxclients + 1; i < globals.num_edicts; i++, ent++) {
+        if (!ent->inuse)
+            continue;
+
+        pm = &premoves[i];
+        if (!SV_PredictMove(ent, pm->start, pm->end))
+            continue;
+
+        pm->sequence = premove_sequence;
+        pm->mask = ent->clipmask ? ent->clipmask : MASK_SOLID;
+        VectorCopy(ent->mins, pm->mins);
+        VectorCopy(ent->maxs, pm->maxs);
+        premove_ents[num_premoves++] = ent;
+    }
+
+    if (num_premoves < MIN_PREMOVES) {
+        num_premoves = 0;
+        return;
+    }
+
+    // split into a few jobs per thread
+    count = min(count * 4, num_premoves);
+    parallel_api->RunParallel(SV_RunPremoves, &count, count);
+}
+
+/*
+============
+SV_PremoveTrace
+
+Finishes precomputed trace if it matches the move.
+============
+*/
+static bool SV_PremoveTrace(trace_t *trace, edict_t *ent, const vec3_t start, const vec3_t end, int mask)
+{
+    premove_t *pm = &premoves[ent - g_edicts];
+
+    if (!num_premoves || pm->sequence != premove_sequence)
+        return false;
+    if (pm->mask != mask)
+        return false;
+    if (!VectorCompare(pm->start, start) || !VectorCompare(pm->end, end))
+        return false;
+    if (!VectorCompare(pm->mins, ent->mins) || !VectorCompare(pm->maxs, ent->maxs))
+        return false;
+
+    *trace = pm->trace;
+    parallel_api->ClipToEntities(trace, start, ent->mins, ent->maxs, end, ent, mask);
+    return true;
+}
+
+/*
+===============================================================================
+
 PUSHMOVE
 
 ===============================================================================
@@ -332,7 +496,8 @@ retry:
     else
         mask = MASK_SOLID;
 
-    trace = gi.trace(start, ent->mins, ent->maxs, end, ent, mask);
+    if (!SV_PremoveTrace(&trace, ent, start, end, mask))
+        trace = gi.trace(start, ent->mins, ent->maxs, end, ent, mask);
 
     VectorCopy(trace.endpos, ent->s.origin);
     gi.linkentity(ent);
@@ -630,6 +630,7 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
     char        *com_token;
     int         i;
     int         skill_level;
+    uint32_t    seed;
 
     skill_level = Q_clip(skill->value, 0, 3);
     if (skill->value != skill_level)
@@ -644,6 +645,11 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
     memset(&level, 0, sizeof(level));
     memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
 
+    // fixed seed makes the level reproducible given the same client input
+    seed = strtoul(g_seed->string, NULL, 10);
+    if (seed)
+        Q_srand(seed);
+
     Q_strlcpy(level.mapname, mapname, sizeof(level.mapname));
     Q_strlcpy(game.spawnpoint, spawnpoint, sizeof(game.spawnpoint));
 
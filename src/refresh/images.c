@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/files.h"
 #include "common/intreadwrite.h"
 #include "common/sizebuf.h"
+#include "system/pthread.h"
 #include "system/system.h"
 #include "format/pcx.h"
 #include "format/wal.h"
@@ -55,6 +56,30 @@ static bool check_image_size(unsigned w, unsigned h)
     return (w < 1 || h < 1 || w > MAX_TEXTURE_SIZE || h > MAX_TEXTURE_SIZE);
 }
 
+#define MAX_IMG_WARNING     256
+
+// decoders running on async work threads can't print to console. first
+// warning is saved here and printed when decoded image is picked up.
+static q_thread_local char *img_warnbuf;
+
+static q_printf(1, 2) void IMG_Warning(const char *fmt, ...)
+{
+    char        buffer[MAXPRINTMSG];
+    va_list     argptr;
+
+    if (img_warnbuf && *img_warnbuf)
+        return;
+
+    va_start(argptr, fmt);
+    Q_vsnprintf(buffer, sizeof(buffer), fmt, argptr);
+    va_end(argptr);
+
+    if (img_warnbuf)
+        Q_strlcpy(img_warnbuf, buffer, MAX_IMG_WARNING);
+    else
+        Com_WPrintf("%s", buffer);
+}
+
 /*
 ====================================================================
 
@@ -298,7 +323,7 @@ static int load_pcx(const byte *rawdata, size_t rawlen,
 
         if (is_pal) {
             if (SZ_Remaining(&s) < PCX_PALETTE_SIZE)
-                Com_WPrintf("PCX file %s possibly corrupted\n", image->name);
+                IMG_Warning("PCX file %s possibly corrupted\n", image->name);
 
             if (image->type == IT_SKIN)
                 IMG_FloodFill(pixels, w, h);
@@ -309,7 +334,8 @@ static int load_pcx(const byte *rawdata, size_t rawlen,
 
             IMG_FreePixels(pixels);
         } else {
-            Com_DWPrintf("%s is a 24-bit PCX file. This is not portable.\n", image->name);
+            if (COM_DEVELOPER)
+                IMG_Warning("%s is a 24-bit PCX file. This is not portable.\n", image->name);
             *pic = pixels;
             image->flags |= IF_OPAQUE;
         }
@@ -750,7 +776,7 @@ static void my_output_message_2(j_common_ptr cinfo, bool err_exit)
     if (err_exit)
         Com_SetLastError(buffer);
     else
-        Com_WPrintf("libjpeg: %s: %s\n", jerr->filename, buffer);
+        IMG_Warning("libjpeg: %s: %s\n", jerr->filename, buffer);
 }
 
 static void my_output_message(j_common_ptr cinfo)
@@ -953,7 +979,7 @@ static void my_png_warning_fn(png_structp png_ptr, png_const_charp warning_msg)
     my_png_error *err = png_get_error_ptr(png_ptr);
 
     if (err->filename)
-        Com_WPrintf("libpng: %s: %s\n", err->filename, warning_msg);
+        IMG_Warning("libpng: %s: %s\n", err->filename, warning_msg);
 }
 
 static int my_png_read_header(png_structp png_ptr, png_infop info_ptr,
@@ -1481,6 +1507,7 @@ static cvar_t   *r_texture_overrides;
 #endif
 
 static cvar_t   *r_glowmaps;
+static cvar_t   *r_texture_async;
 
 static const cmd_option_t o_imagelist[] = {
     { "8", "pal", "list paletted images" },
@@ -1638,16 +1665,80 @@ static image_t *lookup_image(const char *name,
     return NULL;
 }
 
+#define PREFETCH_HASH   256
+
+typedef enum {
+    PF_QUEUED,
+    PF_RUNNING,
+    PF_DONE
+} pfstate_t;
+
+typedef struct {
+    list_t          entry;      // in img_prefetchHash
+    bool            glow;       // glow map for image with the same name
+    imageflags_t    flags;      // as requested
+
+    // filled on main thread
+    image_t         image;
+    imageformat_t   fmt;
+    void            *data;
+    int             len;
+    uint16_t        width, height;  // recovered original dimensions
+
+    texcachekey_t   cachekey;   // for storing prepared data
+
+    // filled by decoder
+    byte            *pic;
+    imgupload_t     up;
+    bool            prepared;
+    int             ret;
+    char            error[MAX_IMG_WARNING];
+    char            warning[MAX_IMG_WARNING];
+
+    pfstate_t       state;      // protected by img_prefetchLock
+    bool            taken, completed;
+} prefetch_t;
+
+// set while reading files for prefetch
+static prefetch_t   *img_prefetch;
+
+typedef struct {
+    imgupload_t     *up;    // filled on cache hit
+    texcachekey_t   key;    // filled on cache miss
+} cacheload_t;
+
+// set while loading images that may be found in texture cache
+static cacheload_t  *img_cache;
+
 static int try_image_format(imageformat_t fmt, image_t *image, byte **pic)
 {
     void    *data;
     int     ret;
 
+    // check the texture cache. 8-bit textures are cheap to decode and
+    // not worth caching.
+    if (img_cache) {
+        img_cache->key.name[0] = 0;
+        if (fmt > IM_WAL) {
+            ret = IMG_LookupCache(image, &img_cache->key, img_cache->up);
+            if (ret)
+                return ret < 0 ? ret : fmt;
+        }
+    }
+
     // load the file
-    ret = FS_LoadFile(image->name, &data);
+    ret = FS_LoadFileMapped(image->name, &data);
     if (!data)
         return ret;
 
+    // decompression is done later on async work thread
+    if (img_prefetch) {
+        img_prefetch->fmt = fmt;
+        img_prefetch->data = data;
+        img_prefetch->len = ret;
+        return fmt;
+    }
+
     // decompress the image
     ret = img_loaders[fmt].load(data, ret, image, pic);
 
@@ -1854,10 +1945,320 @@ static int load_image_data(image_t *image, imageformat_t fmt, bool need_dimensio
     return ret;
 }
 
+/*
+=========================================================
+
+ASYNC PREFETCH
+
+Files are read on the main thread (filesystem is not thread safe), then
+decoded and prepared for upload by async work threads. GL upload is done
+when the image is actually registered.
+
+=========================================================
+*/
+
+static pthread_mutex_t  img_prefetchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   img_prefetchCond = PTHREAD_COND_INITIALIZER;
+static list_t           img_prefetchHash[PREFETCH_HASH];
+static int              img_prefetchCount;
+
+static void premultiply_glow_map(image_t *image, byte *pic)
+{
+    int size = image->upload_width * image->upload_height;
+
+    for (int i = 0; i < size; i++, pic += 4) {
+        float alpha = pic[3] / 255.0f;
+        pic[0] *= alpha;
+        pic[1] *= alpha;
+        pic[2] *= alpha;
+    }
+}
+
+// may be called from any thread
+static void prefetch_decode(prefetch_t *pf)
+{
+    image_t *image = &pf->image;
+    int ret;
+
+    img_warnbuf = pf->warning;
+    ret = img_loaders[pf->fmt].load(pf->data, pf->len, image, &pf->pic);
+    img_warnbuf = NULL;
+
+    FS_FreeFile(pf->data);
+    pf->data = NULL;
+
+    if (ret < 0) {
+        Q_strlcpy(pf->error, Com_GetLastError(), sizeof(pf->error));
+        pf->ret = ret;
+        return;
+    }
+
+    pf->ret = pf->fmt;
+
+    // restore dimensions of replaced 8-bit texture
+    if (pf->width && pf->height) {
+        image->width = pf->width;
+        image->height = pf->height;
+    }
+
+    // model glowmaps should be premultiplied
+    if (pf->glow && image->type == IT_SKIN)
+        premultiply_glow_map(image, pf->pic);
+
+    pf->prepared = IMG_PrepareLoad(image, pf->pic, &pf->up);
+}
+
+static void prefetch_work_cb(void *arg)
+{
+    prefetch_t *pf = arg;
+
+    pthread_mutex_lock(&img_prefetchLock);
+    if (pf->state != PF_QUEUED) {
+        // already taken by main thread
+        pthread_mutex_unlock(&img_prefetchLock);
+        return;
+    }
+    pf->state = PF_RUNNING;
+    pthread_mutex_unlock(&img_prefetchLock);
+
+    prefetch_decode(pf);
+
+    pthread_mutex_lock(&img_prefetchLock);
+    pf->state = PF_DONE;
+    pthread_cond_broadcast(&img_prefetchCond);
+    pthread_mutex_unlock(&img_prefetchLock);
+}
+
+static void prefetch_done_cb(void *arg)
+{
+    prefetch_t *pf = arg;
+
+    pf->completed = true;
+    if (pf->taken)
+        Z_Free(pf);
+}
+
+// waits for decoding to finish, decoding inline if not started yet
+static void prefetch_wait(prefetch_t *pf)
+{
+    pthread_mutex_lock(&img_prefetchLock);
+    if (pf->state == PF_QUEUED) {
+        pf->state = PF_RUNNING;
+        pthread_mutex_unlock(&img_prefetchLock);
+
+        prefetch_decode(pf);
+
+        pthread_mutex_lock(&img_prefetchLock);
+        pf->state = PF_DONE;
+    }
+    while (pf->state != PF_DONE)
+        pthread_cond_wait(&img_prefetchCond, &img_prefetchLock);
+    pthread_mutex_unlock(&img_prefetchLock);
+}
+
+static void prefetch_release(prefetch_t *pf)
+{
+    List_Remove(&pf->entry);
+    img_prefetchCount--;
+
+    pf->taken = true;
+    if (pf->completed)
+        Z_Free(pf);
+}
+
+static prefetch_t *prefetch_find(const char *name, size_t baselen,
+                                 imagetype_t type, bool glow)
+{
+    unsigned hash = FS_HashPathLen(name, baselen, PREFETCH_HASH);
+    prefetch_t *pf;
+
+    if (!img_prefetchCount)
+        return NULL;
+
+    LIST_FOR_EACH(prefetch_t, pf, &img_prefetchHash[hash], entry) {
+        if (pf->image.type != type || pf->glow != glow)
+            continue;
+        if (pf->image.baselen != baselen)
+            continue;
+        if (!FS_pathcmpn(pf->image.name, name, baselen))
+            return pf;
+    }
+
+    return NULL;
+}
+
+static void prefetch_image(const char *name, size_t len, size_t baselen,
+                           imagetype_t type, imageflags_t flags, bool glow)
+{
+    prefetch_t *pf;
+    imageformat_t fmt;
+    int ret;
+
+    if (prefetch_find(name, baselen, type, glow))
+        return;
+
+    pf = Z_Mallocz(sizeof(*pf));
+    pf->glow = glow;
+    pf->flags = flags;
+
+    memcpy(pf->image.name, name, len + 1);
+    pf->image.baselen = baselen;
+    pf->image.type = type;
+    pf->image.flags = flags;
+
+    List_Append(&img_prefetchHash[FS_HashPathLen(name, baselen, PREFETCH_HASH)], &pf->entry);
+    img_prefetchCount++;
+
+    // find out original extension
+    for (fmt = 0; fmt < IM_MAX; fmt++)
+        if (!Q_stricmp(name + baselen + 1, img_loaders[fmt].ext))
+            break;
+
+    // read the file, using the same search order as load_image_data()
+    cacheload_t cache = { .up = &pf->up };
+    img_prefetch = pf;
+    img_cache = &cache;
+    ret = load_image_data(&pf->image, fmt, !glow, NULL);
+    img_prefetch = NULL;
+    img_cache = NULL;
+
+    if (ret < 0) {
+        if (ret == Q_ERR_INVALID_FORMAT || ret == Q_ERR_LIBRARY_ERROR)
+            Q_strlcpy(pf->error, Com_GetLastError(), sizeof(pf->error));
+        pf->ret = ret;
+        pf->state = PF_DONE;
+        pf->completed = true;
+        return;
+    }
+
+    // found in texture cache, nothing to decode
+    if (pf->up.data) {
+        pf->prepared = true;
+        pf->ret = ret;
+        pf->state = PF_DONE;
+        pf->completed = true;
+        return;
+    }
+
+    pf->cachekey = cache.key;
+
+    // dimensions recovered by get_image_dimensions()
+    pf->width = pf->image.width;
+    pf->height = pf->image.height;
+
+    asyncwork_t work = {
+        .work_cb = prefetch_work_cb,
+        .done_cb = prefetch_done_cb,
+        .cb_arg = pf,
+        .priority = ASYNC_HIGH,
+    };
+    Com_QueueAsyncWork(&work);
+}
+
+// returns prefetched image data, or Q_ERR(EAGAIN) if not prefetched
+static int prefetch_take(image_t *image, bool glow, byte **pic, imgupload_t *up)
+{
+    prefetch_t *pf;
+    int ret;
+
+    pf = prefetch_find(image->name, image->baselen, image->type, glow);
+    if (!pf)
+        return Q_ERR(EAGAIN);
+
+    prefetch_wait(pf);
+
+    if (pf->warning[0])
+        Com_WPrintf("%s", pf->warning);
+
+    ret = pf->ret;
+    if (ret < 0) {
+        memcpy(image->name, pf->image.name, sizeof(image->name));
+        Com_SetLastError(pf->error);
+    } else if (pf->flags != image->flags) {
+        // prepared with different flags, load again
+        if (pf->prepared)
+            IMG_FreePrepared(&pf->up);
+        Z_Free(pf->pic);
+        ret = Q_ERR(EAGAIN);
+    } else {
+        memcpy(image->name, pf->image.name, sizeof(image->name));
+        image->width = pf->image.width;
+        image->height = pf->image.height;
+        image->upload_width = pf->image.upload_width;
+        image->upload_height = pf->image.upload_height;
+        image->flags = pf->image.flags;
+        *pic = pf->pic;
+        if (pf->prepared) {
+            *up = pf->up;
+            IMG_StoreCache(&pf->cachekey, image, up);
+        } else {
+            up->data = NULL;
+        }
+    }
+
+    prefetch_release(pf);
+    return ret;
+}
+
+// waits for and frees prefetched images that were never registered
+static void flush_prefetch(void)
+{
+    prefetch_t *pf, *next;
+    int i, count = 0;
+
+    if (!img_prefetchCount)
+        return;
+
+    for (i = 0; i < PREFETCH_HASH; i++) {
+        LIST_FOR_EACH_SAFE(prefetch_t, pf, next, &img_prefetchHash[i], entry) {
+            prefetch_wait(pf);
+            if (pf->ret >= 0) {
+                if (pf->prepared)
+                    IMG_FreePrepared(&pf->up);
+                Z_Free(pf->pic);
+            }
+            prefetch_release(pf);
+            count++;
+        }
+    }
+
+    Com_DPrintf("%s: %d unused images freed\n", __func__, count);
+}
+
+// loads image data, trying texture cache first. on cache hit, or if
+// image is cacheable, returns data prepared for upload in `up'.
+static int load_prepared_data(image_t *image, imageformat_t fmt, bool glow,
+                              byte **pic, imgupload_t *up)
+{
+    cacheload_t cache = { .up = up };
+    int ret;
+
+    up->data = NULL;
+
+    img_cache = &cache;
+    ret = load_image_data(image, fmt, !glow, pic);
+    img_cache = NULL;
+
+    if (ret < 0 || up->data)
+        return ret;
+
+    // post-process glowmap data;
+    // - model glowmaps should be premultiplied
+    // - wal glowmaps just use the alpha, so the RGB channels are ignored
+    if (glow && image->type == IT_SKIN)
+        premultiply_glow_map(image, *pic);
+
+    if (cache.key.name[0] && IMG_PrepareLoad(image, *pic, up))
+        IMG_StoreCache(&cache.key, image, up);
+
+    return ret;
+}
+
 static void check_for_glow_map(image_t *image)
 {
     extern cvar_t *gl_shaders;
     imagetype_t type = image->type;
+    imgupload_t up;
     byte *glow_pic;
     size_t len;
     int ret;
@@ -1883,28 +2284,18 @@ static void check_for_glow_map(image_t *image)
     // load the pic from disk
     glow_pic = NULL;
 
-    ret = load_image_data(&temporary, IM_PCX, false, &glow_pic);
+    ret = prefetch_take(&temporary, true, &glow_pic, &up);
+    if (ret == Q_ERR(EAGAIN))
+        ret = load_prepared_data(&temporary, IM_PCX, true, &glow_pic, &up);
     if (ret < 0) {
         print_error(temporary.name, -1, ret);
         return;
     }
 
-    // post-process data;
-    // - model glowmaps should be premultiplied
-    // - wal glowmaps just use the alpha, so the RGB channels are ignored
-    if (type == IT_SKIN) {
-        int size = temporary.upload_width * temporary.upload_height;
-        byte *dst = glow_pic;
-
-        for (int i = 0; i < size; i++, dst += 4) {
-            float alpha = dst[3] / 255.0f;
-            dst[0] *= alpha;
-            dst[1] *= alpha;
-            dst[2] *= alpha;
-        }
-    }
-
-    IMG_Load(&temporary, glow_pic);
+    if (up.data)
+        IMG_LoadPrepared(&temporary, &up);
+    else
+        IMG_Load(&temporary, glow_pic);
     image->texnum2 = temporary.texnum;
 
     Z_Free(glow_pic);
@@ -1916,6 +2307,7 @@ static image_t *find_or_load_image(const char *name, size_t len,
 {
     image_t         *image;
     byte            *pic;
+    imgupload_t     up;
     unsigned        hash;
     size_t          baselen;
     imageformat_t   fmt;
@@ -1963,6 +2355,7 @@ static image_t *find_or_load_image(const char *name, size_t len,
 
     // load the pic from disk
     pic = NULL;
+    up.data = NULL;
 
     if (flags & IF_KEEP_EXTENSION) {
         // direct load requested (for testing code)
@@ -1971,7 +2364,9 @@ static image_t *find_or_load_image(const char *name, size_t len,
         else
             ret = try_image_format(fmt, image, &pic);
     } else {
-        ret = load_image_data(image, fmt, true, &pic);
+        ret = prefetch_take(image, false, &pic, &up);
+        if (ret == Q_ERR(EAGAIN))
+            ret = load_prepared_data(image, fmt, false, &pic, &up);
     }
 
     if (ret < 0) {
@@ -2013,6 +2408,9 @@ static image_t *find_or_load_image(const char *name, size_t len,
 
         IMG_Load(&temporary, pic);
         image->texnum2 = temporary.texnum;
+    } else if (up.data) {
+        // upload prefetched image
+        IMG_LoadPrepared(image, &up);
     } else {
         // upload the image
         IMG_Load(image, pic);
@@ -2053,6 +2451,49 @@ image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags)
     return image;
 }
 
+/*
+===============
+IMG_Prefetch
+
+Starts decoding the given image on async work threads.
+It should be registered with IMG_Find soon after.
+===============
+*/
+void IMG_Prefetch(const char *name, imagetype_t type, imageflags_t flags)
+{
+    extern cvar_t *gl_shaders;
+    char buffer[MAX_QPATH];
+    size_t len, baselen;
+
+    if (!r_texture_async->integer)
+        return;
+
+    len = FS_NormalizePathBuffer(buffer, name, sizeof(buffer));
+    if (len >= MAX_QPATH)
+        return;
+
+    baselen = COM_FileExtension(buffer) - buffer;
+    if (baselen < 1 || buffer[baselen] != '.')
+        return;
+
+    if (lookup_image(buffer, type, FS_HashPathLen(buffer, baselen, RIMAGES_HASH), baselen))
+        return;
+
+    prefetch_image(buffer, len, baselen, type, flags, false);
+
+    // same conditions as in check_for_glow_map()
+    if (!r_glowmaps->integer || !gl_shaders->integer)
+        return;
+    if (type != IT_SKIN && type != IT_WALL)
+        return;
+
+    len = Q_strlcpy(buffer + baselen, "_glow.pcx", sizeof(buffer) - baselen) + baselen;
+    if (len >= sizeof(buffer))
+        return;
+
+    prefetch_image(buffer, len, len - 4, type, IF_TURBULENT, true);
+}
+
 /*
 ===============
 IMG_ForHandle
@@ -2138,6 +2579,8 @@ void IMG_FreeUnused(void)
     image_t *image;
     int i, count = 0;
 
+    flush_prefetch();
+
     for (i = R_NUM_AUTO_IMG, image = r_images + i; i < r_numImages; i++, image++) {
         if (!image->name[0])
             continue;        // free image_t slot
@@ -2158,6 +2601,8 @@ void IMG_FreeUnused(void)
 
     if (count)
         Com_DPrintf("%s: %i images freed\n", __func__, count);
+
+    IMG_TrimCache();
 }
 
 void IMG_FreeAll(void)
@@ -2165,6 +2610,8 @@ void IMG_FreeAll(void)
     image_t *image;
     int i, count = 0;
 
+    flush_prefetch();
+
     for (i = R_NUM_AUTO_IMG, image = r_images + i; i < r_numImages; i++, image++) {
         if (!image->name[0])
             continue;        // free image_t slot
@@ -2266,12 +2713,18 @@ void IMG_Init(void)
 #endif // USE_PNG || USE_JPG || USE_TGA
 
     r_glowmaps = Cvar_Get("r_glowmaps", "1", CVAR_FILES);
+    r_texture_async = Cvar_Get("r_texture_async", "1", 0);
+
+    IMG_InitCache();
 
     Cmd_Register(img_cmd);
 
     for (i = 0; i < RIMAGES_HASH; i++)
         List_Init(&r_imageHash[i]);
 
+    for (i = 0; i < PREFETCH_HASH; i++)
+        List_Init(&img_prefetchHash[i]);
+
     // &r_images[0] == R_NOTEXTURE
     r_numImages = R_NUM_AUTO_IMG;
 }
@@ -84,6 +84,7 @@ extern unsigned r_registration_sequence;
 extern uint32_t d_8to24table[256];
 
 image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags);
+void IMG_Prefetch(const char *name, imagetype_t type, imageflags_t flags);
 void IMG_FreeUnused(void);
 void IMG_FreeAll(void);
 void IMG_Init(void);
@@ -92,8 +93,37 @@ void IMG_GetPalette(void);
 
 image_t *IMG_ForHandle(qhandle_t h);
 
+// texture data prepared for upload by IMG_PrepareLoad
+typedef struct {
+    byte    *data;
+    int     width, height;  // after power of two and picmip
+    int     comp;
+    bool    alpha;
+    bool    allocated;      // data doesn't point into source pic
+    void    *mapping;       // data points into mapped texture cache file
+    size_t  mapsize;
+} imgupload_t;
+
 void IMG_Unload(image_t *image);
 void IMG_Load(image_t *image, byte *pic);
+bool IMG_PrepareLoad(const image_t *image, byte *pic, imgupload_t *up);
+void IMG_LoadPrepared(image_t *image, imgupload_t *up);
+void IMG_FreePrepared(imgupload_t *up);
+unsigned IMG_PrepareChecksum(void);
+
+// persistent cache of prepared texture data
+typedef struct {
+    char    name[20];       // cache file name, empty if not cacheable
+    int64_t size;           // source file size
+    int64_t mtime;          // source file modification time
+    int     flags;          // image flags as requested
+    unsigned settings;      // IMG_PrepareChecksum
+} texcachekey_t;
+
+void IMG_InitCache(void);
+int IMG_LookupCache(image_t *image, texcachekey_t *key, imgupload_t *up);
+void IMG_StoreCache(const texcachekey_t *key, const image_t *image, const imgupload_t *up);
+void IMG_TrimCache(void);
 
 typedef struct screenshot_s screenshot_t;
 
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
  */
 
 #include "gl.h"
+#include "common/tracing.h"
 
 glRefdef_t glr;
 glStatic_t gl_static;
@@ -795,6 +796,8 @@ static pp_flags_t GL_BindFramebuffer(void)
 
 void R_RenderFrame(const refdef_t *fd)
 {
+    uint64_t time = Com_TraceTime();
+
     GL_Flush2D();
 
     Q_assert(gl_static.world.cache || (fd->rdflags & RDF_NOWORLDMODEL));
@@ -878,6 +881,8 @@ void R_RenderFrame(const refdef_t *fd)
 
     if (gl_showerrors->integer > 1)
         GL_ShowErrors(__func__);
+
+    Com_TraceEnd(time, "R_RenderFrame", NULL);
 }
 
 void R_BeginFrame(void)
@@ -1293,7 +1298,7 @@ void GL_InitQueries(void)
         gl_static.samples_passed = GL_ANY_SAMPLES_PASSED;
 
     Q_assert(!gl_static.queries);
-    gl_static.queries = HashMap_TagCreate(int, glquery_t, HashInt32, NULL, TAG_RENDERER);
+    gl_static.queries = HashMap_TagCreateFlat(int, glquery_t, HashInt32, NULL, TAG_RENDERER);
 }
 
 void GL_DeleteQueries(void)
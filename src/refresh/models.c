@@ -1587,7 +1587,7 @@ qhandle_t R_RegisterModel(const char *name)
         goto done;
     }
 
-    ret = FS_LoadFile(normalized, (void **)&rawdata);
+    ret = FS_LoadFileMapped(normalized, (void **)&rawdata);
     if (!rawdata)
         goto fail1;
 
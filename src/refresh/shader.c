@@ -1038,7 +1038,7 @@ static void shader_init(void)
     gl_bloom_sigma = Cvar_Get("gl_bloom_sigma", "4", 0);
     gl_bloom_sigma->changed = gl_bloom_sigma_changed;
 
-    gl_static.programs = HashMap_TagCreate(glStateBits_t, GLuint, HashInt64, NULL, TAG_RENDERER);
+    gl_static.programs = HashMap_TagCreateFlat(glStateBits_t, GLuint, HashInt64, NULL, TAG_RENDERER);
 
     qglGenBuffers(1, &gl_static.uniform_buffer);
     GL_BindBufferBase(GL_UNIFORM_BUFFER, UBO_UNIFORMS, gl_static.uniform_buffer);
@@ -0,0 +1,343 @@
+/*
+Copyright (C) 2026 Q2PRO contributors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// texcache.c -- persistent cache of decoded textures
+//
+// Stores texture data as returned by IMG_PrepareLoad in game directory,
+// so that decoding and downsampling of large replacement textures can be
+// skipped on subsequent loads. Cache files are mapped into memory and
+// passed to GL directly. Each file is keyed by source file path, size and
+// modification time, and by all settings that affect prepared data.
+//
+
+#include "shared/shared.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/files.h"
+#include "common/mdfour.h"
+#include "common/utils.h"
+#include "system/system.h"
+#include "images.h"
+
+#define TEXCACHE_IDENT      MakeLittleLong('Q','2','T','C')
+#define TEXCACHE_VERSION    1
+
+#define TEXCACHE_DIR        "texcache"
+#define TEXCACHE_EXT        ".tc"
+
+typedef struct {
+    uint32_t    ident;
+    uint32_t    version;
+    uint32_t    settings;       // IMG_PrepareChecksum
+    uint32_t    lastused;       // informational, LRU uses file mtime
+    int64_t     size;           // source file
+    int64_t     mtime;
+    uint16_t    type;
+    uint16_t    flags;          // as requested
+    uint16_t    image_flags;    // after loading
+    uint16_t    width, height;
+    uint16_t    upload_width, upload_height;
+    uint16_t    data_width, data_height;
+    uint16_t    alpha;
+    int32_t     comp;
+    char        name[MAX_QPATH];
+} texcache_header_t;
+
+static cvar_t   *r_texture_cache;
+static cvar_t   *r_texture_cache_size;
+
+static bool     tc_stored;  // cache may need trimming
+
+static void make_key(const image_t *image, texcachekey_t *key)
+{
+    struct mdfour md;
+    uint8_t digest[16];
+    uint32_t info[6];
+    int i;
+
+    info[0] = key->size;
+    info[1] = key->size >> 32;
+    info[2] = key->mtime;
+    info[3] = key->mtime >> 32;
+    info[4] = image->type | key->flags << 16;
+    info[5] = key->settings;
+
+    mdfour_begin(&md);
+    mdfour_update(&md, (const uint8_t *)image->name, strlen(image->name));
+    mdfour_update(&md, (const uint8_t *)info, sizeof(info));
+    mdfour_result(&md, digest);
+
+    for (i = 0; i < 8; i++) {
+        key->name[i * 2 + 0] = com_hexchars[digest[i] >> 4];
+        key->name[i * 2 + 1] = com_hexchars[digest[i] & 15];
+    }
+    key->name[i * 2] = 0;
+}
+
+// updates file mtime for LRU eviction
+static void touch_file(const char *path)
+{
+    uint32_t now = time(NULL);
+    FILE *fp;
+
+    fp = fopen(path, "r+b");
+    if (!fp)
+        return;
+
+    if (!fseek(fp, offsetof(texcache_header_t, lastused), SEEK_SET))
+        fwrite(&now, sizeof(now), 1, fp);
+
+    fclose(fp);
+}
+
+static bool check_header(const texcache_header_t *h, size_t len,
+                         const image_t *image, const texcachekey_t *key)
+{
+    if (len < sizeof(*h))
+        return false;
+    if (h->ident != TEXCACHE_IDENT || h->version != TEXCACHE_VERSION)
+        return false;
+    if (h->settings != key->settings || h->size != key->size || h->mtime != key->mtime)
+        return false;
+    if (h->type != image->type || h->flags != key->flags)
+        return false;
+    if (strncmp(h->name, image->name, sizeof(h->name)))
+        return false;
+    if (!h->width || !h->height || !h->upload_width || !h->upload_height)
+        return false;
+    if (!h->data_width || !h->data_height)
+        return false;
+    if (len - sizeof(*h) != (size_t)h->data_width * h->data_height * 4)
+        return false;
+    return true;
+}
+
+/*
+================
+IMG_LookupCache
+
+Looks up prepared data for image file being loaded. Returns 1 and fills
+image and upload info on cache hit. Returns 0 on cache miss, filling in
+key for storing prepared data later (key name is empty if the image is
+not cacheable). Returns Q_ERR(ENOENT) if source file doesn't exist.
+================
+*/
+int IMG_LookupCache(image_t *image, texcachekey_t *key, imgupload_t *up)
+{
+    char path[MAX_OSPATH];
+    const texcache_header_t *h;
+    file_info_t info;
+    void *data;
+    size_t len;
+    int ret;
+
+    key->name[0] = 0;
+
+    if (!r_texture_cache->integer)
+        return 0;
+
+    // same conditions as in IMG_PrepareLoad
+    if (image->type == IT_PIC || image->flags & (IF_CUBEMAP | IF_CLASSIC_SKY))
+        return 0;
+
+    // source file is not opened until cache miss
+    ret = FS_GetFileInfo(image->name, &info);
+    if (ret)
+        return ret == Q_ERR(ENOENT) ? ret : 0;
+
+    key->size = info.size;
+    key->mtime = info.mtime;
+    key->flags = image->flags;
+    key->settings = IMG_PrepareChecksum();
+    make_key(image, key);
+
+    if (Q_snprintf(path, sizeof(path), "%s/" TEXCACHE_DIR "/%s" TEXCACHE_EXT,
+                   fs_gamedir, key->name) >= sizeof(path)) {
+        key->name[0] = 0;
+        return 0;
+    }
+
+    // mapped copy-on-write since data may be mipmapped in place
+    data = Sys_MapFile(path, &len, true);
+    if (!data)
+        return 0;
+
+    h = data;
+    if (!check_header(h, len, image, key)) {
+        Com_DPrintf("%s: %s is invalid\n", __func__, path);
+        Sys_UnmapFile(data, len);
+        return 0;
+    }
+
+    touch_file(path);
+
+    image->flags = h->image_flags;
+    image->width = h->width;
+    image->height = h->height;
+    image->upload_width = h->upload_width;
+    image->upload_height = h->upload_height;
+
+    up->data = (byte *)data + sizeof(*h);
+    up->width = h->data_width;
+    up->height = h->data_height;
+    up->comp = h->comp;
+    up->alpha = h->alpha;
+    up->allocated = false;
+    up->mapping = data;
+    up->mapsize = len;
+
+    key->name[0] = 0;
+    return 1;
+}
+
+/*
+================
+IMG_StoreCache
+
+Writes prepared data to cache file after cache miss.
+================
+*/
+void IMG_StoreCache(const texcachekey_t *key, const image_t *image, const imgupload_t *up)
+{
+    texcache_header_t h;
+    char path[MAX_QPATH];
+    qhandle_t f;
+    int ret1, ret2, ret3;
+
+    if (!key->name[0] || !up->data)
+        return;
+
+    memset(&h, 0, sizeof(h));
+    h.ident = TEXCACHE_IDENT;
+    h.version = TEXCACHE_VERSION;
+    h.settings = key->settings;
+    h.lastused = time(NULL);
+    h.size = key->size;
+    h.mtime = key->mtime;
+    h.type = image->type;
+    h.flags = key->flags;
+    h.image_flags = image->flags;
+    h.width = image->width;
+    h.height = image->height;
+    h.upload_width = image->upload_width;
+    h.upload_height = image->upload_height;
+    h.data_width = up->width;
+    h.data_height = up->height;
+    h.alpha = up->alpha;
+    h.comp = up->comp;
+    Q_strlcpy(h.name, image->name, sizeof(h.name));
+
+    Q_concat(path, sizeof(path), TEXCACHE_DIR "/", key->name, TEXCACHE_EXT);
+
+    ret1 = FS_OpenFile(path, &f, FS_MODE_WRITE);
+    if (!f) {
+        Com_DPrintf("Couldn't write %s: %s\n", path, Q_ErrorString(ret1));
+        return;
+    }
+
+    ret1 = FS_Write(&h, sizeof(h), f);
+    ret2 = FS_Write(up->data, up->width * up->height * 4, f);
+    ret3 = FS_CloseFile(f);
+
+    // partially written file will be rejected by check_header()
+    if (ret1 < 0 || ret2 < 0 || ret3 < 0) {
+        Com_DPrintf("Couldn't write %s\n", path);
+        return;
+    }
+
+    tc_stored = true;
+}
+
+static int mtimecmp(const void *p1, const void *p2)
+{
+    const file_info_t *n1 = *(const file_info_t **)p1;
+    const file_info_t *n2 = *(const file_info_t **)p2;
+
+    if (n1->mtime < n2->mtime)
+        return -1;
+    if (n1->mtime > n2->mtime)
+        return 1;
+    return 0;
+}
+
+/*
+================
+IMG_TrimCache
+
+Removes least recently used cache files until total size of cache fits
+into r_texture_cache_size megabytes. Called after registration.
+================
+*/
+void IMG_TrimCache(void)
+{
+    char path[MAX_OSPATH];
+    int64_t total, limit;
+    size_t len;
+    int i, count;
+
+    if (!tc_stored)
+        return;
+    tc_stored = false;
+
+    len = Q_concat(path, sizeof(path), fs_gamedir, "/" TEXCACHE_DIR);
+    if (len >= sizeof(path))
+        return;
+
+    listfiles_t list = {
+        .filter = TEXCACHE_EXT,
+        .flags = FS_SEARCH_EXTRAINFO,
+        .baselen = len + 1,
+    };
+    Sys_ListFiles_r(&list, path, 0);
+
+    total = 0;
+    for (i = 0; i < list.count; i++) {
+        file_info_t *info = list.files[i];
+        total += info->size;
+    }
+
+    limit = (int64_t)Cvar_ClampInteger(r_texture_cache_size, 0, INT_MAX / 2) << 20;
+    if (total > limit) {
+        qsort(list.files, list.count, sizeof(list.files[0]), mtimecmp);
+
+        for (i = count = 0; i < list.count && total > limit; i++) {
+            file_info_t *info = list.files[i];
+
+            if (Q_concat(path + len, sizeof(path) - len, "/", info->name) >= sizeof(path) - len)
+                continue;
+            if (os_unlink(path))
+                continue;
+
+            total -= info->size;
+            count++;
+        }
+
+        Com_DPrintf("%s: removed %d files, %"PRId64" bytes left\n", __func__, count, total);
+    }
+
+    for (i = 0; i < list.count; i++)
+        Z_Free(list.files[i]);
+    Z_Free(list.files);
+}
+
+void IMG_InitCache(void)
+{
+    r_texture_cache = Cvar_Get("r_texture_cache", "0", 0);
+    r_texture_cache_size = Cvar_Get("r_texture_cache_size", "512", 0);
+}
@@ -18,7 +18,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "gl.h"
+#include "common/mdfour.h"
 #include "common/prompt.h"
+#include "system/system.h"
 
 static int gl_filter_min;
 static int gl_filter_max;
@@ -459,14 +461,18 @@ static void GL_ClampTextureSize(int *width, int *height)
 
 /*
 ===============
-GL_Upload32
+GL_PrepareUpload32
+
+CPU side of texture upload: color adjustments, downsampling to upload
+size and alpha scan. Doesn't touch GL state and may be called from
+async work threads during registration.
 ===============
 */
-static void GL_Upload32(byte *data, int width, int height, int baselevel, imagetype_t type, imageflags_t flags)
+static void GL_PrepareUpload32(byte *data, int width, int height, imagetype_t type, imageflags_t flags, imgupload_t *up)
 {
     byte        *scaled;
     int         scaled_width, scaled_height, comp;
-    bool        power_of_two;
+    bool        power_of_two, alpha;
 
     scaled_width = width;
     scaled_height = height;
@@ -489,8 +495,6 @@ static void GL_Upload32(byte *data, int width, int height, int baselevel, imaget
 
     // don't ever bother with >256 textures
     GL_ClampTextureSize(&scaled_width, &scaled_height);
-    upload_width = scaled_width;
-    upload_height = scaled_height;
 
     // set colorscale and lightscale before mipmap
     comp = GL_GrayScaleTexture(data, width, height, type, flags);
@@ -515,17 +519,45 @@ static void GL_Upload32(byte *data, int width, int height, int baselevel, imaget
     }
 
     if (flags & IF_TRANSPARENT) {
-        upload_alpha = true;
+        alpha = true;
     } else if (flags & IF_OPAQUE) {
-        upload_alpha = false;
+        alpha = false;
     } else {
         // scan the texture for any non-255 alpha
-        upload_alpha = GL_TextureHasAlpha(scaled, scaled_width, scaled_height);
+        alpha = GL_TextureHasAlpha(scaled, scaled_width, scaled_height);
     }
 
-    if (upload_alpha)
+    if (alpha)
         comp = gl_tex_alpha_format;
 
+    up->data = scaled;
+    up->width = scaled_width;
+    up->height = scaled_height;
+    up->comp = comp;
+    up->alpha = alpha;
+    up->allocated = scaled != data;
+    up->mapping = NULL;
+    up->mapsize = 0;
+}
+
+/*
+===============
+GL_SubmitUpload32
+
+GL side of texture upload, frees prepared data.
+===============
+*/
+static void GL_SubmitUpload32(imgupload_t *up, int baselevel, imagetype_t type, imageflags_t flags)
+{
+    byte    *scaled = up->data;
+    int     scaled_width = up->width;
+    int     scaled_height = up->height;
+    int     comp = up->comp;
+
+    upload_width = scaled_width;
+    upload_height = scaled_height;
+    upload_alpha = up->alpha;
+
     if (flags & IF_CUBEMAP)
         qglTexImage2D(upload_target, baselevel, GL_RGBA, scaled_width,
                       scaled_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, scaled);
@@ -556,8 +588,20 @@ static void GL_Upload32(byte *data, int width, int height, int baselevel, imaget
         }
     }
 
-    if (scaled != data)
-        FS_FreeTempMem(scaled);
+    IMG_FreePrepared(up);
+}
+
+/*
+===============
+GL_Upload32
+===============
+*/
+static void GL_Upload32(byte *data, int width, int height, int baselevel, imagetype_t type, imageflags_t flags)
+{
+    imgupload_t up;
+
+    GL_PrepareUpload32(data, width, height, type, flags, &up);
+    GL_SubmitUpload32(&up, baselevel, type, flags);
 }
 
 static int GL_UpscaleLevel(int width, int height, imagetype_t type, imageflags_t flags)
@@ -820,6 +864,20 @@ static bool GL_UploadCubemap(image_t *image, byte *pic)
     return true;
 }
 
+static void GL_FinishTexture(image_t *image, int maxlevel)
+{
+    GL_SetFilterAndRepeat(image->type, image->flags);
+
+    if (upload_alpha)
+        image->flags |= IF_TRANSPARENT;
+    image->upload_width = upload_width << maxlevel;     // after power of 2 and scales
+    image->upload_height = upload_height << maxlevel;
+    image->sl = 0;
+    image->sh = 1;
+    image->tl = 0;
+    image->th = 1;
+}
+
 /*
 ================
 IMG_Load
@@ -876,19 +934,109 @@ void IMG_Load(image_t *image, byte *pic)
             GL_Upload32(pic, width, height, maxlevel, image->type, image->flags);
         }
 
-        GL_SetFilterAndRepeat(image->type, image->flags);
-
-        if (upload_alpha)
-            image->flags |= IF_TRANSPARENT;
-        image->upload_width = upload_width << maxlevel;     // after power of 2 and scales
-        image->upload_height = upload_height << maxlevel;
-        image->sl = 0;
-        image->sh = 1;
-        image->tl = 0;
-        image->th = 1;
+        GL_FinishTexture(image, maxlevel);
     }
 }
 
+/*
+================
+IMG_PrepareLoad
+
+Does the CPU side of IMG_Load in advance. Returns false if the image
+needs to go through full IMG_Load (skies, pics that may be put on the
+scrap and upscaled images). Safe to call from async work threads.
+================
+*/
+bool IMG_PrepareLoad(const image_t *image, byte *pic, imgupload_t *up)
+{
+    int width = image->upload_width;
+    int height = image->upload_height;
+
+    if (image->flags & (IF_CUBEMAP | IF_CLASSIC_SKY))
+        return false;
+    if (image->type == IT_PIC)
+        return false;
+    if (GL_UpscaleLevel(width, height, image->type, image->flags))
+        return false;
+
+    GL_PrepareUpload32(pic, width, height, image->type, image->flags, up);
+    return true;
+}
+
+/*
+================
+IMG_FreePrepared
+
+Frees data returned by IMG_PrepareLoad or texture cache without uploading.
+================
+*/
+void IMG_FreePrepared(imgupload_t *up)
+{
+    if (up->mapping)
+        Sys_UnmapFile(up->mapping, up->mapsize);
+    else if (up->allocated)
+        FS_FreeTempMem(up->data);
+    up->data = NULL;
+    up->mapping = NULL;
+}
+
+/*
+================
+IMG_PrepareChecksum
+
+Returns checksum of all settings IMG_PrepareLoad output depends on.
+Used to invalidate texture cache entries.
+================
+*/
+unsigned IMG_PrepareChecksum(void)
+{
+    struct {
+        int     alpha_format, solid_format;
+        int     max_texture_size;
+        int     caps;
+        int     round_down, picmip, downsample_skins;
+        int     gamma_scale_pics, invert, gammaramp;
+        float   colorscale;
+        bool    lightscale;
+        byte    gammatable[256];
+        byte    gammaintensitytable[256];
+    } s;
+
+    memset(&s, 0, sizeof(s));
+    s.alpha_format = gl_tex_alpha_format;
+    s.solid_format = gl_tex_solid_format;
+    s.max_texture_size = gl_config.max_texture_size;
+    s.caps = gl_config.caps & (QGL_CAP_TEXTURE_NON_POWER_OF_TWO | QGL_CAP_TEXTURE_BITS);
+    s.round_down = gl_round_down->integer;
+    s.picmip = Cvar_ClampInteger(gl_picmip, 0, 31);
+    s.downsample_skins = gl_downsample_skins->integer;
+    s.gamma_scale_pics = gl_gamma_scale_pics->integer;
+    s.invert = gl_invert->integer;
+    s.gammaramp = r_config.flags & QVF_GAMMARAMP;
+    s.colorscale = colorscale;
+    s.lightscale = lightscale;
+    memcpy(s.gammatable, gammatable, sizeof(s.gammatable));
+    memcpy(s.gammaintensitytable, gammaintensitytable, sizeof(s.gammaintensitytable));
+
+    return Com_BlockChecksum(&s, sizeof(s));
+}
+
+/*
+================
+IMG_LoadPrepared
+
+Finishes IMG_Load with data returned by IMG_PrepareLoad.
+================
+*/
+void IMG_LoadPrepared(image_t *image, imgupload_t *up)
+{
+    qglGenTextures(1, &image->texnum);
+    GL_ForceTexture(TMU_TEXTURE, image->texnum);
+
+    GL_SubmitUpload32(up, 0, image->type, image->flags);
+    GL_FinishTexture(image, 0);
+}
+
 void IMG_Unload(image_t *image)
 {
     if (image->texnum && !(image->flags & IF_SCRAP)) {
@@ -324,6 +324,7 @@ static void GL_MarkLeaves(void)
 {
     const bsp_t *bsp = gl_static.world.cache;
     const mleaf_t *leaf;
+    const visrow_t *vis, *row;
     visrow_t vis1, vis2;
     int i, cluster1, cluster2;
     vec3_t tmp;
@@ -361,12 +362,13 @@ static void GL_MarkLeaves(void)
         return;
     }
 
-    BSP_ClusterVis(bsp, &vis1, cluster1, DVIS_PVS);
+    vis = BSP_GetClusterVis(bsp, &vis1, cluster1, DVIS_PVS);
     if (cluster1 != cluster2) {
-        BSP_ClusterVis(bsp, &vis2, cluster2, DVIS_PVS);
+        row = BSP_GetClusterVis(bsp, &vis2, cluster2, DVIS_PVS);
         int longs = VIS_FAST_LONGS(bsp->visrowsize);
         for (i = 0; i < longs; i++)
-            vis1.l[i] |= vis2.l[i];
+            vis1.l[i] = vis->l[i] | row->l[i];
+        vis = &vis1;
     }
 
     glr.nodes_visible = 0;
@@ -374,7 +376,7 @@ static void GL_MarkLeaves(void)
         cluster1 = leaf->cluster;
         if (cluster1 == -1)
             continue;
-        if (!Q_IsBitSet(vis1.b, cluster1))
+        if (!Q_IsBitSet(vis->b, cluster1))
             continue;
         // mark parent nodes visible
         for (mnode_t *node = (mnode_t *)leaf; node && node->visframe != glr.visframe; node = node->parent) {
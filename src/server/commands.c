@@ -1769,6 +1769,10 @@ static const cmdreg_t c_server[] = {
     { "demomap", SV_DemoMap_f, SV_DemoMap_c },
     { "gamemap", SV_GameMap_f, SV_Map_c },
     { "dumpents", SV_DumpEnts_f },
+    { "deltastats", SV_DeltaStats_f },
+    { "areastats", SV_AreaStats_f },
+    { "scratchstats", SV_ScratchStats_f },
+    { "framestats", SV_FrameStats_f },
     { "setmaster", SV_SetMaster_f },
     { "listmasters", SV_ListMasters_f },
     { "killserver", SV_KillServer_f },
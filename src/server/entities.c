@@ -30,6 +30,213 @@ Encode a client frame onto the network channel
 #define Q2PRO_OPTIMIZE(c) \
     ((c)->protocol == PROTOCOL_VERSION_Q2PRO && !(c)->settings[CLS_RECORDING])
 
+/*
+=============================================================================
+
+Delta entity encoding cache
+
+Clients watching the same entities mostly receive identical transitions from
+the same old state to the same new state. Encoded bytes are cached for the
+duration of a frame and copied into msg_write when transition repeats. Each
+thread writing frames has its own cache, so no locking is needed.
+
+=============================================================================
+*/
+
+#define ESCACHE_SLOTS   2048    // must be power of two
+#define ESCACHE_BYTES   0x20000
+
+// entity_packed_t may have padding at the end, don't hash or compare it
+#define ES_KEYSIZE  (offsetof(entity_packed_t, loop_attenuation) + 1)
+
+typedef struct {
+    unsigned        generation;
+    uint32_t        hash;
+    msgEsFlags_t    flags;
+    unsigned        ofs;
+    unsigned        len;
+    entity_packed_t from;
+    entity_packed_t to;
+} escache_slot_t;
+
+typedef struct {
+    unsigned        generation;
+    unsigned        numslots;
+    unsigned        datasize;
+    uint64_t        hits;
+    uint64_t        misses;
+    uint64_t        bytes;
+    escache_slot_t  slots[ESCACHE_SLOTS];
+    byte            data[ESCACHE_BYTES];
+} escache_t;
+
+static struct {
+    unsigned    generation;
+    escache_t   *caches[MAX_SEND_WORKERS + 1];
+} sv_escache;
+
+// only number, angles and origins are hashed, these change most often.
+// anything else differing is sorted out by full comparison.
+static uint32_t hash_delta(const entity_packed_t *from,
+                           const entity_packed_t *to, msgEsFlags_t flags)
+{
+    uint32_t hash = flags, a, b;
+    int i;
+
+    for (i = 0; i < offsetof(entity_packed_t, modelindex); i += 4) {
+        memcpy(&a, (const byte *)from + i, 4);
+        memcpy(&b, (const byte *)to + i, 4);
+        hash = (hash ^ a ^ (b * 0x85ebca6b)) * 0x9e3779b1;
+        hash ^= hash >> 15;
+    }
+
+    return hash;
+}
+
+/*
+=============
+write_delta_entity
+
+Same as MSG_WriteDeltaEntity, but tries to reuse encoded bytes from cache.
+=============
+*/
+static void write_delta_entity(const entity_packed_t *from,
+                               const entity_packed_t *to, msgEsFlags_t flags)
+{
+    escache_t *cache = sv_escache.caches[sv_worker_index];
+    escache_slot_t *slot;
+    uint32_t hash;
+    unsigned i, start, len;
+
+    if (!cache || !sv_delta_cache->integer) {
+        MSG_WriteDeltaEntity(from, to, flags);
+        return;
+    }
+
+    // invalidate all slots once per frame
+    if (cache->generation != sv_escache.generation) {
+        cache->generation = sv_escache.generation;
+        cache->numslots = 0;
+        cache->datasize = 0;
+    }
+
+    hash = hash_delta(from, to, flags);
+
+    for (i = hash & (ESCACHE_SLOTS - 1);; i = (i + 1) & (ESCACHE_SLOTS - 1)) {
+        slot = &cache->slots[i];
+        if (slot->generation != cache->generation)
+            break;
+        if (slot->hash == hash && slot->flags == flags &&
+            !memcmp(&slot->from, from, ES_KEYSIZE) &&
+            !memcmp(&slot->to, to, ES_KEYSIZE)) {
+            SZ_Write(&msg_write, cache->data + slot->ofs, slot->len);
+            cache->hits++;
+            cache->bytes += slot->len;
+            return;
+        }
+    }
+
+    start = msg_write.cursize;
+    MSG_WriteDeltaEntity(from, to, flags);
+    cache->misses++;
+
+    if (msg_write.overflowed || msg_write.cursize < start)
+        return;
+
+    // keep load factor low, probing stops at first free slot
+    len = msg_write.cursize - start;
+    if (cache->numslots >= ESCACHE_SLOTS * 3 / 4)
+        return;
+    if (len > ESCACHE_BYTES - cache->datasize)
+        return;
+
+    slot->generation = cache->generation;
+    slot->hash = hash;
+    slot->flags = flags;
+    slot->ofs = cache->datasize;
+    slot->len = len;
+    memcpy(&slot->from, from, ES_KEYSIZE);
+    memcpy(&slot->to, to, ES_KEYSIZE);
+
+    memcpy(cache->data + cache->datasize, msg_write.data + start, len);
+    cache->datasize += len;
+    cache->numslots++;
+}
+
+/*
+=============
+SV_BeginEntityCache
+
+Called once per frame on main thread before frames are written. Makes sure
+caches exist for main thread and `numthreads' worker threads.
+=============
+*/
+void SV_BeginEntityCache(int numthreads)
+{
+    int i;
+
+    if (!sv_delta_cache->integer)
+        return;
+
+    // generation 0 is never used so that zero filled slots are invalid
+    if (!++sv_escache.generation)
+        sv_escache.generation++;
+
+    for (i = 0; i <= numthreads; i++)
+        if (!sv_escache.caches[i])
+            sv_escache.caches[i] = SV_Mallocz(sizeof(escache_t));
+}
+
+/*
+=============
+SV_FreeEntityCache
+=============
+*/
+void SV_FreeEntityCache(void)
+{
+    int i;
+
+    for (i = 0; i <= MAX_SEND_WORKERS; i++)
+        Z_Freep(&sv_escache.caches[i]);
+}
+
+/*
+=============
+SV_DeltaStats_f
+=============
+*/
+void SV_DeltaStats_f(void)
+{
+    uint64_t hits = 0, misses = 0, bytes = 0;
+    const escache_t *cache;
+    int i, count = 0;
+
+    for (i = 0; i <= MAX_SEND_WORKERS; i++) {
+        cache = sv_escache.caches[i];
+        if (!cache)
+            continue;
+        if (Cmd_Argc() > 1) {
+            memset((escache_t *)cache, 0, offsetof(escache_t, slots));
+            continue;
+        }
+        hits += cache->hits;
+        misses += cache->misses;
+        bytes += cache->bytes;
+        count++;
+    }
+
+    if (Cmd_Argc() > 1)
+        return;
+
+    Com_Printf("Delta entity cache: %s, %d thread%s\n",
+               sv_delta_cache->integer ? "enabled" : "disabled",
+               count, count == 1 ? "" : "s");
+    Com_Printf("Hits: %"PRIu64" (%"PRIu64" bytes)\n", hits, bytes);
+    Com_Printf("Misses: %"PRIu64"\n", misses);
+    if (hits + misses)
+        Com_Printf("Hit ratio: %.1f%%\n", hits * 100.0 / (hits + misses));
+}
+
 /*
 =============
 SV_TruncPacketEntities
@@ -189,7 +396,7 @@ static bool SV_EmitPacketEntities(client_t *client, const client_frame_t *from,
                 VectorCopy(oldent->origin, newent->origin);
                 VectorCopy(oldent->angles, newent->angles);
             }
-            MSG_WriteDeltaEntity(oldent, newent, flags);
+            write_delta_entity(oldent, newent, flags);
             oldindex++;
             newindex++;
             continue;
@@ -209,7 +416,7 @@ static bool SV_EmitPacketEntities(client_t *client, const client_frame_t *from,
                 VectorCopy(oldent->origin, newent->origin);
                 VectorCopy(oldent->angles, newent->angles);
             }
-            MSG_WriteDeltaEntity(oldent, newent, flags);
+            write_delta_entity(oldent, newent, flags);
             newindex++;
             continue;
         }
@@ -488,15 +695,17 @@ static bool SV_EntityAttenuatedAway(const vec3_t org, const edict_t *ent)
     ((ent->svflags & (SVF_MONSTER | SVF_DEADMONSTER)) == SVF_MONSTER || (ent->s.renderfx & RF_FRAMELERP))
 
 #define IS_HI_PRIO(ent) \
-    (ent->s.number <= sv_client->maxclients || IS_MONSTER(ent) || ent->solid == SOLID_BSP)
+    (ent->s.number <= sortclient->maxclients || IS_MONSTER(ent) || ent->solid == SOLID_BSP)
 
 #define IS_GIB(ent) \
-    (sv_client->csr->extended ? (ent->s.renderfx & RF_LOW_PRIORITY) : (ent->s.effects & (EF_GIB | EF_GREENGIB)))
+    (sortclient->csr->extended ? (ent->s.renderfx & RF_LOW_PRIORITY) : (ent->s.effects & (EF_GIB | EF_GREENGIB)))
 
 #define IS_LO_PRIO(ent) \
     (IS_GIB(ent) || (!ent->s.modelindex && !ent->s.effects))
 
-static vec3_t clientorg;
+// frames may be built in parallel by worker threads
+static q_thread_local const client_t *sortclient;
+static q_thread_local vec3_t clientorg;
 
 static int entpriocmp(const void *p1, const void *p2)
 {
@@ -527,30 +736,211 @@ static int entnumcmp(const void *p1, const void *p2)
     return a->s.number - b->s.number;
 }
 
+/*
+=============================================================================
+
+Per-frame visibility data shared between clients
+
+=============================================================================
+*/
+
+typedef struct {
+    const cm_t  *cm;
+    int         vis;
+    int         numclusters;
+    int         clusters[MAX_FAT_CLUSTERS];
+    const visrow_t  *ptr;   // either row or shared BSP row
+    visrow_t    *row;
+} visrow_entry_t;
+
+typedef struct {
+    const game_export_t *ge;
+    int         num_edicts;
+    edict_t     **edicts;   // [MAX_EDICTS]
+} visents_entry_t;
+
+static struct {
+    int             numrows, maxrows;
+    visrow_entry_t  *rows;
+    int             numents, maxents;
+    visents_entry_t *ents;
+} sv_vis;
+
+// clients in the same cluster share decompressed vis rows
+static const visrow_t *get_vis_row(const cm_t *cm, int vis, const int *clusters, int numclusters)
+{
+    visrow_entry_t *entry;
+    int i;
+
+    for (i = 0, entry = sv_vis.rows; i < sv_vis.numrows; i++, entry++)
+        if (entry->cm == cm && entry->vis == vis && entry->numclusters == numclusters &&
+            !memcmp(entry->clusters, clusters, sizeof(clusters[0]) * numclusters))
+            return entry->ptr;
+
+    if (sv_vis.numrows == sv_vis.maxrows) {
+        sv_vis.maxrows += 16;
+        sv_vis.rows = Z_ReallocArray(sv_vis.rows, sv_vis.maxrows, sizeof(sv_vis.rows[0]), TAG_SERVER);
+        memset(sv_vis.rows + sv_vis.numrows, 0, sizeof(sv_vis.rows[0]) * 16);
+    }
+
+    entry = &sv_vis.rows[sv_vis.numrows++];
+    if (!entry->row)
+        entry->row = SV_Malloc(sizeof(*entry->row));
+
+    entry->cm = cm;
+    entry->vis = vis;
+    entry->numclusters = numclusters;
+    memcpy(entry->clusters, clusters, sizeof(clusters[0]) * numclusters);
+
+    if (vis == DVIS_PHS || numclusters == 1) {
+        entry->ptr = BSP_GetClusterVis(cm->cache, entry->row, clusters[0], vis);
+    } else {
+        CM_ClustersVis(cm, entry->row, clusters, numclusters);
+        entry->ptr = entry->row;
+    }
+
+    return entry->ptr;
+}
+
+// client independent entity checks are done once per frame
+static const visents_entry_t *get_vis_ents(const game_export_t *ge)
+{
+    visents_entry_t *entry;
+    edict_t *ent;
+    int i;
+
+    for (i = 0, entry = sv_vis.ents; i < sv_vis.numents; i++, entry++)
+        if (entry->ge == ge)
+            return entry;
+
+    if (sv_vis.numents == sv_vis.maxents) {
+        sv_vis.maxents += 4;
+        sv_vis.ents = Z_ReallocArray(sv_vis.ents, sv_vis.maxents, sizeof(sv_vis.ents[0]), TAG_SERVER);
+        memset(sv_vis.ents + sv_vis.numents, 0, sizeof(sv_vis.ents[0]) * 4);
+    }
+
+    entry = &sv_vis.ents[sv_vis.numents++];
+    if (!entry->edicts)
+        entry->edicts = SV_Malloc(sizeof(entry->edicts[0]) * MAX_EDICTS);
+
+    entry->ge = ge;
+    entry->num_edicts = 0;
+
+    for (i = 1; i < ge->num_edicts; i++) {
+        ent = EDICT_NUM2(ge, i);
+
+        // ignore entities not in use
+        if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE))
+            continue;
+
+        // ignore ents without visible models
+        if (ent->svflags & SVF_NOCLIENT)
+            continue;
+
+        // ignore ents without visible models unless they have an effect
+        if (!HAS_EFFECTS(ent))
+            continue;
+
+        SV_CheckEntityNumber(ent, i);
+
+        entry->edicts[entry->num_edicts++] = ent;
+    }
+
+    return entry;
+}
+
+/*
+=============
+SV_BeginFrameVis
+
+Invalidates shared visibility data. Called once per frame before
+building any client frames.
+=============
+*/
+void SV_BeginFrameVis(void)
+{
+    sv_vis.numrows = 0;
+    sv_vis.numents = 0;
+}
+
+/*
+=============
+SV_CalcClientVis
+
+Finds client's PVS, PHS and list of candidate entities for the current
+frame. Must be called from main thread before SV_BuildClientFrame.
+=============
+*/
+void SV_CalcClientVis(client_t *client)
+{
+    client_vis_t        *vis = &client->vis;
+    const visents_entry_t *ents;
+    const mleaf_t       *leaf;
+    int                 clusters[MAX_FAT_CLUSTERS];
+    int                 numclusters;
+
+    if (!client->edict->client)
+        return;        // not in game yet
+
+    SV_GetClient_ViewOrg(client, vis->org);
+
+    leaf = CM_PointLeaf(client->cm, vis->org);
+    vis->area = leaf->area;
+    vis->cluster = leaf->cluster;
+
+    numclusters = CM_FatClusters(client->cm, clusters, vis->org);
+    vis->pvs = get_vis_row(client->cm, DVIS_PVS, clusters, numclusters);
+    vis->phs = get_vis_row(client->cm, DVIS_PHS, &vis->cluster, 1);
+
+    ents = get_vis_ents(client->ge);
+    vis->edicts = ents->edicts;
+    vis->num_edicts = ents->num_edicts;
+}
+
+/*
+=============
+SV_FreeFrameVis
+=============
+*/
+void SV_FreeFrameVis(void)
+{
+    int i;
+
+    for (i = 0; i < sv_vis.maxrows; i++)
+        Z_Free(sv_vis.rows[i].row);
+    for (i = 0; i < sv_vis.maxents; i++)
+        Z_Free(sv_vis.ents[i].edicts);
+    Z_Free(sv_vis.rows);
+    Z_Free(sv_vis.ents);
+
+    memset(&sv_vis, 0, sizeof(sv_vis));
+}
+
 /*
 =============
 SV_BuildClientFrame
 
 Decides which entities are going to be visible to the client, and
 copies off the playerstat and areabits.
+
+May be called from send worker threads. Must not touch anything but
+the client itself and read-only world state.
 =============
 */
 void SV_BuildClientFrame(client_t *client)
 {
     int         i, e;
-    vec3_t      org;
+    const vec_t *org;
     edict_t     *ent;
     edict_t     *clent;
     client_frame_t  *frame;
     entity_packed_t *state;
-    const mleaf_t   *leaf;
-    int         clientarea, clientcluster;
-    visrow_t    clientphs;
-    visrow_t    clientpvs;
+    const client_vis_t  *vis;
     bool        need_clientnum_fix;
     int         max_packet_entities;
-    edict_t     *edicts[MAX_EDICTS];
+    edict_t     **edicts;
     int         num_edicts;
+    size_t      mark;
     qboolean (*visible)(edict_t *, edict_t *) = NULL;
     qboolean (*customize)(edict_t *, edict_t *, customize_entity_t *) = NULL;
     customize_entity_t temp;
@@ -569,15 +959,12 @@ void SV_BuildClientFrame(client_t *client)
 
     client->frames_sent++;
 
-    // find the client's PVS
-    SV_GetClient_ViewOrg(client, org);
-
-    leaf = CM_PointLeaf(client->cm, org);
-    clientarea = leaf->area;
-    clientcluster = leaf->cluster;
+    // client's PVS was found by SV_CalcClientVis
+    vis = &client->vis;
+    org = vis->org;
 
     // calculate the visible areas
-    frame->areabytes = CM_WriteAreaBits(client->cm, frame->areabits, clientarea);
+    frame->areabytes = CM_WriteAreaBits(client->cm, frame->areabits, vis->area);
     if (!frame->areabytes && client->protocol != PROTOCOL_VERSION_Q2PRO) {
         frame->areabits[0] = 255;
         frame->areabytes = 1;
@@ -616,28 +1003,16 @@ void SV_BuildClientFrame(client_t *client)
         customize = gex->CustomizeEntityToClient;
     }
 
-    CM_FatPVS(client->cm, &clientpvs, org);
-    BSP_ClusterVis(client->cm->cache, &clientphs, clientcluster, DVIS_PHS);
-
     // build up the list of visible entities
     frame->num_entities = 0;
     frame->first_entity = client->next_entity;
 
+    // go through entities that passed client independent checks
+    mark = SV_ScratchMark();
+    edicts = SV_ScratchAlloc(sizeof(edicts[0]) * max(vis->num_edicts, 1));
     num_edicts = 0;
-    for (e = 1; e < client->ge->num_edicts; e++) {
-        ent = EDICT_NUM2(client->ge, e);
-
-        // ignore entities not in use
-        if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE))
-            continue;
-
-        // ignore ents without visible models
-        if (ent->svflags & SVF_NOCLIENT)
-            continue;
-
-        // ignore ents without visible models unless they have an effect
-        if (!HAS_EFFECTS(ent))
-            continue;
+    for (i = 0; i < vis->num_edicts; i++) {
+        ent = vis->edicts[i];
 
         // ignore gibs if client says so
         if (client->settings[CLS_NOGIBS]) {
@@ -654,10 +1029,10 @@ void SV_BuildClientFrame(client_t *client)
         // ignore if not touching a PV leaf
         if (ent != clent && !sv_novis->integer && !(client->csr->extended && ent->svflags & SVF_NOCULL)) {
             // check area
-            if (!CM_AreasConnected(client->cm, clientarea, ent->areanum)) {
+            if (!CM_AreasConnected(client->cm, vis->area, ent->areanum)) {
                 // doors can legally straddle two areas, so
                 // we may need to check another one
-                if (!CM_AreasConnected(client->cm, clientarea, ent->areanum2)) {
+                if (!CM_AreasConnected(client->cm, vis->area, ent->areanum2)) {
                     continue;        // blocked by a door
                 }
             }
@@ -668,7 +1043,7 @@ void SV_BuildClientFrame(client_t *client)
             // remaster uses different sound culling rules
             bool sound_cull = client->csr->extended && ent->s.sound;
 
-            if (!SV_EntityVisible(client, ent, (beam_cull || sound_cull) ? &clientphs : &clientpvs))
+            if (!SV_EntityVisible(client, ent, (beam_cull || sound_cull) ? vis->phs : vis->pvs))
                 continue;
 
             // don't send sounds if they will be attenuated away
@@ -676,7 +1051,7 @@ void SV_BuildClientFrame(client_t *client)
                 if (SV_EntityAttenuatedAway(org, ent)) {
                     if (!ent->s.modelindex)
                         continue;
-                    if (!beam_cull && !SV_EntityVisible(client, ent, &clientpvs))
+                    if (!beam_cull && !SV_EntityVisible(client, ent, vis->pvs))
                         continue;
                 }
             } else if (!ent->s.modelindex) {
@@ -685,8 +1060,6 @@ void SV_BuildClientFrame(client_t *client)
             }
         }
 
-        SV_CheckEntityNumber(ent, e);
-
         // optionally skip it
         if (visible && !visible(clent, ent))
             continue;
@@ -700,11 +1073,9 @@ void SV_BuildClientFrame(client_t *client)
     // prioritize entities on overflow
     if (num_edicts > max_packet_entities) {
         VectorCopy(org, clientorg);
-        sv_client = client;
-        sv_player = client->edict;
+        sortclient = client;
         qsort(edicts, num_edicts, sizeof(edicts[0]), entpriocmp);
-        sv_client = NULL;
-        sv_player = NULL;
+        sortclient = NULL;
         num_edicts = max_packet_entities;
         qsort(edicts, num_edicts, sizeof(edicts[0]), entnumcmp);
     }
@@ -762,6 +1133,8 @@ void SV_BuildClientFrame(client_t *client)
         client->next_entity++;
     }
 
+    SV_ScratchRelease(mark);
+
     if (need_clientnum_fix)
         frame->clientNum = client->infonum;
 }
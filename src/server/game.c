@@ -452,15 +452,16 @@ static void PF_WritePos(const vec3_t pos)
 static qboolean PF_inVIS(const vec3_t p1, const vec3_t p2, vis_t vis)
 {
     const mleaf_t *leaf1, *leaf2;
-    visrow_t mask;
+    const visrow_t *mask;
+    visrow_t temp;
 
     leaf1 = CM_PointLeaf(&sv.cm, p1);
-    BSP_ClusterVis(sv.cm.cache, &mask, leaf1->cluster, vis & VIS_PHS);
+    mask = BSP_GetClusterVis(sv.cm.cache, &temp, leaf1->cluster, vis & VIS_PHS);
 
     leaf2 = CM_PointLeaf(&sv.cm, p2);
     if (leaf2->cluster == -1)
         return false;
-    if (!Q_IsBitSet(mask.b, leaf2->cluster))
+    if (!Q_IsBitSet(mask->b, leaf2->cluster))
         return false;
     if (vis & VIS_NOAREAS)
         return true;
@@ -526,7 +527,8 @@ static void SV_StartSound(const vec3_t origin, edict_t *edict,
     int         i, ent, vol, att, ofs, flags, sendchan;
     vec3_t      origin_v;
     client_t    *client;
-    visrow_t    mask;
+    visrow_t    temp;
+    const visrow_t      *mask;
     const mleaf_t       *leaf1, *leaf2;
     message_packet_t    *msg;
     bool        force_pos;
@@ -614,9 +616,10 @@ static void SV_StartSound(const vec3_t origin, edict_t *edict,
     }
 
     leaf1 = NULL;
+    mask = NULL;
     if (!(channel & CHAN_NO_PHS_ADD)) {
         leaf1 = CM_PointLeaf(&sv.cm, origin);
-        BSP_ClusterVis(sv.cm.cache, &mask, leaf1->cluster, DVIS_PHS);
+        mask = BSP_GetClusterVis(sv.cm.cache, &temp, leaf1->cluster, DVIS_PHS);
     }
 
     // decide per client if origin needs to be sent
@@ -633,7 +636,7 @@ static void SV_StartSound(const vec3_t origin, edict_t *edict,
                 continue;
             if (leaf2->cluster == -1)
                 continue;
-            if (!Q_IsBitSet(mask.b, leaf2->cluster))
+            if (!Q_IsBitSet(mask->b, leaf2->cluster))
                 continue;
         }
 
@@ -773,7 +776,8 @@ static int PF_LoadFile(const char *path, void **buffer, unsigned flags, unsigned
     if (tag > UINT16_MAX - TAG_MAX) {
         Com_Error(ERR_DROP, "%s: bad tag", __func__);
     }
-    return FS_LoadFileEx(path, buffer, flags, tag + TAG_MAX);
+    // game frees with TagFree/FreeTags, mapped buffers can't be supported
+    return FS_LoadFileEx(path, buffer, flags & ~FS_FLAG_MAPPED, tag + TAG_MAX);
 }
 
 static void *PF_TagRealloc(void *ptr, size_t size)
@@ -875,6 +879,12 @@ static const debug_draw_api_v1_t debug_draw_api_v1 = {
 };
 #endif
 
+static const parallel_api_v1_t parallel_api_v1 = {
+    .NumThreads = SV_NumWorkerThreads,
+    .RunParallel = SV_RunParallel,
+    .ClipToEntities = SV_ClipToEntities,
+};
+
 static void *PF_GetExtension(const char *name)
 {
     if (!name)
@@ -883,6 +893,9 @@ static void *PF_GetExtension(const char *name)
     if (!strcmp(name, FILESYSTEM_API_V1))
         return (void *)&filesystem_api_v1;
 
+    if (!strcmp(name, PARALLEL_API_V1))
+        return (void *)&parallel_api_v1;
+
 #if USE_REF && USE_DEBUG
     if (!strcmp(name, DEBUG_DRAW_API_V1) && !dedicated->integer)
         return (void *)&debug_draw_api_v1;
@@ -177,6 +177,7 @@ void SV_SpawnServer(const mapcmd_t *cmd)
     // clear physics interaction links
     //
     SV_ClearWorld();
+    SV_InitMulticast();
 
     //
     // spawn the rest of the entities on the map
@@ -186,6 +187,11 @@ void SV_SpawnServer(const mapcmd_t *cmd)
     // map initialization
     SV_SetState(ss_loading);
 
+#if USE_REPLAY
+    // start recording or replaying with the same random seed
+    SV_ReplaySpawn();
+#endif
+
     // load and spawn all other entities
     ge->SpawnEntities(sv.name, sv.cm.entitystring, cmd->spawnpoint);
 
@@ -0,0 +1,885 @@
+/*
+Copyright (C) 2026 Q2PRO contributors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// loadgen.c -- simulated clients for server load testing
+
+#include "server.h"
+#include "common/crc.h"
+
+/*
+===============================================================================
+
+Each simulated client talks to the target server over its own UDP socket
+using the original protocol 34 and the old netchan, performs the usual
+challenge, connect, new, precache and begin handshake, and then sends
+movement commands at loadgen_rate packets per second.
+
+Server messages are parsed only as far as needed to answer stufftext
+commands and to acknowledge the latest frame, so that the server keeps
+delta compressing as it would for a real client. Anything after svc_frame
+(entities, temp entities, unreliable sounds) is skipped unparsed.
+
+Handshakes are done one client at a time, since the server keeps only one
+outstanding challenge per IP address.
+
+===============================================================================
+*/
+
+#define LG_RESEND_TIME  1000    // handshake packet retransmit time
+#define LG_TIMEOUT      15000   // drop client if nothing heard for this long
+#define LG_BACKUP       64      // must be power of two
+#define LG_MASK         (LG_BACKUP - 1)
+
+typedef enum {
+    LG_DISCONNECTED,
+    LG_CHALLENGING,     // waiting for challenge
+    LG_CONNECTING,      // waiting for client_connect
+    LG_CONNECTED,       // netchan established, loading
+    LG_SPAWNED          // receiving frames
+} lgstate_t;
+
+typedef struct {
+    int         number;
+    lgstate_t   state;
+    netsrc_t    sock;
+    netadr_t    address;
+    netchan_t   netchan;
+    int         qport;
+    int         challenge;
+    int         serverframe;        // last frame received, -1 if none
+
+    unsigned    connect_time;       // start of the current handshake step
+    unsigned    handshake_time;     // last handshake packet sent
+    unsigned    last_received;
+    unsigned    next_send;
+    unsigned    last_cmd;
+
+    // movement state
+    uint32_t    seed;
+    usercmd_t   cmds[3];            // oldest, old, new
+    int         yaw, yawspeed;
+    int         forwardmove, sidemove;
+
+    unsigned    sent_time[LG_BACKUP];   // indexed by outgoing sequence
+    unsigned    last_acked;
+
+    // statistics
+    unsigned    start_time;
+    unsigned    end_time;
+    uint64_t    bytes_sent, bytes_rcvd;
+    unsigned    packets_sent, packets_rcvd, packets_dropped;
+    unsigned    ping_total, ping_count, ping_min, ping_max;
+
+    char        reason[64];         // why disconnected
+} lgclient_t;
+
+static lgclient_t   *lg_clients;
+static int          lg_numclients;
+static lgclient_t   *lg_current;    // for LG_PacketEvent
+static unsigned     lg_time;
+
+static cvar_t   *loadgen_rate;
+static cvar_t   *loadgen_move;
+
+static const char *const lg_statenames[] = {
+    "disconn",
+    "challenge",
+    "connect",
+    "loading",
+    "spawned"
+};
+
+static uint32_t LG_Random(lgclient_t *c)
+{
+    // xorshift32, repeatable for given client number
+    c->seed ^= c->seed << 13;
+    c->seed ^= c->seed >> 17;
+    c->seed ^= c->seed << 5;
+    return c->seed;
+}
+
+static unsigned LG_Interval(void)
+{
+    return 1000 / Cvar_ClampInteger(loadgen_rate, 1, 125);
+}
+
+static void LG_ClientCommand(lgclient_t *c, const char *s)
+{
+    SZ_WriteByte(&c->netchan.message, clc_stringcmd);
+    SZ_WriteString(&c->netchan.message, s);
+}
+
+static void LG_Transmit(lgclient_t *c, size_t len, const void *data)
+{
+    c->sent_time[c->netchan.outgoing_sequence & LG_MASK] = lg_time;
+    c->bytes_sent += Netchan_Transmit(&c->netchan, len, data, 1);
+    c->packets_sent++;
+}
+
+/*
+==================
+LG_Disconnect
+==================
+*/
+static void LG_Disconnect(lgclient_t *c, const char *reason)
+{
+    int i;
+
+    if (c->state == LG_DISCONNECTED)
+        return;
+
+    if (c->state >= LG_CONNECTED) {
+        // send it a few times in case one is dropped
+        MSG_WriteByte(clc_stringcmd);
+        MSG_WriteData("disconnect", 11);
+        for (i = 0; i < 3; i++)
+            LG_Transmit(c, msg_write.cursize, msg_write.data);
+        SZ_Clear(&msg_write);
+        Netchan_Close(&c->netchan);
+    }
+
+    Com_Printf("[lg%02d] Disconnected: %s\n", c->number, reason);
+    Q_strlcpy(c->reason, reason, sizeof(c->reason));
+    c->state = LG_DISCONNECTED;
+    c->end_time = lg_time;
+}
+
+static void LG_SendConnect(lgclient_t *c)
+{
+    char userinfo[MAX_INFO_STRING];
+
+    Q_snprintf(userinfo, sizeof(userinfo),
+               "\\name\\lg%02d\\skin\\male/grunt\\rate\\25000\\msg\\1\\hand\\2\\fov\\90",
+               c->number);
+
+    Netchan_OutOfBand(c->sock, &c->address, "connect %i %i %i \"%s\"\n",
+                      PROTOCOL_VERSION_DEFAULT, c->qport, c->challenge, userinfo);
+}
+
+static void LG_Reconnect(lgclient_t *c)
+{
+    // server is changing maps, start loading over
+    c->state = LG_CONNECTED;
+    c->serverframe = -1;
+    LG_ClientCommand(c, "new");
+}
+
+/*
+==================
+LG_StuffText
+
+Answers commands server expects a real client to execute.
+==================
+*/
+static void LG_StuffText(lgclient_t *c, char *text)
+{
+    char *p, *s;
+
+    for (; text; text = p) {
+        p = strchr(text, '\n');
+        if (p)
+            *p++ = 0;
+
+        // expands $version, etc
+        Cmd_TokenizeString(text, true);
+        s = Cmd_Argv(0);
+
+        if (!strcmp(s, "cmd")) {
+            if (Cmd_Argc() > 1)
+                LG_ClientCommand(c, Cmd_RawArgsFrom(1));
+        } else if (!strcmp(s, "precache")) {
+            LG_ClientCommand(c, va("begin %s\n", Cmd_Argv(1)));
+        } else if (!strcmp(s, "reconnect")) {
+            LG_Reconnect(c);
+        }
+    }
+}
+
+static bool LG_ParseServerData(lgclient_t *c)
+{
+    int protocol = MSG_ReadLong();
+
+    if (protocol != PROTOCOL_VERSION_DEFAULT) {
+        LG_Disconnect(c, va("unsupported protocol %d", protocol));
+        return false;
+    }
+
+    MSG_ReadLong();         // spawn count
+    MSG_ReadByte();         // attract loop
+    MSG_ReadString(NULL, 0);    // game directory
+    MSG_ReadShort();        // client number
+    MSG_ReadString(NULL, 0);    // level name
+    return true;
+}
+
+static bool LG_ParseBaseline(void)
+{
+    entity_state_t es;
+    uint64_t bits;
+    int number;
+
+    number = MSG_ParseEntityBits(&bits, 0);
+    if (number < 1 || number >= MAX_EDICTS)
+        return false;
+
+    MSG_ParseDeltaEntity(&es, NULL, number, bits, 0);
+    return true;
+}
+
+static void LG_ParseSound(void)
+{
+    int flags = MSG_ReadByte();
+
+    if (flags & SND_INDEX16)
+        MSG_ReadWord();
+    else
+        MSG_ReadByte();
+    if (flags & SND_VOLUME)
+        MSG_ReadByte();
+    if (flags & SND_ATTENUATION)
+        MSG_ReadByte();
+    if (flags & SND_OFFSET)
+        MSG_ReadByte();
+    if (flags & SND_ENT)
+        MSG_ReadShort();
+    if (flags & SND_POS)
+        MSG_ReadData(6);
+}
+
+/*
+==================
+LG_ParseTempEntity
+
+Skips temp entity. Positions are 6 bytes and directions 1 byte without
+protocol extensions. Returns false on unknown type.
+==================
+*/
+static bool LG_ParseTempEntity(void)
+{
+    switch (MSG_ReadByte()) {
+    case TE_BLOOD:
+    case TE_GUNSHOT:
+    case TE_SPARKS:
+    case TE_BULLET_SPARKS:
+    case TE_SCREEN_SPARKS:
+    case TE_SHIELD_SPARKS:
+    case TE_SHOTGUN:
+    case TE_BLASTER:
+    case TE_GREENBLOOD:
+    case TE_BLASTER2:
+    case TE_FLECHETTE:
+    case TE_HEATBEAM_SPARKS:
+    case TE_HEATBEAM_STEAM:
+    case TE_MOREBLOOD:
+    case TE_ELECTRIC_SPARKS:
+    case TE_BLUEHYPERBLASTER_2:
+    case TE_BERSERK_SLAM:
+        MSG_ReadData(6 + 1);
+        break;
+
+    case TE_SPLASH:
+    case TE_LASER_SPARKS:
+    case TE_WELDING_SPARKS:
+    case TE_TUNNEL_SPARKS:
+        MSG_ReadData(1 + 6 + 1 + 1);
+        break;
+
+    case TE_BLUEHYPERBLASTER:
+    case TE_RAILTRAIL:
+    case TE_RAILTRAIL2:
+    case TE_BUBBLETRAIL:
+    case TE_DEBUGTRAIL:
+    case TE_BUBBLETRAIL2:
+    case TE_BFG_LASER:
+    case TE_BFG_ZAP:
+        MSG_ReadData(6 + 6);
+        break;
+
+    case TE_GRENADE_EXPLOSION:
+    case TE_GRENADE_EXPLOSION_WATER:
+    case TE_EXPLOSION2:
+    case TE_PLASMA_EXPLOSION:
+    case TE_ROCKET_EXPLOSION:
+    case TE_ROCKET_EXPLOSION_WATER:
+    case TE_EXPLOSION1:
+    case TE_EXPLOSION1_NP:
+    case TE_EXPLOSION1_BIG:
+    case TE_BFG_EXPLOSION:
+    case TE_BFG_BIGEXPLOSION:
+    case TE_BOSSTPORT:
+    case TE_PLAIN_EXPLOSION:
+    case TE_CHAINFIST_SMOKE:
+    case TE_TRACKER_EXPLOSION:
+    case TE_TELEPORT_EFFECT:
+    case TE_DBALL_GOAL:
+    case TE_WIDOWSPLASH:
+    case TE_NUKEBLAST:
+    case TE_EXPLOSION1_NL:
+    case TE_EXPLOSION2_NL:
+        MSG_ReadData(6);
+        break;
+
+    case TE_PARASITE_ATTACK:
+    case TE_MEDIC_CABLE_ATTACK:
+    case TE_HEATBEAM:
+    case TE_MONSTER_HEATBEAM:
+    case TE_GRAPPLE_CABLE_2:
+    case TE_LIGHTNING_BEAM:
+        MSG_ReadData(2 + 6 + 6);
+        break;
+
+    case TE_GRAPPLE_CABLE:
+        MSG_ReadData(2 + 6 + 6 + 6);
+        break;
+
+    case TE_LIGHTNING:
+        MSG_ReadData(2 + 2 + 6 + 6);
+        break;
+
+    case TE_FLASHLIGHT:
+        MSG_ReadData(6 + 2);
+        break;
+
+    case TE_FORCEWALL:
+        MSG_ReadData(6 + 6 + 1);
+        break;
+
+    case TE_STEAM:
+        if (MSG_ReadShort() == -1)
+            MSG_ReadData(1 + 6 + 1 + 1 + 2);
+        else
+            MSG_ReadData(1 + 6 + 1 + 1 + 2 + 4);
+        break;
+
+    case TE_WIDOWBEAMOUT:
+        MSG_ReadData(2 + 6);
+        break;
+
+    case TE_POWER_SPLASH:
+        MSG_ReadData(2 + 1);
+        break;
+
+    case TE_DAMAGE_DEALT:
+        MSG_ReadData(2);
+        break;
+
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+/*
+==================
+LG_ParseServerMessage
+
+Parses reliable part of the message up to svc_frame.
+==================
+*/
+static void LG_ParseServerMessage(lgclient_t *c)
+{
+    char string[MAX_NET_STRING];
+    int cmd, size;
+
+    while (1) {
+        if (msg_read.readcount > msg_read.cursize) {
+            LG_Disconnect(c, "read past end of server message");
+            return;
+        }
+
+        if ((cmd = MSG_ReadByte()) == -1)
+            return;
+
+        switch (cmd) {
+        case svc_nop:
+            break;
+
+        case svc_disconnect:
+            LG_Disconnect(c, "server disconnected");
+            return;
+
+        case svc_reconnect:
+            LG_Reconnect(c);
+            break;
+
+        case svc_print:
+            MSG_ReadByte();
+            MSG_ReadString(NULL, 0);
+            break;
+
+        case svc_centerprint:
+        case svc_layout:
+            MSG_ReadString(NULL, 0);
+            break;
+
+        case svc_stufftext:
+            MSG_ReadString(string, sizeof(string));
+            LG_StuffText(c, string);
+            break;
+
+        case svc_serverdata:
+            if (!LG_ParseServerData(c))
+                return;
+            break;
+
+        case svc_configstring:
+            MSG_ReadWord();
+            MSG_ReadString(NULL, 0);
+            break;
+
+        case svc_spawnbaseline:
+            if (!LG_ParseBaseline()) {
+                LG_Disconnect(c, "bad baseline");
+                return;
+            }
+            break;
+
+        case svc_inventory:
+            MSG_ReadData(MAX_ITEMS * 2);
+            break;
+
+        case svc_muzzleflash:
+        case svc_muzzleflash2:
+            MSG_ReadShort();
+            MSG_ReadByte();
+            break;
+
+        case svc_sound:
+            LG_ParseSound();
+            break;
+
+        case svc_download:
+            size = MSG_ReadShort();
+            MSG_ReadByte();
+            if (size > 0)
+                MSG_ReadData(size);
+            break;
+
+        case svc_frame:
+            c->serverframe = MSG_ReadLong();
+            if (c->state == LG_CONNECTED) {
+                Com_Printf("[lg%02d] Spawned\n", c->number);
+                c->state = LG_SPAWNED;
+            }
+            return;
+
+        case svc_temp_entity:
+            if (!LG_ParseTempEntity())
+                return;
+            break;
+
+        default:
+            // can't skip unknown command, rest of the message is lost
+            return;
+        }
+    }
+}
+
+static void LG_ConnectionlessPacket(lgclient_t *c)
+{
+    char string[MAX_STRING_CHARS];
+    char *s;
+
+    MSG_BeginReading();
+    MSG_ReadLong();     // skip the -1
+
+    if (MSG_ReadStringLine(string, sizeof(string)) >= sizeof(string))
+        return;
+
+    Cmd_TokenizeString(string, false);
+    s = Cmd_Argv(0);
+
+    if (!strcmp(s, "challenge")) {
+        if (c->state != LG_CHALLENGING)
+            return;
+        c->challenge = Q_atoi(Cmd_Argv(1));
+        c->state = LG_CONNECTING;
+        c->connect_time = c->handshake_time = lg_time;
+        LG_SendConnect(c);
+        return;
+    }
+
+    if (!strcmp(s, "client_connect")) {
+        if (c->state != LG_CONNECTING)
+            return;
+        Netchan_Setup(&c->netchan, c->sock, NETCHAN_OLD, &c->address,
+                      c->qport, MAX_PACKETLEN_WRITABLE_DEFAULT,
+                      PROTOCOL_VERSION_DEFAULT);
+        c->state = LG_CONNECTED;
+        c->serverframe = -1;
+        c->last_received = c->next_send = c->last_cmd = lg_time;
+        LG_ClientCommand(c, "new");
+        return;
+    }
+
+    if (!strcmp(s, "print")) {
+        if (c->state != LG_CHALLENGING && c->state != LG_CONNECTING)
+            return;
+        MSG_ReadString(string, sizeof(string));
+        COM_strclr(string);
+        LG_Disconnect(c, string);
+        return;
+    }
+}
+
+static void LG_PacketEvent(void)
+{
+    lgclient_t *c = lg_current;
+    unsigned ack;
+
+    if (!NET_IsEqualAdr(&net_from, &c->address))
+        return;
+
+    c->bytes_rcvd += msg_read.cursize;
+
+    if (msg_read.cursize >= 4 && *(int *)msg_read.data == -1) {
+        LG_ConnectionlessPacket(c);
+        return;
+    }
+
+    if (c->state < LG_CONNECTED)
+        return;
+
+    if (!Netchan_Process(&c->netchan))
+        return;
+
+    c->last_received = lg_time;
+    c->packets_rcvd++;
+    c->packets_dropped += c->netchan.dropped;
+
+    // measure round trip time of the newest command acknowledged
+    ack = c->netchan.incoming_acknowledged;
+    if (ack > c->last_acked && c->netchan.outgoing_sequence - ack <= LG_BACKUP) {
+        unsigned ping = lg_time - c->sent_time[ack & LG_MASK];
+
+        c->ping_total += ping;
+        c->ping_min = c->ping_count ? min(c->ping_min, ping) : ping;
+        c->ping_max = max(c->ping_max, ping);
+        c->ping_count++;
+        c->last_acked = ack;
+    }
+
+    LG_ParseServerMessage(c);
+}
+
+/*
+==================
+LG_BuildCmd
+
+Generates random but repeatable movement for each client.
+==================
+*/
+static void LG_BuildCmd(lgclient_t *c, usercmd_t *cmd, unsigned msec)
+{
+    static const int moves[3] = { -400, 0, 400 };
+    int mode = loadgen_move->integer;
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->msec = msec;
+
+    if (mode > 0) {
+        // change direction about once per second
+        if (LG_Random(c) % 1000 < msec) {
+            c->forwardmove = moves[LG_Random(c) % 3];
+            c->sidemove = moves[LG_Random(c) % 3];
+            c->yawspeed = (int)(LG_Random(c) % 65) - 32;
+        }
+        c->yaw += c->yawspeed * (int)msec;
+
+        cmd->forwardmove = c->forwardmove;
+        cmd->sidemove = c->sidemove;
+        if (LG_Random(c) % 2000 < msec)
+            cmd->upmove = 200;
+        if (mode > 1 && LG_Random(c) % 4 == 0)
+            cmd->buttons |= BUTTON_ATTACK;
+    }
+
+    cmd->angles[YAW] = c->yaw;
+}
+
+static void LG_SendCmd(lgclient_t *c)
+{
+    unsigned msec, checksumIndex;
+    usercmd_t *cmd;
+
+    if (c->state == LG_CONNECTED) {
+        // only deliver reliable commands while loading
+        if (c->netchan.message.cursize || c->netchan.reliable_length ||
+            lg_time - c->netchan.last_sent >= 1000)
+            LG_Transmit(c, 0, NULL);
+        return;
+    }
+
+    msec = Q_clip(lg_time - c->last_cmd, 1, 250);
+    c->last_cmd = lg_time;
+
+    c->cmds[0] = c->cmds[1];
+    c->cmds[1] = c->cmds[2];
+    cmd = &c->cmds[2];
+    LG_BuildCmd(c, cmd, msec);
+
+    MSG_WriteByte(clc_move);
+
+    // save the position for a checksum byte
+    checksumIndex = msg_write.cursize;
+    SZ_GetSpace(&msg_write, 1);
+
+    // let the server know what the last frame we got was
+    MSG_WriteLong(c->serverframe);
+
+    MSG_WriteDeltaUsercmd(NULL, &c->cmds[0], 0);
+    MSG_WriteByte(0);   // light level
+    MSG_WriteDeltaUsercmd(&c->cmds[0], &c->cmds[1], 0);
+    MSG_WriteByte(0);
+    MSG_WriteDeltaUsercmd(&c->cmds[1], &c->cmds[2], 0);
+    MSG_WriteByte(0);
+
+    msg_write.data[checksumIndex] = COM_BlockSequenceCRCByte(
+        msg_write.data + checksumIndex + 1,
+        msg_write.cursize - checksumIndex - 1,
+        c->netchan.outgoing_sequence);
+
+    LG_Transmit(c, msg_write.cursize, msg_write.data);
+    SZ_Clear(&msg_write);
+}
+
+static void LG_RunHandshake(lgclient_t *c)
+{
+    if (lg_time - c->connect_time > LG_TIMEOUT) {
+        LG_Disconnect(c, "connection timed out");
+        return;
+    }
+
+    if (c->handshake_time && lg_time - c->handshake_time < LG_RESEND_TIME)
+        return;
+
+    c->handshake_time = lg_time;
+    if (c->state == LG_CHALLENGING)
+        OOB_PRINT(c->sock, &c->address, "getchallenge\n");
+    else
+        LG_SendConnect(c);
+}
+
+/*
+==================
+LG_Frame
+
+Runs all simulated clients. Returns number of milliseconds until the
+next command should be sent.
+==================
+*/
+unsigned LG_Frame(void)
+{
+    unsigned interval, wait = SV_FRAMETIME;
+    bool handshaking = false;
+    lgclient_t *c;
+    int i;
+
+    if (!lg_numclients)
+        return wait;
+
+    lg_time = Sys_Milliseconds();
+    interval = LG_Interval();
+
+    for (i = 0, c = lg_clients; i < lg_numclients; i++, c++) {
+        if (c->state == LG_DISCONNECTED)
+            continue;
+
+        lg_current = c;
+        NET_GetPackets(c->sock, LG_PacketEvent);
+
+        if (c->state == LG_CHALLENGING || c->state == LG_CONNECTING) {
+            // start handshake only after the previous client is done
+            if (!handshaking) {
+                if (!c->connect_time)
+                    c->connect_time = lg_time;
+                LG_RunHandshake(c);
+                handshaking = true;
+            }
+            continue;
+        }
+
+        if (c->state < LG_CONNECTED)
+            continue;
+
+        if (lg_time - c->last_received > LG_TIMEOUT) {
+            LG_Disconnect(c, "server connection timed out");
+            continue;
+        }
+
+        if ((int)(c->next_send - lg_time) <= 0) {
+            LG_SendCmd(c);
+            c->next_send += interval;
+            // don't try to catch up if running late
+            if ((int)(c->next_send - lg_time) <= 0)
+                c->next_send = lg_time + interval;
+        }
+
+        wait = min(wait, c->next_send - lg_time);
+    }
+
+    lg_current = NULL;
+
+    return handshaking ? min(wait, 10) : wait;
+}
+
+static void LG_FreeClients(void)
+{
+    lgclient_t *c;
+    int i;
+
+    for (i = 0, c = lg_clients; i < lg_numclients; i++, c++) {
+        LG_Disconnect(c, "stopped");
+        NET_CloseLoadgenSocket(c->sock);
+    }
+
+    Z_Freep(&lg_clients);
+    lg_numclients = 0;
+}
+
+static void LG_Start_f(void)
+{
+    netadr_t adr;
+    lgclient_t *c;
+    int i, count, sock;
+    unsigned qport;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <address[:port]> [count]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (lg_numclients) {
+        Com_Printf("Load generator is already running.\n");
+        return;
+    }
+
+    if (!NET_StringToAdr(Cmd_Argv(1), &adr, PORT_SERVER)) {
+        Com_Printf("Bad server address: %s\n", Cmd_Argv(1));
+        return;
+    }
+
+    count = Cmd_Argc() > 2 ? Q_atoi(Cmd_Argv(2)) : 1;
+    if (count < 1 || count > NS_MAX_LOADGEN) {
+        Com_Printf("Number of clients must be between 1 and %d.\n", NS_MAX_LOADGEN);
+        return;
+    }
+
+    lg_clients = Z_Mallocz(sizeof(lg_clients[0]) * count);
+    lg_time = Sys_Milliseconds();
+
+    // all clients share one IP address, so server tells them apart by
+    // qport only. make sure these are unique.
+    qport = Q_rand();
+
+    for (i = 0; i < count; i++) {
+        sock = NET_OpenLoadgenSocket(adr.type);
+        if (sock == -1)
+            break;
+
+        c = &lg_clients[i];
+        c->number = i;
+        c->state = LG_CHALLENGING;
+        c->sock = sock;
+        c->address = adr;
+        c->qport = (qport + i) % 0xffff + 1;
+        c->seed = 0x9e3779b9 * (i + 1);
+        c->start_time = lg_time;
+    }
+
+    lg_numclients = i;
+    if (!lg_numclients) {
+        Z_Freep(&lg_clients);
+        return;
+    }
+
+    Com_Printf("Connecting %d clients to %s.\n", lg_numclients, NET_AdrToString(&adr));
+}
+
+static void LG_Stop_f(void)
+{
+    if (!lg_numclients) {
+        Com_Printf("Load generator is not running.\n");
+        return;
+    }
+
+    lg_time = Sys_Milliseconds();
+    LG_FreeClients();
+}
+
+static void LG_Status_f(void)
+{
+    uint64_t total_in = 0, total_out = 0;
+    unsigned ping_total = 0, ping_count = 0;
+    unsigned dropped = 0, received = 0;
+    unsigned now = Sys_Milliseconds();
+    lgclient_t *c;
+    int i, active = 0;
+
+    if (!lg_numclients) {
+        Com_Printf("Load generator is not running.\n");
+        return;
+    }
+
+    Com_Printf("num state     ping min  max  loss  in B/s out B/s\n"
+               "--- --------- ---- ---- ---- ----- ------ -------\n");
+
+    for (i = 0, c = lg_clients; i < lg_numclients; i++, c++) {
+        unsigned end = c->state == LG_DISCONNECTED ? c->end_time : now;
+        unsigned secs = max(end - c->start_time, 1000) / 1000;
+        unsigned ping = c->ping_count ? c->ping_total / c->ping_count : 0;
+        unsigned total = c->packets_rcvd + c->packets_dropped;
+        float loss = total ? c->packets_dropped * 100.0f / total : 0;
+
+        Com_Printf("%3d %-9s %4u %4u %4u %5.1f %6"PRIu64" %7"PRIu64"%s%s\n",
+                   c->number, lg_statenames[c->state], ping, c->ping_min, c->ping_max,
+                   loss, c->bytes_rcvd / secs, c->bytes_sent / secs,
+                   c->reason[0] ? " " : "", c->reason);
+
+        if (c->state == LG_SPAWNED) {
+            total_in += c->bytes_rcvd / secs;
+            total_out += c->bytes_sent / secs;
+            active++;
+        }
+        ping_total += c->ping_total;
+        ping_count += c->ping_count;
+        dropped += c->packets_dropped;
+        received += c->packets_rcvd + c->packets_dropped;
+    }
+
+    Com_Printf("%d of %d clients spawned, avg ping %u ms, loss %.1f%%, "
+               "%"PRIu64" B/s in, %"PRIu64" B/s out\n", active, lg_numclients,
+               ping_count ? ping_total / ping_count : 0,
+               received ? dropped * 100.0f / received : 0,
+               total_in, total_out);
+}
+
+static const cmdreg_t c_loadgen[] = {
+    { "loadgen_start", LG_Start_f },
+    { "loadgen_stop", LG_Stop_f },
+    { "loadgen_status", LG_Status_f },
+    { NULL }
+};
+
+void LG_Init(void)
+{
+    loadgen_rate = Cvar_Get("loadgen_rate", "30", 0);
+    loadgen_move = Cvar_Get("loadgen_move", "1", 0);
+
+    Cmd_Register(c_loadgen);
+}
@@ -80,6 +80,8 @@ cvar_t  *sv_max_download_size;
 cvar_t  *sv_max_packet_entities;
 cvar_t  *sv_trunc_packet_entities;
 cvar_t  *sv_prioritize_entities;
+cvar_t  *sv_send_threads;
+cvar_t  *sv_delta_cache;
 
 cvar_t  *sv_strafejump_hack;
 cvar_t  *sv_waterjump_hack;
@@ -218,6 +220,10 @@ void SV_DropClient(client_t *client, const char *reason)
     if (client->state <= cs_zombie)
         return; // called recursively?
 
+#if USE_REPLAY
+    SV_RecordDrop(client);
+#endif
+
     oldstate = client->state;
     client->state = cs_zombie;        // become free in a few seconds
     client->lastmessage = svs.realtime;
@@ -614,21 +620,6 @@ A connection request that did not come from the master
 ==================
 */
 
-typedef struct {
-    int         protocol;   // major version
-    int         version;    // minor version
-    int         qport;
-    int         challenge;
-
-    int         maxlength;
-    int         nctype;
-    bool        has_zlib;
-
-    int         maxclients; // hidden client slots
-    char        reconnect_var[16];
-    char        reconnect_val[16];
-} conn_params_t;
-
 #define reject_printf(...) \
     Netchan_OutOfBand(NS_SERVER, &net_from, "print\n" __VA_ARGS__)
 
@@ -1077,45 +1068,19 @@ static void append_extra_userinfo(conn_params_t *params, char *userinfo)
                params->maxlength, params->qport, params->has_zlib);
 }
 
-static void SVC_DirectConnect(void)
+// this is the only place a client_t is ever initialized. returns false if
+// the game rejected the connection, with the reason left in userinfo.
+static bool init_client(client_t *newcl, const conn_params_t *params, char *userinfo)
 {
-    char            userinfo[MAX_INFO_STRING * 2];
-    conn_params_t   params;
-    client_t        *newcl;
-    int             number;
-    qboolean        allow;
-    char            *reason;
-
-    memset(&params, 0, sizeof(params));
+    int number = newcl - svs.client_pool;
+    qboolean allow;
 
-    // parse and validate parameters
-    if (!parse_basic_params(&params))
-        return;
-    if (!permit_connection(&params))
-        return;
-    if (!parse_packet_length(&params))
-        return;
-    if (!parse_enhanced_params(&params))
-        return;
-    if (!parse_userinfo(&params, userinfo))
-        return;
-
-    // find a free client slot
-    newcl = find_client_slot(&params);
-    if (!newcl)
-        return;
-
-    number = newcl - svs.client_pool;
-
-    // build a new connection
-    // accept the new client
-    // this is the only place a client_t is ever initialized
     memset(newcl, 0, sizeof(*newcl));
     newcl->number = newcl->infonum = number;
-    newcl->challenge = params.challenge; // save challenge for checksumming
-    newcl->protocol = params.protocol;
-    newcl->version = params.version;
-    newcl->has_zlib = params.has_zlib;
+    newcl->challenge = params->challenge; // save challenge for checksumming
+    newcl->protocol = params->protocol;
+    newcl->version = params->version;
+    newcl->has_zlib = params->has_zlib;
     newcl->edict = EDICT_NUM(number + 1);
     newcl->gamedir = fs_game->string;
     newcl->mapname = sv.name;
@@ -1125,8 +1090,8 @@ static void SVC_DirectConnect(void)
     newcl->cm = &sv.cm;
     newcl->spawncount = sv.spawncount;
     newcl->maxclients = svs.maxclients;
-    Q_strlcpy(newcl->reconnect_var, params.reconnect_var, sizeof(newcl->reconnect_var));
-    Q_strlcpy(newcl->reconnect_val, params.reconnect_val, sizeof(newcl->reconnect_val));
+    Q_strlcpy(newcl->reconnect_var, params->reconnect_var, sizeof(newcl->reconnect_var));
+    Q_strlcpy(newcl->reconnect_val, params->reconnect_val, sizeof(newcl->reconnect_val));
 #if USE_FPS
     newcl->framediv = sv.frametime.div;
     newcl->settings[CLS_FPS] = BASE_FRAMERATE;
@@ -1134,7 +1099,9 @@ static void SVC_DirectConnect(void)
 
     init_pmove_and_es_flags(newcl);
 
-    append_extra_userinfo(&params, userinfo);
+#if USE_REPLAY
+    SV_RecordConnect(newcl, params, userinfo);
+#endif
 
     // get the game a chance to reject this connection or modify the userinfo
     sv_client = newcl;
@@ -1142,37 +1109,26 @@ static void SVC_DirectConnect(void)
     allow = ge->ClientConnect(newcl->edict, userinfo);
     sv_client = NULL;
     sv_player = NULL;
-    if (!allow) {
-        reason = Info_ValueForKey(userinfo, "rejmsg");
-        if (*reason) {
-            reject_printf("%s\nConnection refused.\n", reason);
-        } else {
-            reject_printf("Connection refused.\n");
-        }
-        return;
-    }
+    if (!allow)
+        return false;
 
     // setup netchan
-    Netchan_Setup(&newcl->netchan, NS_SERVER, params.nctype, &net_from,
-                  params.qport, params.maxlength, params.protocol);
+    Netchan_Setup(&newcl->netchan, NS_SERVER, params->nctype, &net_from,
+                  params->qport, params->maxlength, params->protocol);
     newcl->numpackets = 1;
 
     // parse some info from the info strings
     Q_strlcpy(newcl->userinfo, userinfo, sizeof(newcl->userinfo));
     SV_UserinfoChanged(newcl);
+    return true;
+}
 
-    // send the connect packet to the client
-    send_connect_packet(newcl, params.nctype);
-
+static void link_client(client_t *newcl)
+{
     SV_RateInit(&newcl->ratelimit_namechange, sv_namechange_limit->string);
 
     SV_InitClientSend(newcl);
 
-    // loopback client doesn't need to reconnect
-    if (NET_IsLocalAddress(&net_from)) {
-        newcl->reconnected = true;
-    }
-
     // add them to the linked list of connected clients
     List_SeqAdd(&sv_clientlist, &newcl->entry);
 
@@ -1185,6 +1141,82 @@ static void SVC_DirectConnect(void)
     newcl->min_ping = 9999;
 }
 
+static void SVC_DirectConnect(void)
+{
+    char            userinfo[MAX_INFO_STRING * 2];
+    conn_params_t   params;
+    client_t        *newcl;
+    char            *reason;
+
+    memset(&params, 0, sizeof(params));
+
+    // parse and validate parameters
+    if (!parse_basic_params(&params))
+        return;
+    if (!permit_connection(&params))
+        return;
+    if (!parse_packet_length(&params))
+        return;
+    if (!parse_enhanced_params(&params))
+        return;
+    if (!parse_userinfo(&params, userinfo))
+        return;
+
+    // find a free client slot
+    newcl = find_client_slot(&params);
+    if (!newcl)
+        return;
+
+    append_extra_userinfo(&params, userinfo);
+
+    // build a new connection
+    // accept the new client
+    if (!init_client(newcl, &params, userinfo)) {
+        reason = Info_ValueForKey(userinfo, "rejmsg");
+        if (*reason) {
+            reject_printf("%s\nConnection refused.\n", reason);
+        } else {
+            reject_printf("Connection refused.\n");
+        }
+        return;
+    }
+
+    // send the connect packet to the client
+    send_connect_packet(newcl, params.nctype);
+
+    // loopback client doesn't need to reconnect
+    if (NET_IsLocalAddress(&net_from)) {
+        newcl->reconnected = true;
+    }
+
+    link_client(newcl);
+}
+
+#if USE_REPLAY
+/*
+==================
+SV_ReplayConnect
+
+Accepts a client recorded by replay code into the given slot. The client
+has no network address, so nothing is ever sent to it.
+==================
+*/
+bool SV_ReplayConnect(client_t *newcl, const conn_params_t *params, char *userinfo)
+{
+    if (newcl->state != cs_free) {
+        SV_DropClient(newcl, NULL);
+        SV_RemoveClient(newcl);
+    }
+
+    memset(&net_from, 0, sizeof(net_from));
+    if (!init_client(newcl, params, userinfo))
+        return false;
+
+    link_client(newcl);
+    return true;
+}
+#endif
+
 typedef enum {
     RCON_BAD,
     RCON_OK,
@@ -1445,6 +1477,9 @@ static void SV_CalcPings(void)
 
         // let the game dll know about the ping
         SV_SetClient_Ping(cl, cl->ping);
+#if USE_REPLAY
+        SV_RecordPing(cl);
+#endif
     }
 }
 
@@ -1794,6 +1829,9 @@ static void SV_RunGameFrame(void)
     // save the entire world state if recording a serverdemo
     SV_MvdBeginFrame();
 
+    // catch up with clients moved since last frame
+    SV_UpdateMulticastClients();
+
 #if USE_CLIENT
     if (host_speeds->integer)
         time_before_game = Sys_Milliseconds();
@@ -1916,6 +1954,8 @@ Returns amount of extra frametime available for sleeping on IO.
 */
 unsigned SV_Frame(unsigned msec)
 {
+    unsigned remaining = SV_FRAMETIME;
+
 #if USE_CLIENT
     time_before_game = time_after_game = 0;
 #endif
@@ -1923,34 +1963,49 @@ unsigned SV_Frame(unsigned msec)
     // advance local server time
     svs.realtime += msec;
 
+    // time spent outside of SV_Frame is not counted
+    SV_ProfileBegin();
+
     if (COM_DEDICATED) {
         // process console commands if not running a client
         Cbuf_Execute(&cmd_buffer);
+        SV_ProfileMark(PROF_COMMANDS);
     }
 
+#if USE_LOADGEN
+    // run simulated clients connected to another server
+    remaining = LG_Frame();
+    SV_ProfileMark(PROF_LOADGEN);
+#endif
+
 #if USE_MVD_CLIENT
     // run connections to MVD/GTV servers
     MVD_Frame();
+    SV_ProfileMark(PROF_MVD_CLIENT);
 #endif
 
     // read packets from UDP clients
     NET_GetPackets(NS_SERVER, SV_PacketEvent);
+    SV_ProfileMark(PROF_PACKETS);
 
     if (svs.initialized) {
         // run connection to the anticheat server
         AC_Run();
+        SV_ProfileMark(PROF_ANTICHEAT);
 
         // run connections from MVD/GTV clients
         SV_MvdRunClients();
+        SV_ProfileMark(PROF_MVD_SERVER);
 
         // deliver fragments and reliable messages for connecting clients
         SV_SendAsyncPackets();
+        SV_ProfileMark(PROF_ASYNC);
     }
 
     // move autonomous things around if enough time has passed
     sv.frameresidual += msec;
     if (sv.frameresidual < SV_FRAMETIME) {
-        return SV_FRAMETIME - sv.frameresidual;
+        return min(SV_FRAMETIME - sv.frameresidual, remaining);
     }
 
     if (svs.initialized && !check_paused()) {
@@ -1962,15 +2017,22 @@ unsigned SV_Frame(unsigned msec)
 
         // give the clients some timeslices
         SV_GiveMsec();
+        SV_ProfileMark(PROF_CHECKS);
 
         // let everything in the world think and move
         SV_RunGameFrame();
+#if USE_REPLAY
+        SV_RecordFrame();
+#endif
+        SV_ProfileMark(PROF_GAME);
 
         // send messages back to the UDP clients
         SV_SendClientMessages();
+        SV_ProfileMark(PROF_SEND);
 
         // send a heartbeat to the master if needed
         SV_MasterHeartbeat();
+        SV_ProfileMark(PROF_HEARTBEAT);
 
         // clear teleport flags, etc for next frame
         SV_PrepWorldFrame();
@@ -1984,10 +2046,15 @@ unsigned SV_Frame(unsigned msec)
         Cbuf_Frame(&cmd_buffer);
     }
 
+    // release temporary memory
+    SV_ResetScratch();
+    SV_ProfileMark(PROF_PREP);
+    SV_ProfileEndFrame();
+
     // decide how long to sleep next frame
     sv.frameresidual -= SV_FRAMETIME;
     if (sv.frameresidual < SV_FRAMETIME) {
-        return SV_FRAMETIME - sv.frameresidual;
+        return min(SV_FRAMETIME - sv.frameresidual, remaining);
     }
 
     // don't accumulate bogus residual
@@ -1999,6 +2066,41 @@ unsigned SV_Frame(unsigned msec)
     return 0;
 }
 
+#if USE_REPLAY
+/*
+==================
+SV_ReplayFrame
+
+Runs a single game frame for replay code, which supplies client input
+directly, without reading packets or sleeping. Of the steps SV_Frame runs
+before the game frame, only SV_GiveMsec is repeated:
+
+- SV_CheckTimeouts is skipped. Clients it dropped were recorded as drop
+  events and are dropped at the same point during replay.
+- SV_CalcPings is skipped. Pings depend on network timing, so the values
+  passed to the game were recorded and are replayed as events instead.
+
+Returns state checksum right after the game frame.
+==================
+*/
+unsigned SV_ReplayFrame(void)
+{
+    unsigned checksum;
+
+    svs.realtime += SV_FRAMETIME;
+
+    SV_GiveMsec();
+    SV_RunGameFrame();
+    checksum = SV_StateChecksum();
+    SV_SendClientMessages();
+    SV_PrepWorldFrame();
+    sv.framenum++;
+
+    SV_ResetScratch();
+    return checksum;
+}
+#endif
+
 //============================================================================
 
 /*
@@ -2174,6 +2276,14 @@ void SV_Init(void)
 
     AC_Register();
 
+#if USE_LOADGEN
+    LG_Init();
+#endif
+
+#if USE_REPLAY
+    SV_RegisterReplay();
+#endif
+
     SV_RegisterSavegames();
 
     Cvar_Get("protocol", STRINGIFY(PROTOCOL_VERSION_DEFAULT), CVAR_SERVERINFO | CVAR_ROM);
@@ -2242,6 +2352,8 @@ void SV_Init(void)
     sv_max_packet_entities = Cvar_Get("sv_max_packet_entities", "0", 0);
     sv_trunc_packet_entities = Cvar_Get("sv_trunc_packet_entities", "1", 0);
     sv_prioritize_entities = Cvar_Get("sv_prioritize_entities", "0", 0);
+    sv_send_threads = Cvar_Get("sv_send_threads", "0", 0);
+    sv_delta_cache = Cvar_Get("sv_delta_cache", "1", 0);
 
     sv_strafejump_hack = Cvar_Get("sv_strafejump_hack", "1", CVAR_LATCH);
     sv_waterjump_hack = Cvar_Get("sv_waterjump_hack", "1", CVAR_LATCH);
@@ -2387,9 +2499,18 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
 
     SV_MvdShutdown(type);
 
+#if USE_REPLAY
+    SV_ReplayShutdown();
+#endif
+
     SV_FinalMessage(finalmsg, type);
     SV_MasterShutdown();
     SV_ShutdownGameProgs();
+    SV_ShutdownSendWorkers();
+    SV_FreeFrameVis();
+    SV_FreeEntityCache();
+    SV_FreeMulticast();
+    SV_FreeScratch();
 
     // free current level
     CM_FreeMap(&sv.cm);
@@ -0,0 +1,247 @@
+/*
+Copyright (C) 2026 Q2PRO contributors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// profile.c -- server frame stage timings
+
+#include "server.h"
+#include "common/tracing.h"
+
+/*
+===============================================================================
+
+SV_Frame calls SV_ProfileMark after each stage, which adds time elapsed since
+the previous mark to that stage, and records trace event if tracing. Stages
+that run more often than game frames (packet processing) accumulate over the
+whole frame interval. When a game frame completes, accumulated times are
+stored into ring buffers holding the last PROF_SAMPLES frames, from which
+percentiles are computed on demand.
+
+===============================================================================
+*/
+
+#define PROF_SAMPLES    1024    // must be power of two
+
+typedef struct {
+    uint32_t    samples[PROF_NUM_STAGES][PROF_SAMPLES];
+    uint32_t    accum[PROF_NUM_STAGES];
+    uint64_t    last;
+    unsigned    head;           // total number of frames recorded
+    unsigned    overbudget;     // in the current window
+    uint32_t    maxever;        // longest frame since reset
+} profile_t;
+
+typedef struct {
+    uint32_t    p50, p99, max, avg;
+} profstats_t;
+
+static profile_t    sv_profile;
+
+static const char *const sv_stagenames[PROF_NUM_STAGES] = {
+    "commands",
+    "loadgen",
+    "mvdclient",
+    "packets",
+    "anticheat",
+    "mvdserver",
+    "async",
+    "checks",
+    "game",
+    "send",
+    "heartbeat",
+    "prep",
+    "frame",
+};
+
+void SV_ProfileBegin(void)
+{
+    sv_profile.last = Sys_Microseconds();
+}
+
+/*
+=============
+SV_ProfileMark
+
+Attributes time elapsed since the last mark to `stage'.
+=============
+*/
+void SV_ProfileMark(profstage_t stage)
+{
+    uint64_t now = Sys_Microseconds();
+
+    sv_profile.accum[stage] += now - sv_profile.last;
+    if (com_tracing)
+        Com_TraceEvent(sv_profile.last, now, sv_stagenames[stage], NULL);
+    sv_profile.last = now;
+}
+
+/*
+=============
+SV_ProfileEndFrame
+
+Records accumulated stage times as a new sample.
+=============
+*/
+void SV_ProfileEndFrame(void)
+{
+    profile_t *p = &sv_profile;
+    unsigned index = p->head & (PROF_SAMPLES - 1);
+    uint32_t total = 0;
+    uint32_t budget = SV_FRAMETIME * 1000;
+    int i;
+
+    // keep over budget counter in sync with the window
+    if (p->head >= PROF_SAMPLES && p->samples[PROF_FRAME][index] > budget)
+        p->overbudget--;
+
+    for (i = 0; i < PROF_FRAME; i++) {
+        p->samples[i][index] = p->accum[i];
+        total += p->accum[i];
+        p->accum[i] = 0;
+    }
+
+    p->samples[PROF_FRAME][index] = total;
+    if (total > budget)
+        p->overbudget++;
+    p->maxever = max(p->maxever, total);
+    p->head++;
+}
+
+static void SV_ResetProfile(void)
+{
+    uint64_t last = sv_profile.last;
+
+    memset(&sv_profile, 0, sizeof(sv_profile));
+    sv_profile.last = last;
+}
+
+static int u32cmp(const void *p1, const void *p2)
+{
+    uint32_t a = *(const uint32_t *)p1;
+    uint32_t b = *(const uint32_t *)p2;
+
+    return a < b ? -1 : a > b;
+}
+
+static unsigned SV_ProfileStats(profstats_t *stats)
+{
+    static uint32_t sorted[PROF_SAMPLES];
+    unsigned count = min(sv_profile.head, PROF_SAMPLES);
+    uint64_t sum;
+    unsigned i, j;
+
+    memset(stats, 0, sizeof(stats[0]) * PROF_NUM_STAGES);
+    if (!count)
+        return 0;
+
+    for (i = 0; i < PROF_NUM_STAGES; i++) {
+        memcpy(sorted, sv_profile.samples[i], count * sizeof(sorted[0]));
+        qsort(sorted, count, sizeof(sorted[0]), u32cmp);
+        for (j = 0, sum = 0; j < count; j++)
+            sum += sorted[j];
+        stats[i].p50 = sorted[count / 2];
+        stats[i].p99 = sorted[count * 99 / 100];
+        stats[i].max = sorted[count - 1];
+        stats[i].avg = sum / count;
+    }
+
+    return count;
+}
+
+static void SV_DumpProfile(const char *path, const profstats_t *stats, unsigned count)
+{
+    char buffer[MAX_OSPATH];
+    qhandle_t f;
+    int i, ret;
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE, "", path, ".json");
+    if (!f)
+        return;
+
+    FS_FPrintf(f, "{\n  \"frames\": %u,\n  \"budget_us\": %u,\n"
+               "  \"over_budget\": %u,\n  \"max_ever_us\": %u,\n  \"stages\": {\n",
+               count, SV_FRAMETIME * 1000, sv_profile.overbudget, sv_profile.maxever);
+    for (i = 0; i < PROF_NUM_STAGES; i++)
+        FS_FPrintf(f, "    \"%s\": { \"p50\": %u, \"p99\": %u, \"max\": %u, \"avg\": %u }%s\n",
+                   sv_stagenames[i], stats[i].p50, stats[i].p99, stats[i].max, stats[i].avg,
+                   i < PROF_NUM_STAGES - 1 ? "," : "");
+    FS_FPrintf(f, "  }\n}\n");
+
+    ret = FS_CloseFile(f);
+    if (ret)
+        Com_EPrintf("Error writing %s: %s\n", buffer, Q_ErrorString(ret));
+    else
+        Com_Printf("Wrote %s.\n", buffer);
+}
+
+static const cmd_option_t o_framestats[] = {
+    { "h", "help", "display this message" },
+    { "o:file", "output", "write statistics in JSON format to <file>" },
+    { "r", "reset", "reset statistics" },
+    { NULL }
+};
+
+/*
+=============
+SV_FrameStats_f
+=============
+*/
+void SV_FrameStats_f(void)
+{
+    profstats_t stats[PROF_NUM_STAGES];
+    char *output = NULL;
+    unsigned count;
+    int c, i;
+
+    while ((c = Cmd_ParseOptions(o_framestats)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_framestats, NULL);
+            Com_Printf("Show server frame stage timings over the last %d frames.\n", PROF_SAMPLES);
+            Cmd_PrintHelp(o_framestats);
+            return;
+        case 'o':
+            output = cmd_optarg;
+            break;
+        case 'r':
+            SV_ResetProfile();
+            Com_Printf("Frame statistics reset.\n");
+            return;
+        default:
+            return;
+        }
+    }
+
+    count = SV_ProfileStats(stats);
+
+    if (output) {
+        SV_DumpProfile(output, stats, count);
+        return;
+    }
+
+    if (!count) {
+        Com_Printf("No frames recorded.\n");
+        return;
+    }
+
+    Com_Printf("stage          p50     p99     max     avg (usec)\n"
+               "---------- ------- ------- ------- -------\n");
+    for (i = 0; i < PROF_NUM_STAGES; i++)
+        Com_Printf("%-10s %7u %7u %7u %7u\n", sv_stagenames[i],
+                   stats[i].p50, stats[i].p99, stats[i].max, stats[i].avg);
+    Com_Printf("%u frames, %u over %u ms budget, longest ever %u usec\n",
+               count, sv_profile.overbudget, SV_FRAMETIME, sv_profile.maxever);
+}
@@ -0,0 +1,794 @@
+/*
+Copyright (C) 2026 Q2PRO contributors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// replay.c -- deterministic server replay for benchmarking
+
+#include "server.h"
+#include "common/mdfour.h"
+
+/*
+===============================================================================
+
+Recording starts when the next level is spawned and captures everything the
+game module gets from clients: connects, userinfo updates, string commands,
+movement commands and pings, plus a state checksum after each game frame. Random
+seed is chosen and saved at the same time, and passed to the game module in
+`g_seed' cvar, which it uses to reseed its PRNG when spawning the level.
+
+Replay spawns the recorded level with the recorded serverinfo and seed, then
+feeds events back through the same functions that processed them, running
+game frames back to back. Replayed clients have no network address, so
+messages are built for them but never sent. Comparing checksums with the
+recorded ones catches nondeterminism in the game or server code.
+
+===============================================================================
+*/
+
+#define REPLAY_MAGIC    MakeLittleLong('Q','2','R','P')
+#define REPLAY_VERSION  2
+
+typedef enum {
+    RE_END,
+    RE_CONNECT,
+    RE_USERINFO,
+    RE_STRINGCMD,
+    RE_MOVE,
+    RE_DROP,
+    RE_FRAME,
+    RE_PING
+} replayevent_t;
+
+static struct {
+    char        pending[MAX_OSPATH];    // start recording on next spawn
+    char        name[MAX_OSPATH];
+    qhandle_t   file;
+    unsigned    frames;
+    int         pings[MAX_CLIENTS];     // last recorded, -1 if none
+} rec;
+
+static struct {
+    bool        playing;
+    uint32_t    seed;
+} rp;
+
+static bool     seed_set;
+
+static void set_seed(uint32_t seed)
+{
+    Cvar_Set("g_seed", va("%u", seed));
+    seed_set = seed != 0;
+}
+
+/*
+==================
+SV_StateChecksum
+
+Checksums packed states of all entities in use and all player states.
+==================
+*/
+unsigned SV_StateChecksum(void)
+{
+    entity_packed_t es;
+    player_packed_t ps;
+    mdfour_t md;
+    edict_t *ent;
+    uint32_t digest[4];
+    int i;
+
+    mdfour_begin(&md);
+
+    for (i = 1; i < ge->num_edicts; i++) {
+        ent = EDICT_NUM(i);
+        if (!ent->inuse)
+            continue;
+
+        memset(&es, 0, sizeof(es));
+        MSG_PackEntity(&es, &ent->s, NULL);
+        mdfour_update(&md, (uint8_t *)&es, sizeof(es));
+
+        if (i > svs.maxclients || !ent->client)
+            continue;
+
+        memset(&ps, 0, sizeof(ps));
+        if (IS_NEW_GAME_API)
+            MSG_PackPlayerNew(&ps, ent->client);
+        else
+            MSG_PackPlayerOld(&ps, ent->client);
+        mdfour_update(&md, (uint8_t *)&ps, sizeof(ps));
+    }
+
+    mdfour_result(&md, (uint8_t *)digest);
+    return LittleLong(digest[0] ^ digest[1] ^ digest[2] ^ digest[3]);
+}
+
+/*
+===============================================================================
+
+RECORDING
+
+===============================================================================
+*/
+
+static void rec_stop(const char *reason)
+{
+    byte buffer[1];
+    int ret;
+
+    if (!rec.file)
+        return;
+
+    buffer[0] = RE_END;
+    FS_Write(buffer, 1, rec.file);
+
+    ret = FS_CloseFile(rec.file);
+    rec.file = 0;
+
+    if (ret)
+        Com_EPrintf("Error writing %s: %s\n", rec.name, Q_ErrorString(ret));
+    else
+        Com_Printf("Stopped replay recording %s (%s), %u frames.\n",
+                   rec.name, reason, rec.frames);
+}
+
+static void rec_write(sizebuf_t *buf)
+{
+    int ret;
+
+    if (buf->overflowed) {
+        Com_EPrintf("Replay event overflowed.\n");
+        return;
+    }
+
+    ret = FS_Write(buf->data, buf->cursize, rec.file);
+    if (ret != buf->cursize) {
+        Com_EPrintf("Error writing %s: %s\n", rec.name, Q_ErrorString(ret));
+        FS_CloseFile(rec.file);
+        rec.file = 0;
+    }
+}
+
+static void rec_connect(const client_t *cl, const conn_params_t *params, const char *userinfo)
+{
+    byte buffer[MAX_INFO_STRING * 2 + 32];
+    sizebuf_t buf;
+
+    SZ_InitWrite(&buf, buffer, sizeof(buffer));
+    SZ_WriteByte(&buf, RE_CONNECT);
+    SZ_WriteByte(&buf, cl->number);
+    SZ_WriteShort(&buf, params->protocol);
+    SZ_WriteShort(&buf, params->version);
+    SZ_WriteShort(&buf, params->qport);
+    SZ_WriteLong(&buf, params->challenge);
+    SZ_WriteShort(&buf, params->maxlength);
+    SZ_WriteByte(&buf, params->nctype);
+    SZ_WriteByte(&buf, params->has_zlib);
+    SZ_WriteString(&buf, userinfo);
+    SZ_WriteString(&buf, userinfo + strlen(userinfo) + 1);
+    rec_write(&buf);
+
+    // new client in this slot starts with unknown ping
+    rec.pings[cl->number] = -1;
+}
+
+static void rec_string(replayevent_t event, const client_t *cl, const char *s)
+{
+    byte buffer[MAX_NET_STRING + 2];
+    sizebuf_t buf;
+
+    if (!rec.file)
+        return;
+
+    SZ_InitWrite(&buf, buffer, sizeof(buffer));
+    SZ_WriteByte(&buf, event);
+    SZ_WriteByte(&buf, cl->number);
+    SZ_WriteString(&buf, s);
+    rec_write(&buf);
+}
+
+static void rec_start(void)
+{
+    char info[MAX_INFO_STRING * 2];
+    byte buffer[MAX_QPATH * 2 + MAX_INFO_STRING + 32];
+    sizebuf_t buf;
+    conn_params_t params;
+    client_t *cl;
+    uint32_t seed;
+
+    rec.file = FS_EasyOpenFile(rec.name, sizeof(rec.name), FS_MODE_WRITE,
+                               "replays/", rec.pending, ".rpl");
+    rec.pending[0] = 0;
+    if (!rec.file)
+        return;
+
+    // zero seed means no reseeding
+    do {
+        seed = Q_rand();
+    } while (!seed);
+    set_seed(seed);
+
+    Cvar_BitInfo(info, CVAR_SERVERINFO);
+
+    SZ_InitWrite(&buf, buffer, sizeof(buffer));
+    SZ_WriteLong(&buf, REPLAY_MAGIC);
+    SZ_WriteLong(&buf, REPLAY_VERSION);
+    SZ_WriteLong(&buf, seed);
+    SZ_WriteString(&buf, sv.mapcmd);
+    SZ_WriteString(&buf, fs_game->string);
+    SZ_WriteString(&buf, info);
+    rec_write(&buf);
+
+    // clients carried over from the previous level connect first
+    FOR_EACH_CLIENT(cl) {
+        if (cl->state <= cs_zombie || !rec.file)
+            continue;
+
+        memset(&params, 0, sizeof(params));
+        params.protocol = cl->protocol;
+        params.version = cl->version;
+        params.qport = cl->netchan.qport;
+        params.challenge = cl->challenge;
+        params.maxlength = cl->netchan.maxpacketlen;
+        params.nctype = cl->netchan.type;
+        params.has_zlib = cl->has_zlib;
+
+        // no extra userinfo
+        memset(info, 0, sizeof(info));
+        Q_strlcpy(info, cl->userinfo, MAX_INFO_STRING);
+        rec_connect(cl, &params, info);
+
+        // version probe is not repeated on level change
+        if (cl->version_string)
+            rec_string(RE_STRINGCMD, cl, va("\177c version %s", cl->version_string));
+    }
+
+    rec.frames = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++)
+        rec.pings[i] = -1;
+    Com_Printf("Recording replay to %s.\n", rec.name);
+}
+
+void SV_RecordConnect(const client_t *cl, const conn_params_t *params, const char *userinfo)
+{
+    if (rec.file)
+        rec_connect(cl, params, userinfo);
+}
+
+void SV_RecordUserinfo(const client_t *cl)
+{
+    rec_string(RE_USERINFO, cl, cl->userinfo);
+}
+
+void SV_RecordStringCmd(const client_t *cl, const char *s)
+{
+    rec_string(RE_STRINGCMD, cl, s);
+}
+
+void SV_RecordMove(const client_t *cl, const usercmd_t *cmd)
+{
+    byte buffer[20];
+    sizebuf_t buf;
+
+    if (!rec.file)
+        return;
+
+    SZ_InitWrite(&buf, buffer, sizeof(buffer));
+    SZ_WriteByte(&buf, RE_MOVE);
+    SZ_WriteByte(&buf, cl->number);
+    SZ_WriteByte(&buf, cmd->msec);
+    SZ_WriteByte(&buf, cmd->buttons);
+    SZ_WriteShort(&buf, cmd->angles[0]);
+    SZ_WriteShort(&buf, cmd->angles[1]);
+    SZ_WriteShort(&buf, cmd->angles[2]);
+    SZ_WriteShort(&buf, cmd->forwardmove);
+    SZ_WriteShort(&buf, cmd->sidemove);
+    SZ_WriteShort(&buf, cmd->upmove);
+    SZ_WriteByte(&buf, cmd->impulse);
+    SZ_WriteByte(&buf, cmd->lightlevel);
+    rec_write(&buf);
+}
+
+void SV_RecordDrop(const client_t *cl)
+{
+    byte buffer[2];
+    sizebuf_t buf;
+
+    if (!rec.file)
+        return;
+
+    SZ_InitWrite(&buf, buffer, sizeof(buffer));
+    SZ_WriteByte(&buf, RE_DROP);
+    SZ_WriteByte(&buf, cl->number);
+    rec_write(&buf);
+}
+
+// pings depend on network timing, so values passed to the game are recorded
+void SV_RecordPing(const client_t *cl)
+{
+    byte buffer[4];
+    sizebuf_t buf;
+
+    if (!rec.file || rec.pings[cl->number] == cl->ping)
+        return;
+
+    SZ_InitWrite(&buf, buffer, sizeof(buffer));
+    SZ_WriteByte(&buf, RE_PING);
+    SZ_WriteByte(&buf, cl->number);
+    SZ_WriteShort(&buf, cl->ping);
+    rec_write(&buf);
+    rec.pings[cl->number] = cl->ping;
+}
+
+void SV_RecordFrame(void)
+{
+    byte buffer[5];
+    sizebuf_t buf;
+
+    if (!rec.file)
+        return;
+
+    SZ_InitWrite(&buf, buffer, sizeof(buffer));
+    SZ_WriteByte(&buf, RE_FRAME);
+    SZ_WriteLong(&buf, SV_StateChecksum());
+    rec_write(&buf);
+    rec.frames++;
+}
+
+/*
+==================
+SV_ReplaySpawn
+
+Called right before spawning level entities.
+==================
+*/
+void SV_ReplaySpawn(void)
+{
+    if (rp.playing) {
+        set_seed(rp.seed);
+        return;
+    }
+
+    rec_stop("level changed");
+
+    if (seed_set)
+        set_seed(0);
+
+    if (rec.pending[0])
+        rec_start();
+}
+
+void SV_ReplayShutdown(void)
+{
+    rec_stop("server shut down");
+}
+
+static void SV_ReplayRecord_f(void)
+{
+    if (Cmd_Argc() != 2) {
+        Com_Printf("Usage: %s <name>\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (rec.file) {
+        Com_Printf("Already recording replay to %s.\n", rec.name);
+        return;
+    }
+
+    Cmd_ArgvBuffer(1, rec.pending, sizeof(rec.pending));
+    Com_Printf("Replay recording will start on the next level spawn.\n");
+}
+
+static void SV_ReplayStop_f(void)
+{
+    if (rec.pending[0]) {
+        rec.pending[0] = 0;
+        Com_Printf("Pending replay recording cancelled.\n");
+        return;
+    }
+
+    if (!rec.file) {
+        Com_Printf("Not recording a replay.\n");
+        return;
+    }
+
+    rec_stop("stopped by user");
+}
+
+/*
+===============================================================================
+
+REPLAY
+
+===============================================================================
+*/
+
+static void *rp_buffer;
+
+static void abort_func(void *arg)
+{
+    if (arg)
+        CM_FreeMap(arg);
+    FS_FreeFile(rp_buffer);
+    rp_buffer = NULL;
+    rp.playing = false;
+    set_seed(0);
+}
+
+static const char *read_string(sizebuf_t *buf)
+{
+    const char *s;
+    size_t len;
+
+    if (buf->readcount >= buf->cursize)
+        return NULL;
+
+    s = (const char *)buf->data + buf->readcount;
+    len = Q_strnlen(s, buf->cursize - buf->readcount);
+    if (len == buf->cursize - buf->readcount)
+        return NULL;
+
+    buf->readcount += len + 1;
+    return s;
+}
+
+// applies recorded serverinfo cvars to be picked up by SV_InitGame
+static void set_serverinfo(const char *info)
+{
+    char key[MAX_INFO_STRING];
+    char value[MAX_INFO_STRING];
+    cvar_t *var;
+
+    while (1) {
+        Info_NextPair(&info, key, value);
+        if (!info)
+            break;
+
+        var = Cvar_FindVar(key);
+        if (!var || var == fs_game || (var->flags & (CVAR_ROM | CVAR_NOSET)))
+            continue;
+
+        Cvar_SetByVar(var, value, FROM_CODE);
+    }
+}
+
+static client_t *read_client(sizebuf_t *buf)
+{
+    int number = SZ_ReadByte(buf);
+
+    if (number < 0 || number >= svs.maxclients)
+        return NULL;
+
+    return &svs.client_pool[number];
+}
+
+static bool read_connect(sizebuf_t *buf)
+{
+    char userinfo[MAX_INFO_STRING * 2];
+    conn_params_t params;
+    const char *info, *extra;
+    client_t *cl;
+
+    memset(&params, 0, sizeof(params));
+    cl = read_client(buf);
+    params.protocol = SZ_ReadShort(buf);
+    params.version = SZ_ReadShort(buf);
+    params.qport = SZ_ReadShort(buf);
+    params.challenge = SZ_ReadLong(buf);
+    params.maxlength = SZ_ReadShort(buf);
+    params.nctype = SZ_ReadByte(buf);
+    params.has_zlib = SZ_ReadByte(buf);
+    info = read_string(buf);
+    extra = read_string(buf);
+    if (!cl || !extra || strlen(info) >= MAX_INFO_STRING || strlen(extra) >= MAX_INFO_STRING)
+        return false;
+
+    strcpy(userinfo, info);
+    strcpy(userinfo + strlen(info) + 1, extra);
+
+    SV_ReplayConnect(cl, &params, userinfo);
+    return true;
+}
+
+static bool read_usercmd(sizebuf_t *buf, usercmd_t *cmd)
+{
+    cmd->msec = SZ_ReadByte(buf);
+    cmd->buttons = SZ_ReadByte(buf);
+    cmd->angles[0] = SZ_ReadShort(buf);
+    cmd->angles[1] = SZ_ReadShort(buf);
+    cmd->angles[2] = SZ_ReadShort(buf);
+    cmd->forwardmove = SZ_ReadShort(buf);
+    cmd->sidemove = SZ_ReadShort(buf);
+    cmd->upmove = SZ_ReadShort(buf);
+    cmd->impulse = SZ_ReadByte(buf);
+    cmd->lightlevel = SZ_ReadByte(buf);
+    return buf->readcount <= buf->cursize;
+}
+
+// returns false if replay file is malformed
+static bool read_event(sizebuf_t *buf, int event)
+{
+    const char *s;
+    client_t *cl;
+    usercmd_t cmd;
+
+    if (event == RE_CONNECT)
+        return read_connect(buf);
+
+    cl = read_client(buf);
+    if (!cl)
+        return false;
+
+    switch (event) {
+    case RE_USERINFO:
+    case RE_STRINGCMD:
+        s = read_string(buf);
+        if (!s || strlen(s) >= MAX_STRING_CHARS)
+            return false;
+        if (cl->state <= cs_zombie)
+            break;
+        sv_client = cl;
+        sv_player = cl->edict;
+        if (event == RE_USERINFO) {
+            Q_strlcpy(cl->userinfo, s, sizeof(cl->userinfo));
+            SV_UpdateUserinfo();
+        } else {
+            SV_ExecuteUserCommand(s);
+        }
+        break;
+
+    case RE_MOVE:
+        if (!read_usercmd(buf, &cmd))
+            return false;
+        if (cl->state != cs_spawned)
+            break;
+        sv_client = cl;
+        sv_player = cl->edict;
+        SV_ClientThink(&cmd);
+        cl->lastcmd = cmd;
+        break;
+
+    case RE_DROP:
+        SV_DropClient(cl, NULL);
+        break;
+
+    case RE_PING:
+        cl->ping = SZ_ReadShort(buf);
+        if (buf->readcount > buf->cursize)
+            return false;
+        if (cl->state > cs_zombie)
+            SV_SetClient_Ping(cl, cl->ping);
+        break;
+
+    default:
+        return false;
+    }
+
+    sv_client = NULL;
+    sv_player = NULL;
+    return true;
+}
+
+static const cmd_option_t o_replay[] = {
+    { "h", "help", "display this message" },
+    { "v", "verbose", "print state checksum of every frame" },
+    { NULL }
+};
+
+/*
+==================
+SV_Replay_f
+
+Replays recorded match as fast as possible and reports timing and any
+checksum mismatches. Server is shut down afterwards.
+==================
+*/
+static void SV_Replay_f(void)
+{
+    char buffer[MAX_OSPATH];
+    mapcmd_t cmd;
+    sizebuf_t buf;
+    const char *mapcmd, *game, *info;
+    unsigned frames, mismatches, first, checksum, recorded;
+    uint64_t start, usec;
+    bool verbose = false, ok = true;
+    int c, ret, event;
+
+    while ((c = Cmd_ParseOptions(o_replay)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_replay, "<name>");
+            Com_Printf("Replay recorded match as fast as possible.\n");
+            Cmd_PrintHelp(o_replay);
+            return;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (!cmd_optarg[0]) {
+        Com_Printf("Missing replay name.\n");
+        Cmd_PrintHint();
+        return;
+    }
+
+    if (rec.file || rec.pending[0]) {
+        Com_Printf("Can't replay while recording.\n");
+        return;
+    }
+
+    if (Q_concat(buffer, sizeof(buffer), "replays/", cmd_optarg, ".rpl") >= sizeof(buffer)) {
+        Com_Printf("Oversize replay name.\n");
+        return;
+    }
+
+    ret = FS_LoadFile(buffer, &rp_buffer);
+    if (!rp_buffer) {
+        Com_Printf("Couldn't load %s: %s\n", buffer, Q_ErrorString(ret));
+        return;
+    }
+
+    SZ_InitRead(&buf, rp_buffer, ret);
+    if (SZ_ReadLong(&buf) != REPLAY_MAGIC || SZ_ReadLong(&buf) != REPLAY_VERSION) {
+        Com_Printf("%s is not a replay file.\n", buffer);
+        goto fail;
+    }
+
+    rp.seed = SZ_ReadLong(&buf);
+    mapcmd = read_string(&buf);
+    game = read_string(&buf);
+    info = read_string(&buf);
+    if (!info) {
+        Com_Printf("%s has malformed header.\n", buffer);
+        goto fail;
+    }
+
+    if (strcmp(game, fs_game->string)) {
+        Com_Printf("%s was recorded with game \"%s\".\n", buffer, game);
+        goto fail;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    if (Q_strlcpy(cmd.buffer, mapcmd, sizeof(cmd.buffer)) >= sizeof(cmd.buffer)) {
+        Com_Printf("%s has oversize level string.\n", buffer);
+        goto fail;
+    }
+
+    if (!SV_ParseMapCmd(&cmd) || cmd.state != ss_game) {
+        CM_FreeMap(&cmd.cm);
+        goto fail;
+    }
+
+    // any error will drop from this point
+    Com_AbortFunc(abort_func, &cmd.cm);
+
+    set_serverinfo(info);
+    rp.playing = true;
+
+    SV_InitGame(MVD_SPAWN_DISABLED);
+
+    Com_AbortFunc(abort_func, NULL);
+
+    SV_SpawnServer(&cmd);
+
+    frames = mismatches = first = 0;
+    start = Sys_Microseconds();
+
+    while (1) {
+        event = SZ_ReadByte(&buf);
+        if (event == RE_END)
+            break;
+
+        if (event == RE_FRAME) {
+            recorded = SZ_ReadLong(&buf);
+            checksum = SV_ReplayFrame();
+            if (checksum != recorded && !mismatches++)
+                first = frames;
+            if (verbose)
+                Com_Printf("%u: %08x%s\n", frames, checksum,
+                           checksum != recorded ? va(" (recorded %08x)", recorded) : "");
+            frames++;
+            continue;
+        }
+
+        if (event == -1 || !read_event(&buf, event)) {
+            Com_EPrintf("%s: malformed event at offset %u\n", buffer, buf.readcount);
+            ok = false;
+            break;
+        }
+    }
+
+    usec = Sys_Microseconds() - start;
+
+    Com_AbortFunc(NULL, NULL);
+    abort_func(NULL);
+
+    Com_Printf("%u frames in %.3f sec, %.1f fps\n", frames,
+               usec * 1e-6, usec ? frames * 1e6 / usec : 0.0);
+    if (mismatches)
+        Com_Printf("%u checksum mismatches, first at frame %u\n", mismatches, first);
+    else if (ok)
+        Com_Printf("All checksums match.\n");
+
+    SV_Shutdown("Server was killed.\n", ERR_DISCONNECT);
+    return;
+
+fail:
+    FS_FreeFile(rp_buffer);
+    rp_buffer = NULL;
+}
+
+#if USE_TESTS && USE_LOADGEN
+/*
+==================
+SV_ReplayTest_f
+
+Scripted check of replay determinism. Records a match played on the given
+level by simulated clients connected to this server, then replays it.
+Replay must report that all checksums match.
+==================
+*/
+static void SV_ReplayTest_f(void)
+{
+    char map[MAX_QPATH];
+    int clients, frames;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <map> [clients] [frames]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (rec.file || rec.pending[0]) {
+        Com_Printf("Already recording replay to %s.\n",
+                   rec.file ? rec.name : rec.pending);
+        return;
+    }
+
+    Cmd_ArgvBuffer(1, map, sizeof(map));
+    clients = Cmd_Argc() > 2 ? Q_atoi(Cmd_Argv(2)) : 3;
+    frames = Cmd_Argc() > 3 ? Q_atoi(Cmd_Argv(3)) : 300;
+
+    // each wait is one server frame, see Cbuf_Frame() call in SV_Frame()
+    Cbuf_AddText(&cmd_buffer, va(
+                 "replayrecord replaytest\n"
+                 "map \"%s\"\n"
+                 "loadgen_start 127.0.0.1:%d %d\n"
+                 "wait %d\n"
+                 "loadgen_stop\n"
+                 "replaystop\n"
+                 "replay replaytest\n",
+                 map, net_port->integer, Q_clip(clients, 1, MAX_CLIENTS),
+                 Q_clip(frames, 1, 1000)));
+}
+#endif
+
+static const cmdreg_t c_replay[] = {
+    { "replayrecord", SV_ReplayRecord_f },
+    { "replaystop", SV_ReplayStop_f },
+    { "replay", SV_Replay_f },
+#if USE_TESTS && USE_LOADGEN
+    { "replaytest", SV_ReplayTest_f },
+#endif
+
+    { NULL }
+};
+
+void SV_RegisterReplay(void)
+{
+    Cmd_Register(c_replay);
+}
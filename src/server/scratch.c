@@ -0,0 +1,200 @@
+/*
+Copyright (C) 2026 Q2PRO contributors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+// scratch.c -- per-frame scratch memory
+
+#include "server.h"
+
+/*
+===============================================================================
+
+Scratch memory is a bump allocator for temporary arrays used by server hot
+paths, instead of large stack arrays. Each thread (main thread and send
+workers) has its own arena. Functions take a mark on entry and release it on
+exit. Everything is reset at the end of each server frame, which also covers
+memory left allocated by errors.
+
+When the arena is exhausted, blocks are allocated from zone instead, and the
+arena is enlarged to the high water mark at the end of the frame.
+
+===============================================================================
+*/
+
+#define SCRATCH_ALIGN   16
+#define SCRATCH_MIN     0x10000
+
+typedef struct scratchblock_s {
+    struct scratchblock_s   *next;
+    size_t      mark;       // offset this block was allocated at
+} scratchblock_t;
+
+typedef struct {
+    byte            *base;
+    size_t          size;
+    size_t          cursize;
+    size_t          peak;       // in the current frame
+    size_t          lastpeak;   // in the last frame
+    size_t          maxpeak;
+    unsigned        overflows;
+    scratchblock_t  *blocks;    // allocated from zone on overflow
+} scratch_t;
+
+static scratch_t    sv_scratch[MAX_SEND_WORKERS + 1];
+
+/*
+=============
+SV_ScratchAlloc
+
+Returns uninitialized memory that stays valid until released.
+=============
+*/
+void *SV_ScratchAlloc(size_t size)
+{
+    scratch_t *s = &sv_scratch[sv_worker_index];
+    scratchblock_t *block;
+    byte *ptr;
+
+    Q_assert(size <= INT_MAX);
+    size = Q_ALIGN(size, SCRATCH_ALIGN);
+
+    if (!s->base) {
+        s->size = SCRATCH_MIN;
+        s->base = SV_Malloc(s->size);
+    }
+
+    if (s->cursize <= s->size && size <= s->size - s->cursize) {
+        ptr = s->base + s->cursize;
+    } else {
+        block = SV_Malloc(Q_ALIGN(sizeof(*block), SCRATCH_ALIGN) + size);
+        block->next = s->blocks;
+        block->mark = s->cursize;
+        s->blocks = block;
+        s->overflows++;
+        ptr = (byte *)block + Q_ALIGN(sizeof(*block), SCRATCH_ALIGN);
+    }
+
+    s->cursize += size;
+    s->peak = max(s->peak, s->cursize);
+    return ptr;
+}
+
+/*
+=============
+SV_ScratchMark
+=============
+*/
+size_t SV_ScratchMark(void)
+{
+    return sv_scratch[sv_worker_index].cursize;
+}
+
+static void release(scratch_t *s, size_t mark)
+{
+    scratchblock_t *block;
+
+    Q_assert(mark <= s->cursize);
+
+    while (s->blocks && s->blocks->mark >= mark) {
+        block = s->blocks;
+        s->blocks = block->next;
+        Z_Free(block);
+    }
+
+    s->cursize = mark;
+}
+
+/*
+=============
+SV_ScratchRelease
+
+Frees everything allocated since the mark was taken.
+=============
+*/
+void SV_ScratchRelease(size_t mark)
+{
+    release(&sv_scratch[sv_worker_index], mark);
+}
+
+/*
+=============
+SV_ResetScratch
+
+Called at the end of server frame, when send workers are idle.
+=============
+*/
+void SV_ResetScratch(void)
+{
+    scratch_t *s;
+    int i;
+
+    for (i = 0, s = sv_scratch; i < q_countof(sv_scratch); i++, s++) {
+        if (!s->base)
+            continue;
+
+        release(s, 0);
+
+        // grow to fit high water mark without overflowing
+        if (s->peak > s->size) {
+            s->size = Q_ALIGN(s->peak + s->peak / 4, SCRATCH_MIN);
+            Z_Free(s->base);
+            s->base = SV_Malloc(s->size);
+        }
+
+        s->lastpeak = s->peak;
+        s->maxpeak = max(s->maxpeak, s->peak);
+        s->peak = 0;
+    }
+}
+
+/*
+=============
+SV_FreeScratch
+=============
+*/
+void SV_FreeScratch(void)
+{
+    scratch_t *s;
+    int i;
+
+    for (i = 0, s = sv_scratch; i < q_countof(sv_scratch); i++, s++) {
+        release(s, 0);
+        Z_Free(s->base);
+    }
+
+    memset(sv_scratch, 0, sizeof(sv_scratch));
+}
+
+/*
+=============
+SV_ScratchStats_f
+=============
+*/
+void SV_ScratchStats_f(void)
+{
+    const scratch_t *s;
+    int i;
+
+    Com_Printf("thread     size last peak  max peak overflows\n"
+               "------ -------- --------- --------- ---------\n");
+
+    for (i = 0, s = sv_scratch; i < q_countof(sv_scratch); i++, s++) {
+        if (!s->base)
+            continue;
+        Com_Printf("%6d %8zu %9zu %9zu %9u\n", i, s->size,
+                   s->lastpeak, max(s->maxpeak, s->peak), s->overflows);
+    }
+}
@@ -18,6 +18,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // sv_send.c
 
 #include "server.h"
+#include "common/tracing.h"
+#include "system/pthread.h"
 
 /*
 =============================================================================
@@ -239,6 +241,181 @@ void SV_BroadcastCommand(const char *fmt, ...)
 }
 
 
+/*
+===============================================================================
+
+MULTICAST CLIENT BUCKETS
+
+Leaf of each client is cached and updated when client entity is linked.
+Clients are grouped into per-cluster buckets, so that PVS/PHS multicasts
+only visit clients in clusters that are set in the visibility row.
+
+===============================================================================
+*/
+
+typedef struct {
+    const mleaf_t   *leaf;
+    vec3_t          origin;
+    int             bucket;     // cluster this client is linked into, -1 if none
+    int             next;       // next client in the same cluster, -1 if last
+} mcast_client_t;
+
+static struct {
+    mcast_client_t  *clients;
+    int             *heads;     // first client in each cluster, -1 if empty
+    int             numclusters;
+    bool            dirty;
+    visrow_t        occupied;   // clusters with non-empty buckets
+} sv_mcast;
+
+/*
+=================
+SV_InitMulticast
+
+Called after new map is loaded.
+=================
+*/
+void SV_InitMulticast(void)
+{
+    int i;
+
+    SV_FreeMulticast();
+
+    if (!sv.cm.cache || !sv.cm.cache->vis)
+        return;
+
+    sv_mcast.numclusters = sv.cm.cache->vis->numclusters;
+    sv_mcast.heads = SV_Malloc(sizeof(sv_mcast.heads[0]) * sv_mcast.numclusters);
+    for (i = 0; i < sv_mcast.numclusters; i++)
+        sv_mcast.heads[i] = -1;
+
+    sv_mcast.clients = SV_Mallocz(sizeof(sv_mcast.clients[0]) * svs.maxclients);
+    for (i = 0; i < svs.maxclients; i++)
+        sv_mcast.clients[i].bucket = sv_mcast.clients[i].next = -1;
+
+    memset(&sv_mcast.occupied, 0, sizeof(sv_mcast.occupied));
+    sv_mcast.dirty = false;
+}
+
+void SV_FreeMulticast(void)
+{
+    Z_Free(sv_mcast.heads);
+    Z_Free(sv_mcast.clients);
+    memset(&sv_mcast, 0, sizeof(sv_mcast));
+}
+
+/*
+=================
+SV_UpdateMulticastClient
+
+Called when client entity is linked or may have moved.
+=================
+*/
+void SV_UpdateMulticastClient(int clientnum, const vec3_t origin)
+{
+    mcast_client_t *mc;
+    const mleaf_t *leaf;
+
+    if (!sv_mcast.clients)
+        return;
+
+    mc = &sv_mcast.clients[clientnum];
+    if (mc->leaf && VectorCompare(mc->origin, origin))
+        return;
+
+    leaf = CM_PointLeaf(&sv.cm, origin);
+    if (!mc->leaf || mc->leaf->cluster != leaf->cluster)
+        sv_mcast.dirty = true;
+
+    mc->leaf = leaf;
+    VectorCopy(origin, mc->origin);
+}
+
+/*
+=================
+SV_UpdateMulticastClients
+
+Catches clients moved by game without relinking. Called once per frame.
+=================
+*/
+void SV_UpdateMulticastClients(void)
+{
+    client_t *client;
+
+    if (!sv_mcast.clients)
+        return;
+
+    FOR_EACH_CLIENT(client)
+        SV_UpdateMulticastClient(client->number, client->edict->s.origin);
+}
+
+static void rebuild_buckets(void)
+{
+    mcast_client_t *mc;
+    int i, cluster;
+
+    for (i = 0; i < svs.maxclients; i++) {
+        mc = &sv_mcast.clients[i];
+        if (mc->bucket != -1) {
+            Q_ClearBit(sv_mcast.occupied.b, mc->bucket);
+            sv_mcast.heads[mc->bucket] = -1;
+        }
+    }
+
+    // insert in reverse order so that buckets are sorted by client number
+    for (i = svs.maxclients - 1; i >= 0; i--) {
+        mc = &sv_mcast.clients[i];
+        mc->bucket = mc->next = -1;
+        if (!mc->leaf)
+            continue;
+        cluster = mc->leaf->cluster;
+        if (cluster == -1)
+            continue;
+        mc->bucket = cluster;
+        mc->next = sv_mcast.heads[cluster];
+        sv_mcast.heads[cluster] = i;
+        Q_SetBit(sv_mcast.occupied.b, cluster);
+    }
+
+    sv_mcast.dirty = false;
+}
+
+static void multicast_bucket(int cluster, const mleaf_t *leaf1, int flags)
+{
+    client_t *client;
+    int i;
+
+    for (i = sv_mcast.heads[cluster]; i != -1; i = sv_mcast.clients[i].next) {
+        client = &svs.client_pool[i];
+        if (client->state < cs_primed)
+            continue;
+        // do not send unreliables to connecting clients
+        if (!(flags & MSG_RELIABLE) && !CLIENT_ACTIVE(client))
+            continue;
+        if (!CM_AreasConnected(&sv.cm, leaf1->area, sv_mcast.clients[i].leaf->area))
+            continue;
+        SV_ClientAddMessage(client, flags);
+    }
+}
+
+// sends the data to clients in clusters set in `mask'
+static void multicast_clusters(const visrow_t *mask, const mleaf_t *leaf1, int flags)
+{
+    int i, j, numlongs;
+    size_t bits;
+
+    if (sv_mcast.dirty)
+        rebuild_buckets();
+
+    numlongs = VIS_FAST_LONGS(sv.cm.cache->visrowsize);
+    for (i = 0; i < numlongs; i++) {
+        bits = mask->l[i] & sv_mcast.occupied.l[i];
+        for (j = 0; bits; j++, bits >>= 1)
+            if (bits & 1)
+                multicast_bucket(i * sizeof(size_t) * 8 + j, leaf1, flags);
+    }
+}
+
 /*
 =================
 SV_Multicast
@@ -256,7 +433,8 @@ MULTICAST_PHS    send to clients potentially hearable from org
 void SV_Multicast(const vec3_t origin, multicast_t to)
 {
     client_t        *client;
-    visrow_t        mask;
+    visrow_t        temp;
+    const visrow_t  *mask = NULL;
     const mleaf_t   *leaf1 = NULL;
     int             flags = 0;
 
@@ -281,7 +459,13 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
 
     if (to) {
         leaf1 = CM_PointLeaf(&sv.cm, origin);
-        BSP_ClusterVis(sv.cm.cache, &mask, leaf1->cluster, MULTICAST_PVS - to);
+        mask = BSP_GetClusterVis(sv.cm.cache, &temp, leaf1->cluster, MULTICAST_PVS - to);
+    }
+
+    // use cluster buckets if available
+    if (to && sv_mcast.clients) {
+        multicast_clusters(mask, leaf1, flags);
+        goto done;
     }
 
     // send the data to all relevant clients
@@ -300,13 +484,14 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
                 continue;
             if (leaf2->cluster == -1)
                 continue;
-            if (!Q_IsBitSet(mask.b, leaf2->cluster))
+            if (!Q_IsBitSet(mask->b, leaf2->cluster))
                 continue;
         }
 
         SV_ClientAddMessage(client, flags);
     }
 
+done:
     // add to MVD datagram
     SV_MvdMulticast(leaf1, to, flags & MSG_RELIABLE);
 
@@ -597,6 +782,43 @@ static inline void write_unreliables(client_t *client, unsigned maxsize)
     }
 }
 
+// determine how much space is left for unreliable data
+static unsigned max_datagram_size(const client_t *client)
+{
+    const message_packet_t *msg;
+    unsigned maxsize;
+
+    if (client->netchan.type == NETCHAN_NEW)
+        return MAX_MSGLEN;
+
+    maxsize = client->netchan.maxpacketlen;
+    if (client->netchan.reliable_length) {
+        // there is still unacked reliable message pending
+        maxsize -= client->netchan.reliable_length;
+    } else {
+        // find at least one reliable message to send
+        // and make sure to reserve space for it
+        if (!LIST_EMPTY(&client->msg_reliable_list)) {
+            msg = MSG_FIRST(&client->msg_reliable_list);
+            maxsize -= msg->cursize;
+        }
+    }
+    Q_assert(maxsize <= client->netchan.maxpacketlen);
+
+    return maxsize;
+}
+
+// send over all the relevant entity_state_t and the player_state_t
+static bool write_frame(client_t *client)
+{
+    unsigned maxsize = max_datagram_size(client);
+
+    if (client->protocol == PROTOCOL_VERSION_DEFAULT)
+        return SV_WriteFrameToClient_Default(client, maxsize);
+
+    return SV_WriteFrameToClient_Enhanced(client, maxsize);
+}
+
 /*
 ===============================================================================
 
@@ -710,33 +932,12 @@ static void repack_unreliables(client_t *client, unsigned maxsize)
     }
 }
 
-static void write_datagram_old(client_t *client)
+static void write_datagram_old(client_t *client, bool ret)
 {
-    message_packet_t *msg;
     unsigned maxsize, cursize;
-    bool ret;
 
-    // determine how much space is left for unreliable data
-    maxsize = client->netchan.maxpacketlen;
-    if (client->netchan.reliable_length) {
-        // there is still unacked reliable message pending
-        maxsize -= client->netchan.reliable_length;
-    } else {
-        // find at least one reliable message to send
-        // and make sure to reserve space for it
-        if (!LIST_EMPTY(&client->msg_reliable_list)) {
-            msg = MSG_FIRST(&client->msg_reliable_list);
-            maxsize -= msg->cursize;
-        }
-    }
-    Q_assert(maxsize <= client->netchan.maxpacketlen);
+    maxsize = max_datagram_size(client);
 
-    // send over all the relevant entity_state_t
-    // and the player_state_t
-    if (client->protocol == PROTOCOL_VERSION_DEFAULT)
-        ret = SV_WriteFrameToClient_Default(client, maxsize);
-    else
-        ret = SV_WriteFrameToClient_Enhanced(client, maxsize);
     if (!ret) {
         SV_DPrintf(1, "Frame %d overflowed for %s\n", client->framenum, client->name);
         SZ_Clear(&msg_write);
@@ -800,13 +1001,11 @@ static void add_message_new(client_t *client, const byte *data,
     }
 }
 
-static void write_datagram_new(client_t *client)
+static void write_datagram_new(client_t *client, bool ret)
 {
     int cursize;
 
-    // send over all the relevant entity_state_t
-    // and the player_state_t
-    if (!SV_WriteFrameToClient_Enhanced(client, msg_write.maxsize)) {
+    if (!ret) {
         // should never really happen
         Com_WPrintf("Frame overflowed for %s\n", client->name);
         SZ_Clear(&msg_write);
@@ -847,6 +1046,259 @@ static void write_datagram_new(client_t *client)
 }
 
 
+/*
+===============================================================================
+
+FRAME UPDATES - WORKER THREADS
+
+Building and delta compressing client frames takes most of the server frame
+time with many clients connected. This only touches per-client state, so it
+is optionally done by a pool of worker threads, each one writing into its
+own msg_write. Results are then merged back and transmitted by the main
+thread in client list order, so output doesn't depend on thread scheduling.
+
+The same pool runs jobs for game module through SV_RunParallel.
+
+===============================================================================
+*/
+
+typedef struct {
+    client_t    *client;
+    byte        *data;      // [MAX_MSGLEN]
+    unsigned    cursize;
+    bool        ret;
+} sendjob_t;
+
+static struct {
+    bool            initialized;
+    bool            terminate;
+    int             wanted;
+    int             numthreads;
+    pthread_t       threads[MAX_SEND_WORKERS];
+    pthread_mutex_t lock;
+    pthread_cond_t  work_cond;
+    pthread_cond_t  done_cond;
+    unsigned        generation;
+
+    void            (*func)(void *, int);
+    void            *arg;
+
+    sendjob_t       jobs[MAX_CLIENTS];
+    int             numjobs;
+    int             nextjob;
+    int             numdone;
+} sv_workers;
+
+// 0 on main thread, 1 and up on worker threads
+q_thread_local int  sv_worker_index;
+
+static void run_job(void *arg, int index)
+{
+    sendjob_t *job = &sv_workers.jobs[index];
+
+    SZ_Init(&msg_write, job->data, MAX_MSGLEN, "msg_write");
+    msg_write.allowoverflow = true;
+
+    SV_BuildClientFrame(job->client);
+
+    job->ret = write_frame(job->client);
+    job->cursize = msg_write.cursize;
+}
+
+// must be called with lock held
+static void process_jobs(void)
+{
+    while (sv_workers.nextjob < sv_workers.numjobs) {
+        int index = sv_workers.nextjob++;
+
+        pthread_mutex_unlock(&sv_workers.lock);
+        sv_workers.func(sv_workers.arg, index);
+        pthread_mutex_lock(&sv_workers.lock);
+
+        if (++sv_workers.numdone == sv_workers.numjobs)
+            pthread_cond_signal(&sv_workers.done_cond);
+    }
+}
+
+static void *worker_func(void *arg)
+{
+    unsigned generation;
+
+    sv_worker_index = (intptr_t)arg;
+    Com_TraceThreadName("send worker");
+
+    pthread_mutex_lock(&sv_workers.lock);
+    generation = sv_workers.generation;
+    while (1) {
+        while (sv_workers.generation == generation && !sv_workers.terminate)
+            pthread_cond_wait(&sv_workers.work_cond, &sv_workers.lock);
+        if (sv_workers.terminate)
+            break;
+        generation = sv_workers.generation;
+        process_jobs();
+    }
+    pthread_mutex_unlock(&sv_workers.lock);
+
+    Com_TraceThreadExit();
+    return NULL;
+}
+
+static void stop_workers(void)
+{
+    int i;
+
+    if (!sv_workers.initialized)
+        return;
+
+    pthread_mutex_lock(&sv_workers.lock);
+    sv_workers.terminate = true;
+    pthread_cond_broadcast(&sv_workers.work_cond);
+    pthread_mutex_unlock(&sv_workers.lock);
+
+    for (i = 0; i < sv_workers.numthreads; i++)
+        Q_assert(!pthread_join(sv_workers.threads[i], NULL));
+
+    pthread_mutex_destroy(&sv_workers.lock);
+    pthread_cond_destroy(&sv_workers.work_cond);
+    pthread_cond_destroy(&sv_workers.done_cond);
+
+    sv_workers.initialized = false;
+    sv_workers.terminate = false;
+    sv_workers.numthreads = 0;
+}
+
+static void start_workers(int count)
+{
+    pthread_mutex_init(&sv_workers.lock, NULL);
+    pthread_cond_init(&sv_workers.work_cond, NULL);
+    pthread_cond_init(&sv_workers.done_cond, NULL);
+    sv_workers.initialized = true;
+
+    for (sv_workers.numthreads = 0; sv_workers.numthreads < count; sv_workers.numthreads++) {
+        if (pthread_create(&sv_workers.threads[sv_workers.numthreads], NULL, worker_func,
+                           (void *)(intptr_t)(sv_workers.numthreads + 1))) {
+            Com_EPrintf("Couldn't create send worker thread\n");
+            break;
+        }
+    }
+
+    Com_DPrintf("Started %d send worker threads\n", sv_workers.numthreads);
+}
+
+static int update_workers(void)
+{
+    int count = Cvar_ClampInteger(sv_send_threads, 0, MAX_SEND_WORKERS);
+
+    if (count != sv_workers.wanted) {
+        stop_workers();
+        if (count)
+            start_workers(count);
+        sv_workers.wanted = count;
+    }
+
+    return sv_workers.numthreads;
+}
+
+static bool use_workers(void)
+{
+    if (!update_workers())
+        return false;
+
+    // game module callbacks are not thread safe
+    if (gex && gex->apiversion >= GAME_API_VERSION_EX_ENTITY_VISIBLE &&
+        (gex->EntityVisibleToClient || gex->CustomizeEntityToClient))
+        return false;
+
+#if USE_DEBUG
+    // neither is debugging output
+    if (developer->integer || sv_debug->integer)
+        return false;
+#endif
+
+    return true;
+}
+
+static void add_job(client_t *client)
+{
+    sendjob_t *job = &sv_workers.jobs[sv_workers.numjobs++];
+
+    if (!job->data)
+        job->data = SV_Malloc(MAX_MSGLEN);
+
+    job->client = client;
+}
+
+static void run_jobs(void (*func)(void *, int), void *arg)
+{
+    pthread_mutex_lock(&sv_workers.lock);
+    sv_workers.func = func;
+    sv_workers.arg = arg;
+    sv_workers.nextjob = 0;
+    sv_workers.numdone = 0;
+    sv_workers.generation++;
+    if (sv_workers.numjobs > 1)
+        pthread_cond_broadcast(&sv_workers.work_cond);
+
+    // main thread takes part in processing, too
+    process_jobs();
+
+    while (sv_workers.numdone < sv_workers.numjobs)
+        pthread_cond_wait(&sv_workers.done_cond, &sv_workers.lock);
+    pthread_mutex_unlock(&sv_workers.lock);
+}
+
+/*
+=======================
+SV_NumWorkerThreads
+
+Returns number of threads SV_RunParallel uses, including the main one.
+=======================
+*/
+int SV_NumWorkerThreads(void)
+{
+    return update_workers() + 1;
+}
+
+/*
+=======================
+SV_RunParallel
+
+Calls func(arg, index) for each index in [0, count) on worker threads and
+the main thread. Returns when all calls are done.
+=======================
+*/
+void SV_RunParallel(void (*func)(void *, int), void *arg, int count)
+{
+    int i;
+
+    if (count > 1 && update_workers()) {
+        sv_workers.numjobs = count;
+        run_jobs(func, arg);
+        sv_workers.numjobs = 0;
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        func(arg, i);
+}
+
+/*
+=======================
+SV_ShutdownSendWorkers
+=======================
+*/
+void SV_ShutdownSendWorkers(void)
+{
+    int i;
+
+    stop_workers();
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        Z_Freep(&sv_workers.jobs[i].data);
+
+    sv_workers.wanted = 0;
+}
+
 /*
 ===============================================================================
 
@@ -880,6 +1332,14 @@ static void check_key_sync(const client_t *client)
 }
 #endif
 
+static void write_datagram(client_t *client, bool ret)
+{
+    if (client->netchan.type == NETCHAN_NEW)
+        write_datagram_new(client, ret);
+    else
+        write_datagram_old(client, ret);
+}
+
 /*
 =======================
 SV_SendClientMessages
@@ -891,7 +1351,18 @@ Clients in earlier connection state are handled in SV_SendAsyncPackets.
 void SV_SendClientMessages(void)
 {
     client_t    *client;
-    int         cursize;
+    sendjob_t   *job;
+    bool        threaded;
+    int         i, cursize;
+
+    threaded = use_workers();
+    sv_workers.numjobs = 0;
+
+    SV_BeginFrameVis();
+    SV_BeginEntityCache(threaded ? sv_workers.numthreads : 0);
+
+    // queue outgoing datagrams and send them at once
+    NET_BeginPacketBatch();
 
     // send a message to each connected client
     FOR_EACH_CLIENT(client) {
@@ -926,13 +1397,18 @@ void SV_SendClientMessages(void)
             goto advance;
         }
 
+        // shared visibility data is calculated on main thread
+        SV_CalcClientVis(client);
+
+        // let worker threads build the frame, then send it below
+        if (threaded) {
+            add_job(client);
+            continue;
+        }
+
         // build the new frame and write it
         SV_BuildClientFrame(client);
-
-        if (client->netchan.type == NETCHAN_NEW)
-            write_datagram_new(client);
-        else
-            write_datagram_old(client);
+        write_datagram(client, write_frame(client));
 
 advance:
         // advance for next frame
@@ -942,6 +1418,26 @@ finish:
         // clear all unreliable messages still left
         finish_frame(client);
     }
+
+    if (sv_workers.numjobs) {
+        sizebuf_t saved = msg_write;
+
+        run_jobs(run_job, NULL);
+        msg_write = saved;
+
+        // merge frames back in order
+        for (i = 0, job = sv_workers.jobs; i < sv_workers.numjobs; i++, job++) {
+            client = job->client;
+
+            SZ_Write(&msg_write, job->data, job->cursize);
+            write_datagram(client, job->ret);
+
+            client->framenum++;
+            finish_frame(client);
+        }
+    }
+
+    NET_FlushPacketBatch();
 }
 
 static void write_pending_download(client_t *client)
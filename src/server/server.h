@@ -117,6 +117,7 @@ typedef struct {
 
 typedef struct {
     int         solid32;
+    struct arealist_s   *arealist;  // area node list entity is linked into
 
 #if USE_FPS
 
@@ -258,6 +259,17 @@ typedef struct {
     unsigned    cost;
 } ratelimit_t;
 
+// per-frame client visibility, see SV_CalcClientVis
+typedef struct {
+    vec3_t          org;
+    int             area;
+    int             cluster;
+    const visrow_t  *pvs;
+    const visrow_t  *phs;
+    edict_t         **edicts;   // candidate entities
+    int             num_edicts;
+} client_vis_t;
+
 typedef struct client_s {
     list_t          entry;
 
@@ -312,6 +324,7 @@ typedef struct client_s {
     int             framediv;
 #endif
     unsigned        frameflags;
+    client_vis_t    vis;
 
     // rate dropping
     unsigned        message_size[RATE_MESSAGES];    // used to rate drop normal packets
@@ -390,6 +403,22 @@ typedef struct client_s {
 // getting kicked off by the server operator
 // a program error, like an overflowed reliable buffer
 
+// parameters of `connect' command
+typedef struct {
+    int         protocol;   // major version
+    int         version;    // minor version
+    int         qport;
+    int         challenge;
+
+    int         maxlength;
+    int         nctype;
+    bool        has_zlib;
+
+    int         maxclients; // hidden client slots
+    char        reconnect_var[16];
+    char        reconnect_val[16];
+} conn_params_t;
+
 //=============================================================================
 
 // MAX_CHALLENGES is made large to prevent a denial
@@ -537,6 +566,8 @@ extern cvar_t       *sv_max_download_size;
 extern cvar_t       *sv_max_packet_entities;
 extern cvar_t       *sv_trunc_packet_entities;
 extern cvar_t       *sv_prioritize_entities;
+extern cvar_t       *sv_send_threads;
+extern cvar_t       *sv_delta_cache;
 
 extern cvar_t       *sv_strafejump_hack;
 #if USE_PACKETDUP
@@ -596,6 +627,11 @@ void SV_zfree(voidpf opaque, voidpf address);
 void sv_sec_timeout_changed(cvar_t *self);
 void sv_min_timeout_changed(cvar_t *self);
 
+#if USE_REPLAY
+bool SV_ReplayConnect(client_t *newcl, const conn_params_t *params, char *userinfo);
+unsigned SV_ReplayFrame(void);
+#endif
+
 //
 // sv_init.c
 //
@@ -626,6 +662,10 @@ void SV_SendClientMessages(void);
 void SV_SendAsyncPackets(void);
 
 void SV_Multicast(const vec3_t origin, multicast_t to);
+void SV_InitMulticast(void);
+void SV_FreeMulticast(void);
+void SV_UpdateMulticastClient(int clientnum, const vec3_t origin);
+void SV_UpdateMulticastClients(void);
 void SV_ClientPrintf(client_t *cl, int level, const char *fmt, ...) q_printf(3, 4);
 void SV_BroadcastPrintf(int level, const char *fmt, ...) q_printf(2, 3);
 void SV_ClientCommand(client_t *cl, const char *fmt, ...) q_printf(2, 3);
@@ -633,6 +673,74 @@ void SV_BroadcastCommand(const char *fmt, ...) q_printf(1, 2);
 void SV_ClientAddMessage(client_t *client, int flags);
 void SV_ShutdownClientSend(client_t *client);
 void SV_InitClientSend(client_t *newcl);
+void SV_ShutdownSendWorkers(void);
+int SV_NumWorkerThreads(void);
+void SV_RunParallel(void (*func)(void *, int), void *arg, int count);
+
+#define MAX_SEND_WORKERS    32
+
+extern q_thread_local int   sv_worker_index;
+
+//
+// scratch.c
+//
+void *SV_ScratchAlloc(size_t size);
+size_t SV_ScratchMark(void);
+void SV_ScratchRelease(size_t mark);
+void SV_ResetScratch(void);
+void SV_FreeScratch(void);
+void SV_ScratchStats_f(void);
+
+//
+// profile.c
+//
+typedef enum {
+    PROF_COMMANDS,
+    PROF_LOADGEN,
+    PROF_MVD_CLIENT,
+    PROF_PACKETS,
+    PROF_ANTICHEAT,
+    PROF_MVD_SERVER,
+    PROF_ASYNC,
+    PROF_CHECKS,
+    PROF_GAME,
+    PROF_SEND,
+    PROF_HEARTBEAT,
+    PROF_PREP,
+    PROF_FRAME,     // sum of all stages
+
+    PROF_NUM_STAGES
+} profstage_t;
+
+void SV_ProfileBegin(void);
+void SV_ProfileMark(profstage_t stage);
+void SV_ProfileEndFrame(void);
+void SV_FrameStats_f(void);
+
+//
+// loadgen.c
+//
+#if USE_LOADGEN
+void LG_Init(void);
+unsigned LG_Frame(void);
+#endif
+
+//
+// replay.c
+//
+#if USE_REPLAY
+void SV_RegisterReplay(void);
+void SV_ReplaySpawn(void);
+void SV_ReplayShutdown(void);
+unsigned SV_StateChecksum(void);
+void SV_RecordConnect(const client_t *cl, const conn_params_t *params, const char *userinfo);
+void SV_RecordUserinfo(const client_t *cl);
+void SV_RecordStringCmd(const client_t *cl, const char *s);
+void SV_RecordMove(const client_t *cl, const usercmd_t *cmd);
+void SV_RecordDrop(const client_t *cl);
+void SV_RecordPing(const client_t *cl);
+void SV_RecordFrame(void);
+#endif
 
 //
 // sv_mvd.c
@@ -724,6 +832,9 @@ void AC_Info_f(void);
 void SV_New_f(void);
 void SV_Begin_f(void);
 void SV_ExecuteClientMessage(client_t *cl);
+void SV_ExecuteUserCommand(const char *s);
+void SV_ClientThink(usercmd_t *cmd);
+void SV_UpdateUserinfo(void);
 void SV_CloseDownload(client_t *client);
 #if USE_FPS
 void SV_AlignKeyFrames(client_t *client);
@@ -762,6 +873,12 @@ static inline void SV_CheckEntityNumber(edict_t *ent, int e, const char *func)
 
 #define SV_CheckEntityNumber(ent, e) SV_CheckEntityNumber(ent, e, __func__)
 
+void SV_BeginEntityCache(int numthreads);
+void SV_FreeEntityCache(void);
+void SV_DeltaStats_f(void);
+void SV_BeginFrameVis(void);
+void SV_CalcClientVis(client_t *client);
+void SV_FreeFrameVis(void);
 void SV_BuildClientFrame(client_t *client);
 bool SV_WriteFrameToClient_Default(client_t *client, unsigned maxsize);
 bool SV_WriteFrameToClient_Enhanced(client_t *client, unsigned maxsize);
@@ -842,6 +959,8 @@ static inline void SV_SetClient_Ping(const client_t *client, int ping)
 void SV_ClearWorld(void);
 // called after the world model has been loaded, before linking any entities
 
+void SV_AreaStats_f(void);
+
 void PF_UnlinkEdict(edict_t *ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -887,3 +1006,9 @@ trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
 trace_t q_gameabi SV_Clip(const vec3_t start, const vec3_t mins,
                           const vec3_t maxs, const vec3_t end,
                           edict_t *clip, int contentmask);
+
+void SV_ClipToEntities(trace_t *trace, const vec3_t start, const vec3_t mins,
+                       const vec3_t maxs, const vec3_t end,
+                       edict_t *passedict, int contentmask);
+// completes a world only trace obtained with SV_Clip(), giving the same
+// result as SV_Trace() would
@@ -1056,12 +1056,16 @@ static void handle_filtercmd(const filtercmd_t *filter)
 SV_ExecuteUserCommand
 ==================
 */
-static void SV_ExecuteUserCommand(const char *s)
+void SV_ExecuteUserCommand(const char *s)
 {
     const ucmd_t *u;
     filtercmd_t *filter;
     char *c;
 
+#if USE_REPLAY
+    SV_RecordStringCmd(sv_client, s);
+#endif
+
     Cmd_TokenizeString(s, false);
     sv_player = sv_client->edict;
 
@@ -1116,10 +1120,14 @@ static int      userinfoUpdateCount;
 SV_ClientThink
 ==================
 */
-static inline void SV_ClientThink(usercmd_t *cmd)
+void SV_ClientThink(usercmd_t *cmd)
 {
     usercmd_t *old = &sv_client->lastcmd;
 
+#if USE_REPLAY
+    SV_RecordMove(sv_client, cmd);
+#endif
+
     sv_client->command_msec -= cmd->msec;
     sv_client->cmd_msec_used += cmd->msec;
     sv_client->num_moves++;
@@ -1384,10 +1392,14 @@ SV_UpdateUserinfo
 Ensures that userinfo is valid and name is properly set.
 =================
 */
-static void SV_UpdateUserinfo(void)
+void SV_UpdateUserinfo(void)
 {
     char *s;
 
+#if USE_REPLAY
+    SV_RecordUserinfo(sv_client);
+#endif
+
     if (!sv_client->userinfo[0]) {
         SV_DropClient(sv_client, "empty userinfo");
         return;
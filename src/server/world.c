@@ -28,16 +28,30 @@ FIXME: this use of "area" is different from the bsp file use
 ===============================================================================
 */
 
+typedef struct arealist_s {
+    list_t  edicts;
+    int     count;
+} arealist_t;
+
 typedef struct areanode_s {
     int     axis;       // -1 = leaf node
     float   dist;
     struct areanode_s   *children[2];
-    list_t  trigger_edicts;
-    list_t  solid_edicts;
+    arealist_t  trigger_edicts;
+    arealist_t  solid_edicts;
+    int     depth;
+    vec3_t  mins, maxs;
 } areanode_t;
 
-#define    AREA_DEPTH    4
-#define    AREA_NODES    32
+// initial tree is subdivided uniformly to at least AREA_MIN_DEPTH, and
+// further while nodes are larger than AREA_MAX_SIZE. leaf nodes are split
+// later when AREA_SPLIT_COUNT edicts get linked into them.
+#define    AREA_MIN_DEPTH       4
+#define    AREA_MAX_DEPTH       10
+#define    AREA_NODES           BIT(AREA_MAX_DEPTH + 1)
+#define    AREA_MAX_SIZE        2048
+#define    AREA_MIN_SIZE        128
+#define    AREA_SPLIT_COUNT     16
 
 static areanode_t   sv_areanodes[AREA_NODES];
 static int          sv_numareanodes;
@@ -47,49 +61,151 @@ static edict_t      **area_list;
 static int          area_count, area_maxcount;
 static int          area_type;
 
+static areanode_t *SV_AllocAreaNode(int depth, const vec3_t mins, const vec3_t maxs)
+{
+    areanode_t  *anode;
+
+    Q_assert(sv_numareanodes < AREA_NODES);
+    anode = &sv_areanodes[sv_numareanodes];
+    sv_numareanodes++;
+
+    List_Init(&anode->trigger_edicts.edicts);
+    List_Init(&anode->solid_edicts.edicts);
+
+    anode->axis = -1;
+    anode->children[0] = anode->children[1] = NULL;
+    anode->depth = depth;
+    VectorCopy(mins, anode->mins);
+    VectorCopy(maxs, anode->maxs);
+
+    return anode;
+}
+
+static float SV_AreaNodeSize(const areanode_t *anode)
+{
+    return max(anode->maxs[0] - anode->mins[0], anode->maxs[1] - anode->mins[1]);
+}
+
+static bool SV_CanSplitAreaNode(const areanode_t *anode)
+{
+    return anode->depth < AREA_MAX_DEPTH && SV_AreaNodeSize(anode) > AREA_MIN_SIZE;
+}
+
 /*
 ===============
-SV_CreateAreaNode
+SV_SplitAreaNode
 
-Builds a uniformly subdivided tree for the given world size
+Turns leaf node into a node with two empty leaf children
 ===============
 */
-static areanode_t *SV_CreateAreaNode(int depth, const vec3_t mins, const vec3_t maxs)
+static void SV_SplitAreaNode(areanode_t *anode)
 {
-    areanode_t  *anode;
     vec3_t      size;
     vec3_t      mins1, maxs1, mins2, maxs2;
 
-    anode = &sv_areanodes[sv_numareanodes];
-    sv_numareanodes++;
-
-    List_Init(&anode->trigger_edicts);
-    List_Init(&anode->solid_edicts);
-
-    if (depth == AREA_DEPTH) {
-        anode->axis = -1;
-        anode->children[0] = anode->children[1] = NULL;
-        return anode;
-    }
-
-    VectorSubtract(maxs, mins, size);
+    VectorSubtract(anode->maxs, anode->mins, size);
     if (size[0] > size[1])
         anode->axis = 0;
     else
         anode->axis = 1;
 
-    anode->dist = 0.5f * (maxs[anode->axis] + mins[anode->axis]);
-    VectorCopy(mins, mins1);
-    VectorCopy(mins, mins2);
-    VectorCopy(maxs, maxs1);
-    VectorCopy(maxs, maxs2);
+    anode->dist = 0.5f * (anode->maxs[anode->axis] + anode->mins[anode->axis]);
+    VectorCopy(anode->mins, mins1);
+    VectorCopy(anode->mins, mins2);
+    VectorCopy(anode->maxs, maxs1);
+    VectorCopy(anode->maxs, maxs2);
 
     maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
 
-    anode->children[0] = SV_CreateAreaNode(depth + 1, mins2, maxs2);
-    anode->children[1] = SV_CreateAreaNode(depth + 1, mins1, maxs1);
+    anode->children[0] = SV_AllocAreaNode(anode->depth + 1, mins2, maxs2);
+    anode->children[1] = SV_AllocAreaNode(anode->depth + 1, mins1, maxs1);
+}
 
-    return anode;
+/*
+===============
+SV_CreateAreaNodes
+
+Builds a subdivided tree for the given world size
+===============
+*/
+static void SV_CreateAreaNodes(areanode_t *anode)
+{
+    if (anode->depth < AREA_MIN_DEPTH || (SV_AreaNodeSize(anode) > AREA_MAX_SIZE &&
+                                          SV_CanSplitAreaNode(anode))) {
+        SV_SplitAreaNode(anode);
+        SV_CreateAreaNodes(anode->children[0]);
+        SV_CreateAreaNodes(anode->children[1]);
+    }
+}
+
+static areanode_t *SV_AreaNodeChild(const areanode_t *node, const edict_t *ent)
+{
+    if (ent->absmin[node->axis] > node->dist)
+        return node->children[0];
+    if (ent->absmax[node->axis] < node->dist)
+        return node->children[1];
+    return NULL;    // crosses the node
+}
+
+static void SV_AddToAreaList(arealist_t *list, edict_t *ent)
+{
+    List_Append(&list->edicts, &ent->area);
+    list->count++;
+    sv.entities[NUM_FOR_EDICT(ent)].arealist = list;
+}
+
+/*
+===============
+SV_PushAreaEdicts
+
+Moves edicts of freshly split node down to children where possible
+===============
+*/
+static void SV_PushAreaEdicts(areanode_t *node, bool trigger)
+{
+    arealist_t  *list = trigger ? &node->trigger_edicts : &node->solid_edicts;
+    edict_t     *ent, *next;
+    areanode_t  *child;
+
+    LIST_FOR_EACH_SAFE(edict_t, ent, next, &list->edicts, area) {
+        child = SV_AreaNodeChild(node, ent);
+        if (!child)
+            continue;
+        List_Remove(&ent->area);
+        list->count--;
+        SV_AddToAreaList(trigger ? &child->trigger_edicts : &child->solid_edicts, ent);
+    }
+}
+
+/*
+===============
+SV_FindAreaNode
+
+Finds the first node that the ent's box crosses, splitting crowded leafs
+===============
+*/
+static areanode_t *SV_FindAreaNode(const edict_t *ent)
+{
+    areanode_t  *node = sv_areanodes;
+    areanode_t  *child;
+
+    while (1) {
+        if (node->axis == -1) {
+            if (node->trigger_edicts.count + node->solid_edicts.count < AREA_SPLIT_COUNT)
+                break;
+            if (!SV_CanSplitAreaNode(node) || sv_numareanodes > AREA_NODES - 2)
+                break;
+            SV_SplitAreaNode(node);
+            SV_PushAreaEdicts(node, true);
+            SV_PushAreaEdicts(node, false);
+        }
+        child = SV_AreaNodeChild(node, ent);
+        if (!child)
+            break;
+        node = child;
+    }
+
+    return node;
 }
 
 /*
@@ -105,14 +221,54 @@ void SV_ClearWorld(void)
 
     if (sv.cm.cache) {
         const mmodel_t *cm = &sv.cm.cache->models[0];
-        SV_CreateAreaNode(0, cm->mins, cm->maxs);
+        SV_CreateAreaNodes(SV_AllocAreaNode(0, cm->mins, cm->maxs));
     }
 
     // make sure all entities are unlinked
     for (int i = 0; i < ge->max_edicts; i++) {
         edict_t *ent = EDICT_NUM(i);
         ent->area.next = ent->area.prev = NULL;
+        sv.entities[i].arealist = NULL;
+    }
+}
+
+/*
+===============
+SV_AreaStats_f
+===============
+*/
+void SV_AreaStats_f(void)
+{
+    const areanode_t *node;
+    int i, leafs = 0, depth = 0, triggers = 0, solids = 0, longest = 0;
+    bool all = Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "all");
+
+    if (!sv_numareanodes) {
+        Com_Printf("No map loaded.\n");
+        return;
+    }
+
+    Com_Printf("node depth axis     dist solid trig\n"
+               "---- ----- ---- -------- ----- ----\n");
+    for (i = 0, node = sv_areanodes; i < sv_numareanodes; i++, node++) {
+        if (node->axis == -1)
+            leafs++;
+        depth = max(depth, node->depth);
+        triggers += node->trigger_edicts.count;
+        solids += node->solid_edicts.count;
+        longest = max(longest, max(node->trigger_edicts.count, node->solid_edicts.count));
+        if (!all && !node->trigger_edicts.count && !node->solid_edicts.count)
+            continue;
+        if (node->axis == -1)
+            Com_Printf("%4d %5d leaf %8s %5d %4d\n", i, node->depth, "",
+                       node->solid_edicts.count, node->trigger_edicts.count);
+        else
+            Com_Printf("%4d %5d %4c %8.1f %5d %4d\n", i, node->depth, "xyz"[node->axis],
+                       node->dist, node->solid_edicts.count, node->trigger_edicts.count);
     }
+
+    Com_Printf("%d nodes (%d leafs), max depth %d\n", sv_numareanodes, leafs, depth);
+    Com_Printf("%d solid edicts, %d triggers, longest list %d\n", solids, triggers, longest);
 }
 
 /*
@@ -125,10 +281,11 @@ Links entity to PVS leafs.
 */
 void SV_LinkEdict(const cm_t *cm, edict_t *ent)
 {
-    const mleaf_t   *leafs[MAX_TOTAL_ENT_LEAFS];
-    int             clusters[MAX_TOTAL_ENT_LEAFS];
+    const mleaf_t   **leafs;
+    int             *clusters;
     int             i, j, area, num_leafs;
     const mnode_t   *topnode;
+    size_t          mark;
 
     // set the size
     VectorSubtract(ent->maxs, ent->mins, ent->size);
@@ -171,9 +328,13 @@ void SV_LinkEdict(const cm_t *cm, edict_t *ent)
     ent->areanum = 0;
     ent->areanum2 = 0;
 
+    mark = SV_ScratchMark();
+    leafs = SV_ScratchAlloc(sizeof(leafs[0]) * MAX_TOTAL_ENT_LEAFS);
+    clusters = SV_ScratchAlloc(sizeof(clusters[0]) * MAX_TOTAL_ENT_LEAFS);
+
     // get all leafs, including solids
     num_leafs = CM_BoxLeafs(cm, ent->absmin, ent->absmax,
-                            leafs, q_countof(leafs), &topnode);
+                            leafs, MAX_TOTAL_ENT_LEAFS, &topnode);
 
     // set areas
     for (i = 0; i < num_leafs; i++) {
@@ -191,7 +352,7 @@ void SV_LinkEdict(const cm_t *cm, edict_t *ent)
         }
     }
 
-    if (num_leafs == q_countof(leafs)) {
+    if (num_leafs == MAX_TOTAL_ENT_LEAFS) {
         // assume we missed some leafs, and mark by headnode
         ent->num_clusters = -1;
         ent->headnode = CM_NumNode(cm, topnode);
@@ -215,16 +376,26 @@ void SV_LinkEdict(const cm_t *cm, edict_t *ent)
             }
         }
     }
+
+    SV_ScratchRelease(mark);
 }
 
 void PF_UnlinkEdict(edict_t *ent)
 {
+    server_entity_t *sent;
+
     if (!ent)
         Com_Error(ERR_DROP, "%s: NULL", __func__);
     if (!ent->area.next)
         return;        // not linked in anywhere
     List_Remove(&ent->area);
     ent->area.next = ent->area.prev = NULL;
+
+    sent = &sv.entities[NUM_FOR_EDICT(ent)];
+    if (sent->arealist) {
+        sent->arealist->count--;
+        sent->arealist = NULL;
+    }
 }
 
 static uint32_t SV_PackSolid32(const edict_t *ent)
@@ -311,6 +482,10 @@ void PF_LinkEdict(edict_t *ent)
 
     SV_LinkEdict(&sv.cm, ent);
 
+    // update leaf cached for multicasts
+    if (entnum <= svs.maxclients)
+        SV_UpdateMulticastClient(entnum - 1, ent->s.origin);
+
     // if first time, make sure old_origin is valid
     if (!ent->linkcount) {
         if (!(ent->s.renderfx & RF_BEAM))
@@ -332,24 +507,14 @@ void PF_LinkEdict(edict_t *ent)
     if (ent->solid == SOLID_NOT)
         return;
 
-// find the first node that the ent's box crosses
-    node = sv_areanodes;
-    while (1) {
-        if (node->axis == -1)
-            break;
-        if (ent->absmin[node->axis] > node->dist)
-            node = node->children[0];
-        else if (ent->absmax[node->axis] < node->dist)
-            node = node->children[1];
-        else
-            break;        // crosses the node
-    }
+    // find the first node that the ent's box crosses
+    node = SV_FindAreaNode(ent);
 
     // link it in
     if (ent->solid == SOLID_TRIGGER)
-        List_Append(&node->trigger_edicts, &ent->area);
+        SV_AddToAreaList(&node->trigger_edicts, ent);
     else
-        List_Append(&node->solid_edicts, &ent->area);
+        SV_AddToAreaList(&node->solid_edicts, ent);
 }
 
 
@@ -366,9 +531,9 @@ static void SV_AreaEdicts_r(areanode_t *node)
 
     // touch linked edicts
     if (area_type == AREA_SOLID)
-        start = &node->solid_edicts;
+        start = &node->solid_edicts.edicts;
     else
-        start = &node->trigger_edicts;
+        start = &node->trigger_edicts.edicts;
 
     LIST_FOR_EACH(edict_t, check, start, area) {
         if (check->solid == SOLID_NOT)
@@ -506,8 +671,9 @@ static void SV_ClipMoveToEntities(trace_t *tr,
 {
     vec3_t      boxmins, boxmaxs;
     int         i, num;
-    edict_t     *touchlist[MAX_EDICTS], *touch;
+    edict_t     **touchlist, *touch;
     trace_t     trace;
+    size_t      mark;
 
     // create the bounding box of the entire move
     for (i = 0; i < 3; i++) {
@@ -520,7 +686,10 @@ static void SV_ClipMoveToEntities(trace_t *tr,
         }
     }
 
-    num = SV_AreaEdicts(boxmins, boxmaxs, touchlist, q_countof(touchlist), AREA_SOLID);
+    mark = SV_ScratchMark();
+    touchlist = SV_ScratchAlloc(sizeof(touchlist[0]) * MAX_EDICTS);
+
+    num = SV_AreaEdicts(boxmins, boxmaxs, touchlist, MAX_EDICTS, AREA_SOLID);
 
     // be careful, it is possible to have an entity in this
     // list removed before we get to it (killtriggered)
@@ -529,7 +698,7 @@ static void SV_ClipMoveToEntities(trace_t *tr,
         if (touch->solid == SOLID_NOT)
             continue;
         if (tr->allsolid)
-            return;
+            break;
         if (passedict) {
             if (touch == passedict)
                 continue;
@@ -560,6 +729,8 @@ static void SV_ClipMoveToEntities(trace_t *tr,
 
         CM_ClipEntity(tr, &trace, touch);
     }
+
+    SV_ScratchRelease(mark);
 }
 
 /*
@@ -592,6 +763,30 @@ trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
     return trace;
 }
 
+/*
+==================
+SV_ClipToEntities
+
+Clips trace previously clipped to world by SV_Clip() to other solid
+entities. This allows expensive world traces to be done ahead of time on
+worker threads.
+==================
+*/
+void SV_ClipToEntities(trace_t *trace, const vec3_t start, const vec3_t mins,
+                       const vec3_t maxs, const vec3_t end,
+                       edict_t *passedict, int contentmask)
+{
+    if (!mins)
+        mins = vec3_origin;
+    if (!maxs)
+        maxs = vec3_origin;
+
+    if (trace->fraction == 0)
+        return;     // blocked by the world
+
+    SV_ClipMoveToEntities(trace, start, end, mins, maxs, passedict, contentmask);
+}
+
 /*
 ==================
 SV_Clip
@@ -42,10 +42,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <SDL.h>
 #endif
 
-#if USE_CLIENT
 #include <pthread.h>
 static pthread_t main_thread;
-#endif
 
 cvar_t  *sys_basedir;
 cvar_t  *sys_libdir;
@@ -71,12 +69,10 @@ void Sys_DebugBreak(void)
     raise(SIGTRAP);
 }
 
-#if USE_CLIENT
 bool Sys_IsMainThread(void)
 {
     return pthread_equal(main_thread, pthread_self());
 }
-#endif
 
 unsigned Sys_Milliseconds(void)
 {
@@ -85,6 +81,59 @@ unsigned Sys_Milliseconds(void)
     return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000U;
+}
+
+int Sys_NumCPUs(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+/*
+=================
+Sys_MapFile
+
+Maps the whole file into memory, either read-only or copy-on-write.
+Returns NULL on failure.
+=================
+*/
+void *Sys_MapFile(const char *path, size_t *len, bool writable)
+{
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        st.st_size <= 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    *len = st.st_size;
+    return data;
+}
+
+void Sys_UnmapFile(void *data, size_t len)
+{
+    munmap(data, len);
+}
+
 /*
 =================
 Sys_Quit
@@ -452,9 +501,7 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-#if USE_CLIENT
     main_thread = pthread_self();
-#endif
 
     Qcommon_Init(argc, argv);
 
@@ -868,6 +868,61 @@ unsigned Sys_Milliseconds(void)
     return tm.QuadPart * 1000ULL / timer_freq.QuadPart;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    LARGE_INTEGER tm;
+    QueryPerformanceCounter(&tm);
+    // split to avoid overflow with high frequency counters
+    return tm.QuadPart / timer_freq.QuadPart * 1000000ULL +
+           tm.QuadPart % timer_freq.QuadPart * 1000000ULL / timer_freq.QuadPart;
+}
+
+int Sys_NumCPUs(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return max(si.dwNumberOfProcessors, 1);
+}
+
+/*
+=================
+Sys_MapFile
+
+Maps the whole file into memory, either read-only or copy-on-write.
+Returns NULL on failure.
+=================
+*/
+void *Sys_MapFile(const char *path, size_t *len, bool writable)
+{
+    LARGE_INTEGER size;
+    HANDLE file, map;
+    void *data = NULL;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                       NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && size.QuadPart <= INT_MAX) {
+        map = CreateFileMappingA(file, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+        if (map) {
+            data = MapViewOfFile(map, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(map);
+        }
+    }
+
+    CloseHandle(file);
+
+    if (data)
+        *len = size.QuadPart;
+    return data;
+}
+
+void Sys_UnmapFile(void *data, size_t len)
+{
+    UnmapViewOfFile(data);
+}
+
 void Sys_AddDefaultConfig(void)
 {
 }